@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "error_stuff.h"
+#include "thread.h"
+#include "dedup.h"
+
+typedef struct
+{
+    uint64_t hash;
+    uint64_t size;
+    char *path; /* NULL for empty slots */
+} dedup_entry;
+
+struct dedup_store
+{
+    pthread_mutex_t lock;
+    dedup_entry *entries; /* open addressing by hash */
+    size_t capacity; /* power of 2 */
+    size_t count;
+    char *store_name;
+
+    int linked;
+    uint64_t bytes_saved;
+};
+
+// slot for a fingerprint, either its entry or the empty slot where it goes
+static dedup_entry *dedup_slot(dedup_store *store, uint64_t hash, uint64_t size)
+{
+    size_t i = hash & (store->capacity - 1);
+
+    while (store->entries[i].path && (store->entries[i].hash != hash || store->entries[i].size != size))
+    {
+        i = (i + 1) & (store->capacity - 1);
+    }
+    return &store->entries[i];
+}
+
+static void dedup_grow(dedup_store *store)
+{
+    dedup_entry *old = store->entries;
+    size_t old_capacity = store->capacity;
+
+    store->capacity = old_capacity ? old_capacity * 2 : 1024;
+    store->entries = calloc(store->capacity, sizeof(dedup_entry));
+    CHECK_ERRNO(!store->entries, "calloc");
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old[i].path)
+        {
+            *dedup_slot(store, old[i].hash, old[i].size) = old[i];
+        }
+    }
+    free(old);
+}
+
+// sets the path for a fingerprint, adding it if new
+static void dedup_set(dedup_store *store, uint64_t hash, uint64_t size, const char *name)
+{
+    dedup_entry *e;
+    char *path;
+
+    /* keep at most 3/4 full so probes stay short */
+    if ((store->count + 1) * 4 > store->capacity * 3)
+    {
+        dedup_grow(store);
+    }
+
+    path = strdup(name);
+    CHECK_ERRNO(!path, "strdup");
+
+    e = dedup_slot(store, hash, size);
+    if (e->path)
+    {
+        free(e->path);
+    }
+    else
+    {
+        store->count++;
+    }
+    e->hash = hash;
+    e->size = size;
+    e->path = path;
+}
+
+dedup_store *dedup_open(const char *store_name)
+{
+    dedup_store *store = calloc(1, sizeof(dedup_store));
+    FILE *infile;
+    char *line;
+
+    CHECK_ERRNO(!store, "calloc");
+    CHECK_ERROR(pthread_mutex_init(&store->lock, NULL) != 0, "mutex init failed");
+    dedup_grow(store);
+
+    if (!store_name)
+    {
+        return store;
+    }
+    store->store_name = strdup(store_name);
+    CHECK_ERRNO(!store->store_name, "strdup");
+
+    /* a missing store is a new one */
+    infile = fopen(store_name, "rb");
+    if (!infile)
+    {
+        return store;
+    }
+
+    line = malloc(0x10000);
+    CHECK_ERRNO(!line, "malloc");
+    while (fgets(line, 0x10000, infile))
+    {
+        uint64_t hash, size;
+        int path_start = 0;
+        size_t len;
+
+        if (sscanf(line, "%" SCNx64 "\t%" SCNu64 "\t%n", &hash, &size, &path_start) != 2 || path_start == 0)
+        {
+            continue;
+        }
+        len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n')
+        {
+            line[--len] = '\0';
+        }
+        if (line[path_start] == '\0')
+        {
+            continue;
+        }
+
+        dedup_set(store, hash, size, line + path_start);
+    }
+    free(line);
+
+    if (ferror(infile))
+    {
+        fclose(infile);
+        dedup_close(store);
+        return NULL;
+    }
+    fclose(infile);
+
+    return store;
+}
+
+int dedup_close(dedup_store *store)
+{
+    int ok = 1;
+
+    if (store->store_name)
+    {
+        /* to a temp file first, so a failed save keeps the old store */
+        size_t name_size = strlen(store->store_name) + 5;
+        char *temp_name = malloc(name_size);
+        FILE *outfile;
+
+        CHECK_ERRNO(!temp_name, "malloc");
+        snprintf(temp_name, name_size, "%s.tmp", store->store_name);
+
+        outfile = fopen(temp_name, "wb");
+        ok = outfile != NULL;
+        for (size_t i = 0; ok && i < store->capacity; i++)
+        {
+            dedup_entry *e = &store->entries[i];
+            if (e->path && fprintf(outfile, "%016" PRIx64 "\t%" PRIu64 "\t%s\n", e->hash, e->size, e->path) < 0)
+            {
+                ok = 0;
+            }
+        }
+        if (outfile && fclose(outfile) != 0)
+        {
+            ok = 0;
+        }
+        if (ok)
+        {
+            remove(store->store_name); /* rename doesn't replace on Windows */
+            ok = rename(temp_name, store->store_name) == 0;
+        }
+        if (!ok)
+        {
+            remove(temp_name);
+        }
+        free(temp_name);
+    }
+
+    for (size_t i = 0; i < store->capacity; i++)
+    {
+        free(store->entries[i].path);
+    }
+    free(store->entries);
+    free(store->store_name);
+    pthread_mutex_destroy(&store->lock);
+    free(store);
+
+    return ok;
+}
+
+int dedup_find(dedup_store *store, uint64_t hash, uint64_t size, const char *name, char *found, size_t found_size)
+{
+    dedup_entry *e;
+    int ret = 0;
+
+    pthread_mutex_lock(&store->lock);
+    e = dedup_slot(store, hash, size);
+    if (e->path && strlen(e->path) < found_size)
+    {
+        strcpy(found, e->path);
+        ret = 1;
+    }
+    else if (!e->path)
+    {
+        dedup_set(store, hash, size, name);
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    return ret;
+}
+
+void dedup_replace(dedup_store *store, uint64_t hash, uint64_t size, const char *name)
+{
+    pthread_mutex_lock(&store->lock);
+    dedup_set(store, hash, size, name);
+    pthread_mutex_unlock(&store->lock);
+}
+
+void dedup_count(dedup_store *store, uint64_t size)
+{
+    pthread_mutex_lock(&store->lock);
+    store->linked++;
+    store->bytes_saved += size;
+    pthread_mutex_unlock(&store->lock);
+}
+
+void dedup_stats(dedup_store *store, int *linked, uint64_t *bytes_saved)
+{
+    pthread_mutex_lock(&store->lock);
+    *linked = store->linked;
+    *bytes_saved = store->bytes_saved;
+    pthread_mutex_unlock(&store->lock);
+}
@@ -0,0 +1,26 @@
+#ifndef _DEDUP_H_INCLUDED
+#define _DEDUP_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// fingerprints (hash + size) of written outputs, to link identical ones instead of copying again;
+// thread-safe, and saved as text lines (hash, size, path) so it persists across runs
+typedef struct dedup_store dedup_store;
+
+// load the store from store_name if it exists (NULL to keep it in memory only), NULL on errors
+dedup_store *dedup_open(const char *store_name);
+// save the store (if it has a name) and free it, returns 0 if saving failed
+int dedup_close(dedup_store *store);
+
+// look for an earlier output with this fingerprint and copy its path to found, returns 1 if any;
+// otherwise remember name as the output for this fingerprint and return 0
+int dedup_find(dedup_store *store, uint64_t hash, uint64_t size, const char *name, char *found, size_t found_size);
+// make name the output for this fingerprint (when the earlier one turned out different or gone)
+void dedup_replace(dedup_store *store, uint64_t hash, uint64_t size, const char *name);
+
+// count an output linked instead of written
+void dedup_count(dedup_store *store, uint64_t size);
+void dedup_stats(dedup_store *store, int *linked, uint64_t *bytes_saved);
+
+#endif /* _DEDUP_H_INCLUDED */
@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifndef __MINGW32__
+#include <regex.h>
+#endif
+
+#include "error_stuff.h"
+#include "filter.h"
+
+typedef struct
+{
+    int first;
+    int last; /* inclusive */
+} filter_range;
+
+struct stream_filter
+{
+    filter_range *ranges;
+    int ranges_count;
+    char **globs;
+    int globs_count;
+#ifndef __MINGW32__
+    regex_t regex;
+#endif
+    int has_regex;
+    uint64_t min_size;
+    uint64_t max_size;
+};
+
+stream_filter *filter_new(void)
+{
+    stream_filter *filter = calloc(1, sizeof(stream_filter));
+    CHECK_ERRNO(!filter, "calloc");
+    filter->max_size = UINT64_MAX;
+    return filter;
+}
+
+void filter_free(stream_filter *filter)
+{
+    if (!filter)
+    {
+        return;
+    }
+    for (int i = 0; i < filter->globs_count; i++)
+    {
+        free(filter->globs[i]);
+    }
+    free(filter->globs);
+    free(filter->ranges);
+#ifndef __MINGW32__
+    if (filter->has_regex)
+    {
+        regfree(&filter->regex);
+    }
+#endif
+    free(filter);
+}
+
+// a stream index, returns the end of the number or NULL if there isn't one
+static const char *parse_index(const char *p, int *index)
+{
+    long value;
+    char *end;
+
+    if (*p < '0' || *p > '9')
+    {
+        return NULL;
+    }
+    value = strtol(p, &end, 10);
+    *index = value > INT_MAX ? INT_MAX : (int)value;
+    return end;
+}
+
+int filter_add_ranges(stream_filter *filter, const char *ranges)
+{
+    const char *p = ranges;
+
+    while (1)
+    {
+        filter_range range;
+        filter_range *grown;
+
+        /* N, N-M, N- or -M */
+        range.first = 0;
+        if (*p != '-' && !(p = parse_index(p, &range.first)))
+        {
+            return 0;
+        }
+        range.last = range.first;
+        if (*p == '-')
+        {
+            p++;
+            range.last = INT_MAX;
+            if (*p != ',' && *p != '\0' && !(p = parse_index(p, &range.last)))
+            {
+                return 0;
+            }
+        }
+        if (range.last < range.first || (*p != ',' && *p != '\0'))
+        {
+            return 0;
+        }
+
+        grown = realloc(filter->ranges, (filter->ranges_count + 1) * sizeof(filter_range));
+        CHECK_ERRNO(!grown, "realloc");
+        filter->ranges = grown;
+        filter->ranges[filter->ranges_count++] = range;
+
+        if (*p == '\0')
+        {
+            return 1;
+        }
+        p++;
+    }
+}
+
+int filter_add_glob(stream_filter *filter, const char *glob)
+{
+    const char *set = strchr(glob, '[');
+    char **grown;
+
+    /* every set must be closed, so matching never runs past the pattern */
+    while (set)
+    {
+        const char *start = set[1] == '!' || set[1] == '^' ? set + 2 : set + 1;
+        const char *close = *start ? strchr(start + 1, ']') : NULL;
+        if (!close)
+        {
+            return 0;
+        }
+        set = strchr(close + 1, '[');
+    }
+
+    grown = realloc(filter->globs, (filter->globs_count + 1) * sizeof(char *));
+    CHECK_ERRNO(!grown, "realloc");
+    filter->globs = grown;
+    filter->globs[filter->globs_count] = strdup(glob);
+    CHECK_ERRNO(!filter->globs[filter->globs_count], "strdup");
+    filter->globs_count++;
+    return 1;
+}
+
+int filter_set_regex(stream_filter *filter, const char *regex)
+{
+#ifdef __MINGW32__
+    return 0;
+#else
+    if (filter->has_regex)
+    {
+        regfree(&filter->regex);
+        filter->has_regex = 0;
+    }
+    if (regcomp(&filter->regex, regex, REG_EXTENDED | REG_NOSUB) != 0)
+    {
+        return 0;
+    }
+    filter->has_regex = 1;
+    return 1;
+#endif
+}
+
+void filter_set_sizes(stream_filter *filter, uint64_t min_size, uint64_t max_size)
+{
+    filter->min_size = min_size;
+    filter->max_size = max_size;
+}
+
+// matches c against a [set] starting after the '[', returns the end of the set or NULL if c isn't in it
+static const char *match_set(const char *p, char c)
+{
+    int negate = *p == '!' || *p == '^';
+    int found = 0;
+
+    if (negate)
+    {
+        p++;
+    }
+    /* a ']' first is part of the set */
+    do
+    {
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0')
+        {
+            found |= c >= p[0] && c <= p[2];
+            p += 3;
+        }
+        else
+        {
+            found |= c == *p;
+            p++;
+        }
+    } while (*p != ']');
+
+    return found != negate ? p + 1 : NULL;
+}
+
+// glob matching with backtracking to the last '*' only, which is enough since a '*' matches anything
+static int match_glob(const char *glob, const char *name)
+{
+    const char *star = NULL, *star_name = NULL;
+
+    while (*name)
+    {
+        const char *next = NULL;
+
+        if (*glob == '*')
+        {
+            star = ++glob;
+            star_name = name;
+            continue;
+        }
+        if (*glob == '?')
+        {
+            next = glob + 1;
+        }
+        else if (*glob == '[')
+        {
+            next = match_set(glob + 1, *name);
+        }
+        else if (*glob == *name)
+        {
+            next = glob + 1;
+        }
+
+        if (next)
+        {
+            glob = next;
+            name++;
+        }
+        else if (star)
+        {
+            glob = star;
+            name = ++star_name;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    while (*glob == '*')
+    {
+        glob++;
+    }
+    return *glob == '\0';
+}
+
+int filter_match(const stream_filter *filter, int index, const char *name, uint64_t size)
+{
+    int i;
+
+    if (size < filter->min_size || size > filter->max_size)
+    {
+        return 0;
+    }
+
+    if (filter->ranges_count)
+    {
+        for (i = 0; i < filter->ranges_count; i++)
+        {
+            if (index >= filter->ranges[i].first && index <= filter->ranges[i].last)
+            {
+                break;
+            }
+        }
+        if (i == filter->ranges_count)
+        {
+            return 0;
+        }
+    }
+
+    if (filter->globs_count)
+    {
+        if (!name)
+        {
+            return 0;
+        }
+        for (i = 0; i < filter->globs_count; i++)
+        {
+            if (match_glob(filter->globs[i], name))
+            {
+                break;
+            }
+        }
+        if (i == filter->globs_count)
+        {
+            return 0;
+        }
+    }
+
+#ifndef __MINGW32__
+    if (filter->has_regex && (!name || regexec(&filter->regex, name, 0, NULL, 0) != 0))
+    {
+        return 0;
+    }
+#endif
+
+    return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef _FILTER_H_INCLUDED
+#define _FILTER_H_INCLUDED
+
+#include <stdint.h>
+
+// which streams to write: index ranges, name globs and a regex, payload size limits;
+// a stream is selected when it passes every kind that was set (any range, any glob)
+typedef struct stream_filter stream_filter;
+
+stream_filter *filter_new(void);
+void filter_free(stream_filter *filter);
+
+// add index ranges like "0-19,40,100-" (0-based, as the Stream NNN numbers), returns 0 on bad syntax
+int filter_add_ranges(stream_filter *filter, const char *ranges);
+// add a glob (* ? [set]) for names, returns 0 on bad syntax
+int filter_add_glob(stream_filter *filter, const char *glob);
+// set an extended regex for names (searched, so anchor it for whole names), returns 0 if it doesn't
+// compile or regexes aren't supported on this platform
+int filter_set_regex(stream_filter *filter, const char *regex);
+void filter_set_sizes(stream_filter *filter, uint64_t min_size, uint64_t max_size);
+
+// 1 if the stream is selected; name may be NULL (no name), which fails any glob or regex
+int filter_match(const stream_filter *filter, int index, const char *name, uint64_t size);
+
+#endif /* _FILTER_H_INCLUDED */
@@ -0,0 +1,275 @@
+#include <string.h>
+
+#include "hash.h"
+#include "thread.h"
+
+/* x86 crc32 instruction, compiled for SSE4.2 but only called if the CPU has it */
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// unaligned little-endian reads (compilers turn these into plain loads)
+static uint64_t read64(const unsigned char *p)
+{
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+           (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t merge_round64(uint64_t acc, uint64_t val)
+{
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+void xxh64_init(xxh64_state *state, uint64_t seed)
+{
+    memset(state, 0, sizeof(xxh64_state));
+    state->seed = seed;
+    state->v[0] = seed + PRIME64_1 + PRIME64_2;
+    state->v[1] = seed + PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME64_1;
+}
+
+void xxh64_update(xxh64_state *state, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + size;
+
+    state->total += size;
+
+    /* top up a partial stripe first */
+    if (state->mem_size + size < 32)
+    {
+        memcpy(state->mem + state->mem_size, p, size);
+        state->mem_size += size;
+        return;
+    }
+    if (state->mem_size)
+    {
+        size_t fill = 32 - state->mem_size;
+        memcpy(state->mem + state->mem_size, p, fill);
+        for (int i = 0; i < 4; i++) state->v[i] = round64(state->v[i], read64(state->mem + i * 8));
+        p += fill;
+        state->mem_size = 0;
+    }
+
+    while (end - p >= 32)
+    {
+        state->v[0] = round64(state->v[0], read64(p + 0));
+        state->v[1] = round64(state->v[1], read64(p + 8));
+        state->v[2] = round64(state->v[2], read64(p + 16));
+        state->v[3] = round64(state->v[3], read64(p + 24));
+        p += 32;
+    }
+
+    if (p < end)
+    {
+        memcpy(state->mem, p, end - p);
+        state->mem_size = end - p;
+    }
+}
+
+uint64_t xxh64_digest(const xxh64_state *state)
+{
+    const unsigned char *p = state->mem;
+    const unsigned char *end = p + state->mem_size;
+    uint64_t h;
+
+    if (state->total >= 32)
+    {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        for (int i = 0; i < 4; i++) h = merge_round64(h, state->v[i]);
+    }
+    else
+    {
+        h = state->seed + PRIME64_5;
+    }
+    h += state->total;
+
+    while (end - p >= 8)
+    {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (end - p >= 4)
+    {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void *data, size_t size, uint64_t seed)
+{
+    xxh64_state state;
+    xxh64_init(&state, seed);
+    xxh64_update(&state, data, size);
+    return xxh64_digest(&state);
+}
+
+#define CRC32C_POLY 0x82F63B78 /* reflected */
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init_table(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        crc32c_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        for (int t = 1; t < 8; t++)
+        {
+            uint32_t crc = crc32c_table[t - 1][i];
+            crc32c_table[t][i] = (crc >> 8) ^ crc32c_table[0][crc & 0xFF];
+        }
+    }
+}
+
+// portable version, 8 bytes per step (slicing-by-8)
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t size)
+{
+    pthread_once(&crc32c_table_once, crc32c_init_table);
+
+    while (size >= 8)
+    {
+        uint32_t lo = crc ^ read32(p);
+        uint32_t hi = read32(p + 4);
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+    {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t size)
+{
+    uint64_t crc64 = crc;
+
+    while (size >= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, read64(p));
+        p += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (size--)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+#ifdef CRC32C_ARM
+static uint32_t crc32c_arm(uint32_t crc, const unsigned char *p, size_t size)
+{
+    while (size >= 8)
+    {
+        crc = __crc32cd(crc, read64(p));
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+    {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size)
+{
+    crc = ~crc;
+#if defined(CRC32C_ARM)
+    crc = crc32c_arm(crc, data, size);
+#else
+#ifdef CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return ~crc32c_sse42(crc, data, size);
+    }
+#endif
+    crc = crc32c_sw(crc, data, size);
+#endif
+    return ~crc;
+}
+
+void checksum_init(checksum_state *sums, int types)
+{
+    memset(sums, 0, sizeof(checksum_state));
+    sums->types = types;
+    if (types & CHECKSUM_XXH64)
+    {
+        xxh64_init(&sums->xxh64, 0);
+    }
+}
+
+void checksum_update(checksum_state *sums, const void *data, size_t size)
+{
+    sums->size += size;
+    if (sums->types & CHECKSUM_CRC32C)
+    {
+        sums->crc32c = crc32c(sums->crc32c, data, size);
+    }
+    if (sums->types & CHECKSUM_XXH64)
+    {
+        xxh64_update(&sums->xxh64, data, size);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef _HASH_H_INCLUDED
+#define _HASH_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// streaming xxHash64, fast and non-cryptographic (for fingerprints, not security)
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char mem[32]; /* bytes waiting for a full stripe */
+    size_t mem_size;
+    uint64_t seed;
+} xxh64_state;
+
+void xxh64_init(xxh64_state *state, uint64_t seed);
+void xxh64_update(xxh64_state *state, const void *data, size_t size);
+uint64_t xxh64_digest(const xxh64_state *state);
+uint64_t xxh64(const void *data, size_t size, uint64_t seed);
+
+// CRC32C (Castagnoli, as in iSCSI/ext4), continuing from crc (0 to start); uses the CPU's
+// crc32 instruction when it has one (SSE4.2 checked at runtime, ARMv8 CRC when built for it)
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+// checksums of some data, updated as it's copied so it doesn't need to be read again
+enum { CHECKSUM_CRC32C = 1, CHECKSUM_XXH64 = 2 };
+typedef struct {
+    int types; /* CHECKSUM_* flags */
+    uint64_t size;
+    uint32_t crc32c;
+    xxh64_state xxh64;
+} checksum_state;
+
+void checksum_init(checksum_state *sums, int types);
+void checksum_update(checksum_state *sums, const void *data, size_t size);
+
+#endif /* _HASH_H_INCLUDED */
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error_stuff.h"
+#include "pool.h"
+#include "thread.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    int *jobs;
+    int head; /* next job for the owner */
+    int tail; /* one past the next job for thieves */
+} pool_queue;
+
+typedef struct {
+    pool_queue *queues;
+    int thread_count;
+    pool_job_fn fn;
+    void *ctx;
+} pool_state;
+
+typedef struct {
+    pool_state *pool;
+    int worker;
+} pool_thread;
+
+static int pool_take(pool_state *pool, int worker, int *job)
+{
+    // own queue first, from the front
+    pool_queue *q = &pool->queues[worker];
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail)
+    {
+        *job = q->jobs[q->head++];
+        pthread_mutex_unlock(&q->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    // then steal the cheapest job left in someone else's queue
+    // (no jobs are added once running, so all queues empty means done)
+    for (int i = 1; i < pool->thread_count; i++)
+    {
+        q = &pool->queues[(worker + i) % pool->thread_count];
+        pthread_mutex_lock(&q->lock);
+        if (q->head < q->tail)
+        {
+            *job = q->jobs[--q->tail];
+            pthread_mutex_unlock(&q->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    return 0;
+}
+
+static void *pool_worker(void *arg)
+{
+    pool_thread *t = arg;
+    int job;
+
+    while (pool_take(t->pool, t->worker, &job))
+    {
+        t->pool->fn(t->pool->ctx, job, t->worker);
+    }
+
+    return NULL;
+}
+
+void pool_run(int thread_count, const int *order, int job_count, pool_job_fn fn, void *ctx)
+{
+    pool_state pool;
+    pool_thread *threads;
+#ifndef __MINGW32__
+    pthread_t *ids;
+#endif
+    int per_queue;
+
+    CHECK_ERROR(thread_count <= 0, "bad thread count");
+
+    per_queue = (job_count + thread_count - 1) / thread_count;
+
+    pool.thread_count = thread_count;
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.queues = calloc(thread_count, sizeof(pool_queue));
+    threads = calloc(thread_count, sizeof(pool_thread));
+    CHECK_ERRNO(!pool.queues || !threads, "calloc");
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        pool_queue *q = &pool.queues[i];
+        CHECK_ERROR(pthread_mutex_init(&q->lock, NULL) != 0, "pthread_mutex_init");
+        q->jobs = malloc((per_queue ? per_queue : 1) * sizeof(int));
+        CHECK_ERRNO(!q->jobs, "malloc");
+    }
+
+    // deal round-robin so every thread starts with some of the first (biggest) jobs
+    for (int i = 0; i < job_count; i++)
+    {
+        pool_queue *q = &pool.queues[i % thread_count];
+        q->jobs[q->tail++] = order[i];
+    }
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        threads[i].pool = &pool;
+        threads[i].worker = i;
+    }
+
+#ifdef __MINGW32__
+    // no threads: worker 0 empties its own queue, then steals all the others
+    pool_worker(&threads[0]);
+#else
+    ids = calloc(thread_count, sizeof(pthread_t));
+    CHECK_ERRNO(!ids, "calloc");
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        CHECK_ERROR(pthread_create(&ids[i], NULL, pool_worker, &threads[i]) != 0, "pthread_create");
+    }
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        CHECK_ERROR(pthread_join(ids[i], NULL) != 0, "pthread_join");
+    }
+    free(ids);
+#endif
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        pthread_mutex_destroy(&pool.queues[i].lock);
+        free(pool.queues[i].jobs);
+    }
+    free(pool.queues);
+    free(threads);
+}
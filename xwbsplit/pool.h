@@ -0,0 +1,13 @@
+#ifndef _POOL_H_INCLUDED
+#define _POOL_H_INCLUDED
+
+// job callback, worker is the thread number (0..thread_count-1) for per-thread state
+typedef void (*pool_job_fn)(void *ctx, int job, int worker);
+
+// run job_count jobs on thread_count threads and wait for all of them (on mingw, all on the calling thread)
+// jobs are dealt round-robin in the given order to per-thread queues, each thread takes
+// from the front of its own queue and steals from the back of the others when empty
+// (so pass the most expensive jobs first)
+void pool_run(int thread_count, const int *order, int job_count, pool_job_fn fn, void *ctx);
+
+#endif /* _POOL_H_INCLUDED */
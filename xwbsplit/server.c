@@ -0,0 +1,1106 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#include "error_stuff.h"
+#include "server.h"
+
+#ifdef __MINGW32__
+
+int server_run(const char *socket_path, size_t cache_size, int overwrite, const xwb_options *opts)
+{
+    return 0;
+}
+
+#else
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define SERVER_CLIENTS  64          /* connections served at once */
+#define SERVER_LINE     0x10000     /* longest request */
+#define SERVER_REPLY    0x1000      /* longest reply line */
+#define SERVER_CHUNK    0x100000    /* extract bytes copied per turn, so other clients are served in between */
+
+// what a file looked like when its bank was loaded, to notice changes
+typedef struct
+{
+    int found; /* 0 if missing (the rest is 0 then) */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime; /* ns */
+} file_key;
+
+// a named stream, for lookups by name
+typedef struct
+{
+    const char *name;
+    int stream;
+} stream_name;
+
+// a parsed bank, in the cache list
+typedef struct cache_entry
+{
+    char *path;
+    char *xsb_path; /* companion .xsb, NULL when names don't come from one */
+    file_key xwb_key;
+    file_key xsb_key; /* an .xsb appearing later is a change too */
+    size_t memory; /* estimated heap use, for the cache budget */
+    xwb_context ctx;
+    stream_name *names; /* sorted by name, then index */
+    int names_count;
+    struct cache_entry *prev; /* more recently used */
+    struct cache_entry *next; /* less recently used */
+} cache_entry;
+
+// a connection; replies are queued and sent as the socket takes them (it's non-blocking), and
+// no more requests are handled until the last reply is out, so one slow reader stalls only itself
+typedef struct
+{
+    int fd; /* -1 when free */
+    char *line; /* request being received */
+    size_t line_used;
+
+    unsigned char *out; /* reply bytes waiting to be sent */
+    size_t out_size;
+    size_t out_used;
+    size_t out_sent;
+    int pass_fd; /* fd to attach to the first byte of out, -1 for none */
+    int data_fd; /* payload sent after out (a dup of the bank's fd, so it outlives the cache), -1 for none */
+    off_t data_offset;
+    uint64_t data_size;
+    int extract_fd; /* file the payload goes to instead, a chunk per turn, -1 for none */
+    uint64_t extract_size; /* for the reply once it's written */
+} server_client;
+
+typedef struct
+{
+    cache_entry *first; /* most recently used */
+    cache_entry *last; /* evicted first */
+    int banks;
+    size_t memory;
+    size_t cache_size;
+    uint64_t hits;
+    uint64_t misses;
+
+    int overwrite;
+    xwb_options opts;
+
+    unsigned char *header; /* split header buffer */
+    size_t header_size;
+    unsigned char *buf; /* copy buffer */
+    char error[512]; /* why the last bank failed to load */
+} server_state;
+
+
+// whole buffer to a blocking fd, returns -1 with errno on failure
+static int write_all(int fd, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, p, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            if (written == 0)
+            {
+                errno = EIO;
+            }
+            return -1;
+        }
+        p += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+// copies up to size bytes at *offset from in_fd to the blocking out_fd (with sendfile when it takes it),
+// returns the bytes copied or -1 with errno (unlike the CLI's copies, which exit)
+static ssize_t copy_chunk(int out_fd, int in_fd, off_t *offset, size_t size, unsigned char *buf)
+{
+    ssize_t bytes_read;
+
+#ifdef __linux__
+    ssize_t sent;
+
+    do
+    {
+        sent = sendfile(out_fd, in_fd, offset, size);
+    } while (sent < 0 && errno == EINTR);
+    if (sent >= 0 || (errno != EINVAL && errno != ENOSYS))
+    {
+        if (sent == 0)
+        {
+            /* bank shrank */
+            errno = EIO;
+            return -1;
+        }
+        return sent;
+    }
+#endif
+
+    if (size > DUMP_BUF)
+    {
+        size = DUMP_BUF;
+    }
+    do
+    {
+        bytes_read = pread(in_fd, buf, size, *offset);
+    } while (bytes_read < 0 && errno == EINTR);
+    if (bytes_read <= 0)
+    {
+        if (bytes_read == 0)
+        {
+            errno = EIO;
+        }
+        return -1;
+    }
+    if (write_all(out_fd, buf, bytes_read) < 0)
+    {
+        return -1;
+    }
+    *offset += bytes_read;
+    return bytes_read;
+}
+
+// add bytes to the client's reply, returns -1 if out of memory
+static int queue_bytes(server_client *client, const void *data, size_t size)
+{
+    if (client->out_size - client->out_used < size)
+    {
+        size_t new_size = client->out_size ? client->out_size : SERVER_REPLY;
+        unsigned char *grown;
+
+        while (new_size - client->out_used < size)
+        {
+            new_size *= 2;
+        }
+        grown = realloc(client->out, new_size);
+        if (!grown)
+        {
+            return -1;
+        }
+        client->out = grown;
+        client->out_size = new_size;
+    }
+
+    memcpy(client->out + client->out_used, data, size);
+    client->out_used += size;
+    return 0;
+}
+
+static int send_reply(server_client *client, const char *format, ...)
+{
+    char reply[SERVER_REPLY];
+    va_list args;
+    int size;
+
+    va_start(args, format);
+    size = vsnprintf(reply, sizeof(reply) - 1, format, args);
+    va_end(args);
+    if (size < 0 || size >= sizeof(reply) - 1)
+    {
+        size = sizeof(reply) - 2;
+    }
+    reply[size++] = '\n';
+
+    return queue_bytes(client, reply, size);
+}
+
+// library messages already start with "ERROR"
+static int send_error(server_client *client, const char *message)
+{
+    if (strncmp(message, "ERROR", 5) == 0)
+    {
+        return send_reply(client, "%s", message);
+    }
+    return send_reply(client, "ERROR: %s", message);
+}
+
+// queued bytes with the fd attached, returns bytes sent or -1
+static ssize_t send_fd(int fd, int passed_fd, const unsigned char *data, size_t size)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+
+    return sendmsg(fd, &msg, 0);
+}
+
+static int output_pending(const server_client *client)
+{
+    return client->out_sent < client->out_used || (client->data_fd >= 0 && client->extract_fd < 0);
+}
+
+// no more requests are handled until the last one is answered
+static int client_busy(const server_client *client)
+{
+    return output_pending(client) || client->extract_fd >= 0;
+}
+
+// sends as much of the reply as the socket takes now;
+// returns 1 when all is sent, 0 if the rest has to wait for POLLOUT, -1 if the client is gone
+static int flush_client(server_client *client)
+{
+    while (output_pending(client))
+    {
+        ssize_t sent;
+
+        if (client->out_sent < client->out_used)
+        {
+            const unsigned char *data = client->out + client->out_sent;
+            size_t size = client->out_used - client->out_sent;
+
+            if (client->pass_fd >= 0)
+            {
+                sent = send_fd(client->fd, client->pass_fd, data, size);
+            }
+            else
+            {
+                sent = write(client->fd, data, size);
+            }
+            if (sent > 0 && client->pass_fd >= 0)
+            {
+                /* the fd went with the first byte */
+                close(client->pass_fd);
+                client->pass_fd = -1;
+            }
+        }
+#ifdef __linux__
+        else
+        {
+            size_t bytes_to_send = client->data_size > 0x40000000 ? 0x40000000 : client->data_size;
+            sent = bytes_to_send ? sendfile(client->fd, client->data_fd, &client->data_offset, bytes_to_send) : 0;
+            if (sent > 0)
+            {
+                client->data_size -= sent;
+                continue;
+            }
+            if (bytes_to_send == 0)
+            {
+                close(client->data_fd);
+                client->data_fd = -1;
+                continue;
+            }
+        }
+#else
+        else
+        {
+            /* the next piece of payload becomes the queued reply */
+            size_t bytes_to_read = client->data_size > DUMP_BUF ? DUMP_BUF : client->data_size;
+
+            client->out_used = 0;
+            client->out_sent = 0;
+            if (bytes_to_read == 0)
+            {
+                close(client->data_fd);
+                client->data_fd = -1;
+                continue;
+            }
+            if (client->out_size < bytes_to_read)
+            {
+                unsigned char *grown = realloc(client->out, bytes_to_read);
+                if (!grown)
+                {
+                    return -1;
+                }
+                client->out = grown;
+                client->out_size = bytes_to_read;
+            }
+            sent = pread(client->data_fd, client->out, bytes_to_read, client->data_offset);
+            if (sent <= 0)
+            {
+                return -1;
+            }
+            client->out_used = sent;
+            client->data_offset += sent;
+            client->data_size -= sent;
+            continue;
+        }
+#endif
+
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+        if (sent <= 0)
+        {
+            return -1;
+        }
+        client->out_sent += sent;
+    }
+
+    client->out_used = 0;
+    client->out_sent = 0;
+    return 1;
+}
+
+static void cache_unlink(server_state *server, cache_entry *e)
+{
+    if (e->prev)
+    {
+        e->prev->next = e->next;
+    }
+    else
+    {
+        server->first = e->next;
+    }
+    if (e->next)
+    {
+        e->next->prev = e->prev;
+    }
+    else
+    {
+        server->last = e->prev;
+    }
+    e->prev = NULL;
+    e->next = NULL;
+}
+
+static void cache_push(server_state *server, cache_entry *e)
+{
+    e->next = server->first;
+    if (server->first)
+    {
+        server->first->prev = e;
+    }
+    server->first = e;
+    if (!server->last)
+    {
+        server->last = e;
+    }
+}
+
+static void cache_free(cache_entry *e)
+{
+    free(e->names);
+    free(e->xsb_path);
+    free(e->path);
+    free(e);
+}
+
+static void cache_remove(server_state *server, cache_entry *e)
+{
+    cache_unlink(server, e);
+    server->banks--;
+    server->memory -= e->memory;
+
+    xwb_close(&e->ctx);
+    cache_free(e);
+}
+
+// drop the least recently used banks until the cache fits, but never the one just used
+static void cache_trim(server_state *server)
+{
+    while (server->memory > server->cache_size && server->last && server->last != server->first)
+    {
+        cache_remove(server, server->last);
+    }
+}
+
+// returns -1 with errno (and found 0) if the file can't be stat'd
+static int get_file_key(const char *path, file_key *key)
+{
+    struct stat st;
+
+    memset(key, 0, sizeof(file_key));
+    if (!path || stat(path, &st) != 0)
+    {
+        return -1;
+    }
+    key->found = 1;
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime = stat_mtime_ns(&st);
+    return 0;
+}
+
+static int same_file_key(const file_key *a, const file_key *b)
+{
+    return a->found == b->found && a->dev == b->dev && a->ino == b->ino && a->size == b->size && a->mtime == b->mtime;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    const stream_name *name_a = a;
+    const stream_name *name_b = b;
+    int ret = strcmp(name_a->name, name_b->name);
+
+    return ret ? ret : name_a->stream - name_b->stream;
+}
+
+// sorted names for find_stream, returns -1 if out of memory
+static int index_names(cache_entry *e)
+{
+    xwb_stream_info info;
+    int i;
+
+    e->names = malloc((e->ctx.xwb.streams_count ? e->ctx.xwb.streams_count : 1) * sizeof(stream_name));
+    if (!e->names)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < e->ctx.xwb.streams_count; i++)
+    {
+        xwb_get_stream(&e->ctx, i, &info, NULL, NULL);
+        if (info.name)
+        {
+            e->names[e->names_count].name = info.name;
+            e->names[e->names_count].stream = i;
+            e->names_count++;
+        }
+    }
+    qsort(e->names, e->names_count, sizeof(stream_name), compare_names);
+    return 0;
+}
+
+static cache_entry *cache_load(server_state *server, const char *path, const file_key *xwb_key)
+{
+    xwb_header *xwb;
+    cache_entry *e;
+    reader *xwb_file;
+    reader *xsb_file = NULL;
+    int ret;
+
+    e = calloc(1, sizeof(cache_entry));
+    if (!e || !(e->path = strdup(path)))
+    {
+        free(e);
+        snprintf(server->error, sizeof(server->error), "out of memory");
+        return NULL;
+    }
+    e->xwb_key = *xwb_key;
+
+    /* companion .xsb, or .xwb names if not found */
+    if (!server->opts.ignore_xsb_name && !server->opts.ignore_xsb_xwb_name)
+    {
+        size_t name_size = strlen(path) + 5;
+        e->xsb_path = malloc(name_size);
+        if (!e->xsb_path)
+        {
+            cache_free(e);
+            snprintf(server->error, sizeof(server->error), "out of memory");
+            return NULL;
+        }
+        strip_ext(e->xsb_path, name_size, path);
+        strcat(e->xsb_path, ".xsb");
+
+        /* before opening it, so a change in between is seen on the next request */
+        get_file_key(e->xsb_path, &e->xsb_key);
+        xsb_file = reader_open(e->xsb_path, 1);
+    }
+
+    xwb_file = reader_open(path, 1);
+    if (!xwb_file)
+    {
+        reader_close(xsb_file);
+        cache_free(e);
+        snprintf(server->error, sizeof(server->error), "failed opening input .xwb");
+        return NULL;
+    }
+
+    ret = xwb_open_readers(&e->ctx, xwb_file, xsb_file, &server->opts);
+    if (ret != XWB_OK)
+    {
+        snprintf(server->error, sizeof(server->error), "%s", xwb_error(&e->ctx));
+        xwb_close(&e->ctx);
+        cache_free(e);
+        return NULL;
+    }
+
+    /* errors show up again when making a stream's header, listing still works */
+    xwb_build_headers(&e->ctx);
+
+    if (index_names(e) < 0)
+    {
+        xwb_close(&e->ctx);
+        cache_free(e);
+        snprintf(server->error, sizeof(server->error), "out of memory");
+        return NULL;
+    }
+
+    xwb = &e->ctx.xwb;
+    e->memory = sizeof(cache_entry) + strlen(path) + 1
+            + (e->xsb_path ? strlen(e->xsb_path) + 1 : 0)
+            + e->names_count * sizeof(stream_name)
+            + xwb->streams_count * sizeof(xwb_stream)
+            + (xwb->xwb_names ? xwb->streams_count * (xwb->name_elem_size + 1) : 0)
+            + xwb->xsb_sounds_count * sizeof(xsb_sound)
+            + xwb->xsb_wavebanks_count * sizeof(xsb_wavebank)
+            + (e->ctx.xsb_file ? reader_size(e->ctx.xsb_file) : 0) /* names table is up to this */
+            + (xwb->header_template ? xwb->header_size : 0);
+
+    /* names are loaded at this point */
+    reader_close(e->ctx.xsb_file);
+    e->ctx.xsb_file = NULL;
+
+    return e;
+}
+
+// parsed bank for a path, reparsed if the .xwb or its .xsb changed since
+static cache_entry *cache_get(server_state *server, const char *path)
+{
+    file_key xwb_key, xsb_key;
+    cache_entry *e;
+
+    if (get_file_key(path, &xwb_key) != 0)
+    {
+        snprintf(server->error, sizeof(server->error), "failed opening input .xwb (%s)", strerror(errno));
+        return NULL;
+    }
+
+    for (e = server->first; e; e = e->next)
+    {
+        if (strcmp(e->path, path) != 0)
+        {
+            continue;
+        }
+
+        get_file_key(e->xsb_path, &xsb_key);
+        if (same_file_key(&e->xwb_key, &xwb_key) && same_file_key(&e->xsb_key, &xsb_key))
+        {
+            server->hits++;
+            if (e != server->first)
+            {
+                cache_unlink(server, e);
+                cache_push(server, e);
+            }
+            return e;
+        }
+
+        cache_remove(server, e);
+        break;
+    }
+
+    server->misses++;
+    e = cache_load(server, path, &xwb_key);
+    if (!e)
+    {
+        return NULL;
+    }
+
+    cache_push(server, e);
+    server->banks++;
+    server->memory += e->memory;
+    cache_trim(server);
+    return e;
+}
+
+// stream index (0=first) or name (the first stream with it), -1 if not found
+static int find_stream(cache_entry *e, const char *text)
+{
+    char *end;
+    long index;
+    int low = 0, high = e->names_count;
+
+    index = strtol(text, &end, 10);
+    if (text[0] != '\0' && *end == '\0')
+    {
+        return index >= 0 && index < e->ctx.xwb.streams_count ? (int)index : -1;
+    }
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (strcmp(e->names[middle].name, text) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low < e->names_count && strcmp(e->names[low].name, text) == 0 ? e->names[low].stream : -1;
+}
+
+// a section of the bank after the queued reply: the bank's fd when it has one, else a copy
+static int queue_data(server_client *client, reader *infile, off_t offset, size_t size, unsigned char *buf)
+{
+    if (offset < 0 || offset > infile->size || size > (uint64_t)(infile->size - offset))
+    {
+        return -1;
+    }
+
+    if (infile->fd >= 0)
+    {
+        client->data_fd = dup(infile->fd);
+        if (client->data_fd < 0)
+        {
+            return -1;
+        }
+        client->data_offset = offset;
+        client->data_size = size;
+        return 0;
+    }
+
+    if (infile->map)
+    {
+        return queue_bytes(client, infile->map + offset, size);
+    }
+
+    while (size > 0)
+    {
+        size_t bytes_to_send = size > DUMP_BUF ? DUMP_BUF : size;
+
+        get_bytes_at(offset, infile, buf, bytes_to_send);
+        if (infile->failed || queue_bytes(client, buf, bytes_to_send) < 0)
+        {
+            return -1;
+        }
+        offset += bytes_to_send;
+        size -= bytes_to_send;
+    }
+
+    return 0;
+}
+
+static int list_streams(server_client *client, xwb_context *ctx)
+{
+    xwb_stream_info info;
+    int i;
+
+    if (send_reply(client, "OK\t%i", (int)ctx->xwb.streams_count) < 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < ctx->xwb.streams_count; i++)
+    {
+        xwb_get_stream(ctx, i, &info, NULL, NULL);
+        if (send_reply(client, "%i\t0x%08"PRIx64"\t%"PRIu64"\t%s",
+                i, (uint64_t)info.offset, (uint64_t)info.size, info.name ? info.name : "") < 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// copies the next chunk of the client's extract, and replies once it's written
+static void extract_step(server_state *server, server_client *client)
+{
+    size_t bytes_to_copy = client->data_size > SERVER_CHUNK ? SERVER_CHUNK : client->data_size;
+    int err = 0;
+
+    if (bytes_to_copy > 0)
+    {
+        ssize_t copied = copy_chunk(client->extract_fd, client->data_fd, &client->data_offset, bytes_to_copy, server->buf);
+        if (copied > 0)
+        {
+            client->data_size -= copied;
+            return;
+        }
+        err = errno;
+    }
+
+    if (close(client->extract_fd) != 0 && err == 0)
+    {
+        err = errno;
+    }
+    close(client->data_fd);
+    client->extract_fd = -1;
+    client->data_fd = -1;
+
+    if (err)
+    {
+        send_reply(client, "ERROR: write failed (%s)", strerror(err));
+    }
+    else
+    {
+        send_reply(client, "OK\t%"PRIu64, client->extract_size);
+    }
+}
+
+// handles one request line, queueing its reply; returns -1 if the client should be dropped
+static int handle_request(server_state *server, server_client *client, char *line)
+{
+    char *fields[4];
+    int fields_count = 0;
+    cache_entry *e;
+    xwb_context *ctx;
+    xwb_stream_info info;
+    int stream;
+
+    if (server->opts.debug)
+    {
+        printf("request: %s\n", line);
+    }
+
+    /* split in place */
+    fields[fields_count++] = line;
+    while (fields_count < 4)
+    {
+        char *tab = strchr(fields[fields_count - 1], '\t');
+        if (!tab)
+        {
+            break;
+        }
+        *tab = '\0';
+        fields[fields_count++] = tab + 1;
+    }
+
+    if (strcmp(fields[0], "stats") == 0)
+    {
+        return send_reply(client, "OK\t%i\t%"PRIu64"\t%"PRIu64"\t%"PRIu64,
+                server->banks, (uint64_t)server->memory, server->hits, server->misses);
+    }
+
+    if (fields_count < 2)
+    {
+        return send_error(client, "unknown request");
+    }
+
+    e = cache_get(server, fields[1]);
+    if (!e)
+    {
+        return send_error(client, server->error);
+    }
+    ctx = &e->ctx;
+
+    if (strcmp(fields[0], "list") == 0)
+    {
+        return list_streams(client, ctx);
+    }
+
+    if (fields_count < 3)
+    {
+        return send_error(client, "unknown request");
+    }
+
+    stream = find_stream(e, fields[2]);
+    if (stream < 0)
+    {
+        return send_error(client, "stream not found");
+    }
+    if (xwb_get_stream(ctx, stream, &info, &server->header, &server->header_size) != XWB_OK)
+    {
+        return send_error(client, xwb_error(ctx));
+    }
+
+    if (strcmp(fields[0], "extract") == 0 && fields_count == 4)
+    {
+        int outfd;
+
+        if (ctx->xwb_file->fd < 0)
+        {
+            return send_error(client, "bank has no fd");
+        }
+        outfd = create_file(fields[3], server->overwrite);
+        if (outfd < 0)
+        {
+            return send_error(client, errno == EEXIST ? "filename exists in path" : "output open failed");
+        }
+
+        client->data_fd = dup(ctx->xwb_file->fd);
+        if (client->data_fd < 0 || write_all(outfd, info.header, info.header_size) < 0)
+        {
+            int err = errno;
+            if (client->data_fd >= 0)
+            {
+                close(client->data_fd);
+                client->data_fd = -1;
+            }
+            close(outfd);
+            return send_reply(client, "ERROR: write failed (%s)", strerror(err));
+        }
+
+        /* the data is copied over the next turns, see extract_step */
+        client->extract_fd = outfd;
+        client->extract_size = info.header_size + info.size;
+        client->data_offset = info.offset;
+        client->data_size = info.size;
+        return 0;
+    }
+
+    if (strcmp(fields[0], "send") == 0)
+    {
+        if (send_reply(client, "OK\t%"PRIu64, (uint64_t)(info.header_size + info.size)) < 0
+                || queue_bytes(client, info.header, info.header_size) < 0)
+        {
+            return -1;
+        }
+        return queue_data(client, ctx->xwb_file, info.offset, info.size, server->buf);
+    }
+
+    if (strcmp(fields[0], "fd") == 0)
+    {
+        if (ctx->xwb_file->fd < 0)
+        {
+            return send_error(client, "bank has no fd");
+        }
+
+        /* a dup, as the bank may leave the cache before the reply is out */
+        client->pass_fd = dup(ctx->xwb_file->fd);
+        if (client->pass_fd < 0)
+        {
+            return -1;
+        }
+        if (send_reply(client, "OK\t%"PRIu64"\t%"PRIu64"\t%"PRIu64,
+                (uint64_t)info.offset, (uint64_t)info.size, (uint64_t)info.header_size) < 0)
+        {
+            return -1;
+        }
+        return queue_bytes(client, info.header, info.header_size);
+    }
+
+    return send_error(client, "unknown request");
+}
+
+static void close_client(server_client *client)
+{
+    close(client->fd);
+    if (client->pass_fd >= 0)
+    {
+        close(client->pass_fd);
+    }
+    if (client->data_fd >= 0)
+    {
+        close(client->data_fd);
+    }
+    if (client->extract_fd >= 0)
+    {
+        close(client->extract_fd);
+    }
+    free(client->line);
+    free(client->out);
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+    client->pass_fd = -1;
+    client->data_fd = -1;
+    client->extract_fd = -1;
+}
+
+// handles the complete lines received, up to the first reply that can't be sent right away
+static int handle_lines(server_state *server, server_client *client)
+{
+    char *end;
+
+    while (!client_busy(client) && (end = memchr(client->line, '\n', client->line_used)) != NULL)
+    {
+        size_t line_size = end + 1 - client->line;
+        int ret;
+
+        *end = '\0';
+        if (end > client->line && end[-1] == '\r')
+        {
+            end[-1] = '\0';
+        }
+
+        ret = handle_request(server, client, client->line);
+        client->line_used -= line_size;
+        memmove(client->line, client->line + line_size, client->line_used);
+        if (ret < 0 || flush_client(client) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (!client_busy(client) && client->line_used == SERVER_LINE)
+    {
+        send_error(client, "request too long");
+        flush_client(client);
+        return -1;
+    }
+
+    return 0;
+}
+
+// continues an extract, or reads what the client sent; then sends pending replies and handles the complete lines
+static void serve_client(server_state *server, server_client *client)
+{
+    if (client->extract_fd >= 0)
+    {
+        extract_step(server, client);
+        if (client->extract_fd >= 0)
+        {
+            return;
+        }
+    }
+    else if (!output_pending(client))
+    {
+        ssize_t bytes_read;
+
+        do
+        {
+            bytes_read = read(client->fd, client->line + client->line_used, SERVER_LINE - client->line_used);
+        } while (bytes_read < 0 && errno == EINTR);
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (bytes_read <= 0)
+        {
+            close_client(client);
+            return;
+        }
+        client->line_used += bytes_read;
+    }
+
+    if (output_pending(client))
+    {
+        int ret = flush_client(client);
+        if (ret <= 0)
+        {
+            if (ret < 0)
+            {
+                close_client(client);
+            }
+            return;
+        }
+    }
+
+    if (handle_lines(server, client) < 0)
+    {
+        close_client(client);
+    }
+}
+
+int server_run(const char *socket_path, size_t cache_size, int overwrite, const xwb_options *opts)
+{
+    server_state server;
+    server_client clients[SERVER_CLIENTS];
+    struct pollfd fds[SERVER_CLIENTS + 1];
+    struct sockaddr_un addr;
+    int listen_fd, i;
+
+    memset(&server, 0, sizeof(server));
+    server.cache_size = cache_size;
+    server.overwrite = overwrite;
+    server.opts = *opts;
+    server.buf = malloc(DUMP_BUF);
+    CHECK_ERRNO(!server.buf, "malloc");
+
+    memset(clients, 0, sizeof(clients));
+    for (i = 0; i < SERVER_CLIENTS; i++)
+    {
+        clients[i].fd = -1;
+        clients[i].pass_fd = -1;
+        clients[i].data_fd = -1;
+        clients[i].extract_fd = -1;
+    }
+
+    /* clients that go away just get dropped */
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    CHECK_ERROR(strlen(socket_path) >= sizeof(addr.sun_path), "socket path too long");
+    strcpy(addr.sun_path, socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_ERRNO(listen_fd < 0, "socket");
+    unlink(socket_path); /* stale socket from a previous run */
+    CHECK_ERRNO(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0, "bind");
+    CHECK_ERRNO(listen(listen_fd, SERVER_CLIENTS) != 0, "listen");
+
+    printf("Listening on %s (cache %"PRIu64" bytes)\n", socket_path, (uint64_t)cache_size);
+    fflush(stdout);
+
+    while (1)
+    {
+        int ready, extracting = 0;
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (i = 0; i < SERVER_CLIENTS; i++)
+        {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = output_pending(&clients[i]) ? POLLOUT : client_busy(&clients[i]) ? 0 : POLLIN;
+            fds[i + 1].revents = 0;
+            extracting |= clients[i].fd >= 0 && clients[i].extract_fd >= 0;
+        }
+
+        /* extracts go on a chunk per turn, so only check for ready clients then */
+        ready = poll(fds, SERVER_CLIENTS + 1, extracting ? 0 : -1);
+        if (ready < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        CHECK_ERRNO(ready < 0, "poll");
+
+        for (i = 0; i < SERVER_CLIENTS; i++)
+        {
+            if (clients[i].fd >= 0 && (fds[i + 1].revents || clients[i].extract_fd >= 0))
+            {
+                serve_client(&server, &clients[i]);
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int client_fd = accept(listen_fd, NULL, NULL);
+            if (client_fd < 0)
+            {
+                continue;
+            }
+
+            for (i = 0; i < SERVER_CLIENTS && clients[i].fd >= 0; i++)
+            {
+            }
+            if (i == SERVER_CLIENTS || fcntl(client_fd, F_SETFL, O_NONBLOCK) != 0
+                    || !(clients[i].line = malloc(SERVER_LINE)))
+            {
+                static const char too_many[] = "ERROR: too many clients\n";
+                ssize_t ignored = write(client_fd, too_many, sizeof(too_many) - 1); /* best effort */
+                (void)ignored;
+                close(client_fd);
+                continue;
+            }
+            clients[i].fd = client_fd;
+        }
+    }
+
+    return 1;
+}
+
+#endif
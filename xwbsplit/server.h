@@ -0,0 +1,25 @@
+#ifndef _SERVER_H_INCLUDED
+#define _SERVER_H_INCLUDED
+
+#include "xwb.h"
+
+// Serves stream requests on a Unix socket until killed, keeping parsed banks in an LRU cache
+// of up to cache_size bytes (keyed by path and the inode, size and mtime of the .xwb and its .xsb,
+// so banks are reparsed when either changes).
+// Each bank uses its companion (bank).xsb for names, or its own names if not found.
+//
+// Requests and replies are lines with tab separated fields; stream is an index (0=first) or a name:
+//   list <bank>                    > OK <count>, then <index> <offset> <size> <name> per stream
+//   extract <bank> <stream> <path> > OK <size>, after writing the split stream to path
+//   send <bank> <stream>           > OK <size>, then the split stream's bytes
+//   fd <bank> <stream>             > OK <offset> <size> <header size> with the bank's fd attached
+//                                    (SCM_RIGHTS), then the header; read the payload with pread
+//   stats                          > OK <banks> <cache bytes> <hits> <misses>
+// Relative paths are from the server's directory. Failed requests (including write errors on
+// extract) get "ERROR: <message>" and the connection stays usable. Requests on a connection are
+// answered in order; a client that reads slowly, or a big extract, only delays its own replies
+// (extracts are copied a chunk at a time between serving the other clients).
+// Returns 0 if not supported on this platform.
+int server_run(const char *socket_path, size_t cache_size, int overwrite, const xwb_options *opts);
+
+#endif /* _SERVER_H_INCLUDED */
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "error_stuff.h"
+#include "util.h"
+#include "stats.h"
+#include "thread.h"
+
+/* stream latencies by powers of 2 of microseconds: bucket 0 is under 1us, bucket i is under 2^i us */
+#define LATENCY_BUCKETS 40
+
+static const char *phase_names[STATS_PHASES] = {
+    "parse_cfg", "parse_xwb", "parse_xsb", "names", "prepare", "output_name", "write",
+};
+
+static const char *io_names[IO_COUNTERS] = {
+    "reads", "writes", "kernel_copies", "seeks", "files_created", "dirs_created",
+};
+
+struct stats
+{
+    pthread_mutex_t lock;
+    stats_timer start; /* of the run */
+
+    uint64_t phase_calls[STATS_PHASES];
+    double phase_wall[STATS_PHASES];
+    double phase_cpu[STATS_PHASES];
+
+    uint64_t streams;
+    double latency_total;
+    double latency_max;
+    uint64_t latency[LATENCY_BUCKETS];
+};
+
+stats *stats_new(void)
+{
+    stats *st = calloc(1, sizeof(stats));
+
+    CHECK_ERRNO(!st, "calloc");
+    CHECK_ERROR(pthread_mutex_init(&st->lock, NULL) != 0, "mutex init failed");
+    get_times(&st->start.wall, &st->start.cpu);
+    io_counting(1);
+    return st;
+}
+
+void stats_free(stats *st)
+{
+    if (!st)
+    {
+        return;
+    }
+    io_counting(0);
+    pthread_mutex_destroy(&st->lock);
+    free(st);
+}
+
+void stats_start(const stats *st, stats_timer *timer)
+{
+    if (!st)
+    {
+        return;
+    }
+    get_times(&timer->wall, &timer->cpu);
+}
+
+void stats_stop(stats *st, int phase, int count, stats_timer *timer)
+{
+    stats_timer now;
+
+    if (!st)
+    {
+        return;
+    }
+    get_times(&now.wall, &now.cpu);
+    stats_add(st, phase, count, now.wall - timer->wall, now.cpu - timer->cpu);
+    *timer = now;
+}
+
+void stats_add(stats *st, int phase, int count, double wall, double cpu)
+{
+    if (!st)
+    {
+        return;
+    }
+    pthread_mutex_lock(&st->lock);
+    st->phase_calls[phase] += count;
+    st->phase_wall[phase] += wall;
+    st->phase_cpu[phase] += cpu;
+    pthread_mutex_unlock(&st->lock);
+}
+
+void stats_stream(stats *st, double seconds)
+{
+    double us = seconds * 1e6;
+    int bucket = 0;
+
+    if (!st)
+    {
+        return;
+    }
+    while (bucket < LATENCY_BUCKETS - 1 && us >= (double)((uint64_t)1 << bucket))
+    {
+        bucket++;
+    }
+
+    pthread_mutex_lock(&st->lock);
+    st->streams++;
+    st->latency_total += seconds;
+    if (seconds > st->latency_max)
+    {
+        st->latency_max = seconds;
+    }
+    st->latency[bucket]++;
+    pthread_mutex_unlock(&st->lock);
+}
+
+void stats_print(stats *st, int json)
+{
+    io_counters io;
+    stats_timer now;
+    double process_cpu, mean;
+    uint64_t peak_rss_kb;
+    int i, last_bucket = -1;
+
+    if (!st)
+    {
+        return;
+    }
+    fflush(stdout);
+
+    get_times(&now.wall, &now.cpu);
+    process_usage(&process_cpu, &peak_rss_kb);
+    io_counters_get(&io);
+
+    pthread_mutex_lock(&st->lock);
+    mean = st->streams ? st->latency_total / st->streams : 0.0;
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        if (st->latency[i])
+        {
+            last_bucket = i;
+        }
+    }
+
+    if (json)
+    {
+        fprintf(stderr, "{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"peak_rss_kb\":%" PRIu64 ",\"phases\":{",
+                (now.wall - st->start.wall) * 1e3, process_cpu * 1e3, peak_rss_kb);
+        for (i = 0; i < STATS_PHASES; i++)
+        {
+            fprintf(stderr, "%s\"%s\":{\"calls\":%" PRIu64 ",\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", i ? "," : "",
+                    phase_names[i], st->phase_calls[i], st->phase_wall[i] * 1e3, st->phase_cpu[i] * 1e3);
+        }
+        fprintf(stderr, "},\"io\":{");
+        for (i = 0; i < IO_COUNTERS; i++)
+        {
+            fprintf(stderr, "%s\"%s\":{\"calls\":%" PRIu64 ",\"bytes\":%" PRIu64 "}", i ? "," : "",
+                    io_names[i], io.calls[i], io.bytes[i]);
+        }
+        fprintf(stderr, "},\"streams\":{\"count\":%" PRIu64 ",\"mean_us\":%.3f,\"max_us\":%.3f,\"latency_us\":[",
+                st->streams, mean * 1e6, st->latency_max * 1e6);
+        for (i = 0; i <= last_bucket; i++)
+        {
+            fprintf(stderr, "%s{\"under\":%" PRIu64 ",\"count\":%" PRIu64 "}", i ? "," : "",
+                    (uint64_t)1 << i, st->latency[i]);
+        }
+        fprintf(stderr, "]}}\n");
+    }
+    else
+    {
+        fprintf(stderr, "Stats: %.3f ms wall, %.3f ms cpu, %" PRIu64 " KB peak RSS\n",
+                (now.wall - st->start.wall) * 1e3, process_cpu * 1e3, peak_rss_kb);
+        fprintf(stderr, "  %-14s %10s %12s %12s\n", "phase", "calls", "wall ms", "cpu ms");
+        for (i = 0; i < STATS_PHASES; i++)
+        {
+            fprintf(stderr, "  %-14s %10" PRIu64 " %12.3f %12.3f\n",
+                    phase_names[i], st->phase_calls[i], st->phase_wall[i] * 1e3, st->phase_cpu[i] * 1e3);
+        }
+        fprintf(stderr, "  %-14s %10s %16s\n", "io", "calls", "bytes");
+        for (i = 0; i < IO_COUNTERS; i++)
+        {
+            fprintf(stderr, "  %-14s %10" PRIu64 " %16" PRIu64 "\n", io_names[i], io.calls[i], io.bytes[i]);
+        }
+        fprintf(stderr, "  streams: %" PRIu64 ", latency mean %.3f us, max %.3f us\n",
+                st->streams, mean * 1e6, st->latency_max * 1e6);
+        for (i = 0; i <= last_bucket; i++)
+        {
+            if (st->latency[i])
+            {
+                fprintf(stderr, "    < %12" PRIu64 " us %10" PRIu64 "\n", (uint64_t)1 << i, st->latency[i]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&st->lock);
+}
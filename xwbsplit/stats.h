@@ -0,0 +1,46 @@
+#ifndef _STATS_H_INCLUDED
+#define _STATS_H_INCLUDED
+
+#include <stdint.h>
+
+// where the time goes; phases done per stream add up the time of every thread
+enum
+{
+    STATS_PARSE_CFG,
+    STATS_PARSE_XWB, /* or loading the index */
+    STATS_PARSE_XSB,
+    STATS_NAMES,     /* resolving xsb/xwb names */
+    STATS_PREPARE,   /* headers and output dirs */
+    STATS_OUTPUT_NAME,
+    STATS_WRITE,     /* everything else done per stream (copies, links, resume checks) */
+    STATS_PHASES
+};
+
+// run stats, thread-safe; every call takes NULL (stats disabled) and does nothing then
+typedef struct stats stats;
+
+typedef struct
+{
+    double wall;
+    double cpu;
+} stats_timer;
+
+// also enables the util.h I/O counters
+stats *stats_new(void);
+void stats_free(stats *st);
+
+// start timing a phase in the calling thread
+void stats_start(const stats *st, stats_timer *timer);
+// add the time since the timer started to a phase (done count more times), and restart the timer for the next one;
+// a single timer can go through interleaved phases this way, counting each only once
+void stats_stop(stats *st, int phase, int count, stats_timer *timer);
+// add time measured elsewhere (in seconds)
+void stats_add(stats *st, int phase, int count, double wall, double cpu);
+
+// count a written stream and how long it took, from getting its name to closing the output
+void stats_stream(stats *st, double seconds);
+
+// print everything so far to stderr, as text or a single JSON object
+void stats_print(stats *st, int json);
+
+#endif /* _STATS_H_INCLUDED */
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "error_stuff.h"
+#include "util.h"
+#include "tar.h"
+
+#define TAR_BLOCK 512
+#define TAR_NAME_SIZE 100
+#define TAR_MAX_SIZE 077777777777ULL /* 11 octal digits */
+
+static const unsigned char zero_block[TAR_BLOCK];
+
+// octal number filling a field, NUL terminated
+static void tar_octal(unsigned char *field, int size, uint64_t value)
+{
+    snprintf((char *)field, size, "%0*" PRIo64, size - 1, value);
+}
+
+static void tar_block(unsigned char *block, const char *name, uint64_t size, int64_t mtime, char type)
+{
+    unsigned int sum = 0;
+    size_t name_len = strlen(name);
+
+    memset(block, 0, TAR_BLOCK);
+    memcpy(block, name, name_len < TAR_NAME_SIZE ? name_len : TAR_NAME_SIZE - 1);
+    tar_octal(block + 100, 8, 0644);
+    tar_octal(block + 108, 8, 0); /* uid */
+    tar_octal(block + 116, 8, 0); /* gid */
+    tar_octal(block + 124, 12, size);
+    tar_octal(block + 136, 12, mtime > 0 ? mtime : 0);
+    block[156] = type;
+    memcpy(block + 257, "ustar", 6);
+    memcpy(block + 263, "00", 2);
+
+    /* checksum of the header with its own field as spaces */
+    memset(block + 148, ' ', 8);
+    for (int i = 0; i < TAR_BLOCK; i++)
+    {
+        sum += block[i];
+    }
+    snprintf((char *)block + 148, 8, "%06o", sum);
+    block[155] = ' ';
+}
+
+void tar_header(int fd, const char *name, uint64_t size, int64_t mtime)
+{
+    unsigned char block[TAR_BLOCK];
+    size_t name_len = strlen(name);
+
+    CHECK_ERROR(size > TAR_MAX_SIZE, "tar member too big");
+
+    if (name_len >= TAR_NAME_SIZE)
+    {
+        /* "(length) path=(name)\n", where the length counts its own digits */
+        size_t base = strlen(" path=\n") + name_len;
+        size_t record_len = base + 1;
+        char *record;
+
+        while (record_len != base + snprintf(NULL, 0, "%zu", record_len))
+        {
+            record_len = base + snprintf(NULL, 0, "%zu", record_len);
+        }
+        record = malloc(record_len + 1);
+        CHECK_ERRNO(!record, "malloc");
+        snprintf(record, record_len + 1, "%zu path=%s\n", record_len, name);
+
+        tar_block(block, "././@PaxHeader", record_len, mtime, 'x');
+        write_bytes(fd, block, TAR_BLOCK);
+        write_bytes(fd, (const unsigned char *)record, record_len);
+        tar_pad(fd, record_len);
+        free(record);
+    }
+
+    /* truncated name for readers without pax */
+    tar_block(block, name, size, mtime, '0');
+    write_bytes(fd, block, TAR_BLOCK);
+}
+
+void tar_pad(int fd, uint64_t size)
+{
+    size_t padding = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+
+    if (padding)
+    {
+        write_bytes(fd, zero_block, padding);
+    }
+}
+
+void tar_end(int fd)
+{
+    write_bytes(fd, zero_block, TAR_BLOCK);
+    write_bytes(fd, zero_block, TAR_BLOCK);
+}
@@ -0,0 +1,13 @@
+#ifndef _TAR_H_INCLUDED
+#define _TAR_H_INCLUDED
+
+#include <stdint.h>
+
+// writing a tar stream front to back (works on pipes): each member is tar_header, then size bytes
+// of data, then tar_pad; tar_end closes the archive. Names longer than ustar allows get a pax
+// extended header, which GNU tar, bsdtar and most libraries read
+void tar_header(int fd, const char *name, uint64_t size, int64_t mtime);
+void tar_pad(int fd, uint64_t size);
+void tar_end(int fd);
+
+#endif /* _TAR_H_INCLUDED */
@@ -0,0 +1,51 @@
+#ifndef _THREAD_H_INCLUDED
+#define _THREAD_H_INCLUDED
+
+// pthreads where available; the mingw32msvc toolchain has none, so there everything runs on
+// the calling thread (pool.c doesn't start threads) and locks are no-ops
+#ifndef __MINGW32__
+#include <pthread.h>
+#else
+
+typedef int pthread_mutex_t;
+typedef int pthread_once_t;
+#define PTHREAD_ONCE_INIT 0
+
+static inline int pthread_mutex_init(pthread_mutex_t *lock, const void *attr)
+{
+    (void)attr;
+    *lock = 0;
+    return 0;
+}
+
+static inline int pthread_mutex_lock(pthread_mutex_t *lock)
+{
+    (void)lock;
+    return 0;
+}
+
+static inline int pthread_mutex_unlock(pthread_mutex_t *lock)
+{
+    (void)lock;
+    return 0;
+}
+
+static inline int pthread_mutex_destroy(pthread_mutex_t *lock)
+{
+    (void)lock;
+    return 0;
+}
+
+static inline int pthread_once(pthread_once_t *once, void (*fn)(void))
+{
+    if (!*once)
+    {
+        *once = 1;
+        fn();
+    }
+    return 0;
+}
+
+#endif
+
+#endif /* _THREAD_H_INCLUDED */
@@ -0,0 +1,439 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "error_stuff.h"
+#include "uring.h"
+
+#ifndef __linux__
+
+int uring_run(int depth, int overwrite, int job_count, uring_prepare_fn prepare, uring_done_fn done, void *ctx, uring_stats *stats)
+{
+    return 0;
+}
+
+#else
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* max bytes per read/write, like dump() */
+#define URING_MAX_IO 0x40000000
+
+enum { SLOT_FREE, SLOT_OPEN, SLOT_READ, SLOT_WRITE, SLOT_CLOSE };
+
+// raw rings (no liburing needed), only this thread submits so the sq tail is kept locally
+typedef struct {
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_tail_local;
+    unsigned to_submit;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+
+// one file in flight, with at most one operation queued at a time
+typedef struct {
+    int state;
+    int job;
+    int fd;
+    uring_job j;
+    size_t header_done;
+    uint64_t data_done;
+    size_t chunk_size; /* data read into buf (when not mmap'd) */
+    size_t chunk_done;
+    struct iovec iov[2];
+} uring_slot;
+
+static int uring_setup(uring *u, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(u, 0, sizeof(uring));
+    memset(&p, 0, sizeof(p));
+    /* over the kernel's max entries setup would fail, this gets the max instead (same 5.6 as the ops) */
+    p.flags = IORING_SETUP_CLAMP;
+
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0)
+    {
+        return 0;
+    }
+
+    u->sq_entries = p.sq_entries;
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_ring_size > u->sq_ring_size) u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED)
+    {
+        close(u->fd);
+        return 0;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        u->cq_ring = u->sq_ring;
+    }
+    else
+    {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED)
+        {
+            munmap(u->sq_ring, u->sq_ring_size);
+            close(u->fd);
+            return 0;
+        }
+    }
+
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        if (u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_size);
+        munmap(u->sq_ring, u->sq_ring_size);
+        close(u->fd);
+        return 0;
+    }
+
+    u->sq_head = (unsigned *)((char *)u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned *)((char *)u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+    u->sq_tail_local = *u->sq_tail;
+
+    return 1;
+}
+
+static void uring_teardown(uring *u)
+{
+    munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_size);
+    munmap(u->sq_ring, u->sq_ring_size);
+    close(u->fd);
+}
+
+/* kernels before 5.6 have rings but not all the ops we need */
+static int uring_supports_ops(uring *u)
+{
+    static const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITEV, IORING_OP_CLOSE };
+    struct io_uring_probe *probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    int supported = probe && syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for (int i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    free(probe);
+    return supported;
+}
+
+static struct io_uring_sqe *uring_get_sqe(uring *u, int slot)
+{
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned index = u->sq_tail_local & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+
+    CHECK_ERROR(u->sq_tail_local - head >= u->sq_entries, "io_uring submission queue full");
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = slot;
+    u->sq_array[index] = index;
+    u->sq_tail_local++;
+    u->to_submit++;
+
+    return sqe;
+}
+
+static void uring_submit_and_wait(uring *u, unsigned wait)
+{
+    __atomic_store_n(u->sq_tail, u->sq_tail_local, __ATOMIC_RELEASE);
+
+    while (1)
+    {
+        int submitted = syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (submitted < 0 && errno == EINTR) continue;
+        CHECK_ERRNO(submitted < 0, "io_uring_enter");
+
+        u->to_submit -= submitted;
+        break;
+    }
+}
+
+static void slot_open(uring *u, uring_slot *s, int slot, int overwrite)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(u, slot);
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)s->j.name;
+    sqe->len = 0644;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_CLOEXEC | (overwrite ? O_TRUNC : O_EXCL);
+    s->state = SLOT_OPEN;
+}
+
+/* queues whatever the file needs next: data read, header/data write or close */
+static void slot_next(uring *u, uring_slot *s, int slot)
+{
+    size_t header_left = s->j.header_size - s->header_done;
+    uint64_t data_left = s->j.size - s->data_done;
+    struct io_uring_sqe *sqe = uring_get_sqe(u, slot);
+
+    if (header_left == 0 && data_left == 0)
+    {
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = s->fd;
+        s->state = SLOT_CLOSE;
+        return;
+    }
+
+    if (!s->j.infile->map && s->chunk_done == s->chunk_size && data_left > 0)
+    {
+        size_t bytes_to_read = s->j.buf_size;
+        if (bytes_to_read > data_left) bytes_to_read = data_left;
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = s->j.infile->fd;
+        sqe->addr = (uintptr_t)s->j.buf;
+        sqe->len = bytes_to_read;
+        sqe->off = s->j.offset + s->data_done;
+        s->state = SLOT_READ;
+        return;
+    }
+
+    /* header goes out with the first data */
+    s->iov[0].iov_base = (void *)(s->j.header + s->header_done);
+    s->iov[0].iov_len = header_left;
+    if (s->j.infile->map)
+    {
+        s->iov[1].iov_base = (void *)(s->j.infile->map + s->j.offset + s->data_done);
+        s->iov[1].iov_len = data_left > URING_MAX_IO ? URING_MAX_IO : data_left;
+    }
+    else
+    {
+        s->iov[1].iov_base = s->j.buf + s->chunk_done;
+        s->iov[1].iov_len = s->chunk_size - s->chunk_done;
+    }
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = s->fd;
+    sqe->addr = (uintptr_t)(header_left ? &s->iov[0] : &s->iov[1]);
+    sqe->len = header_left ? 2 : 1;
+    sqe->off = s->header_done + s->data_done;
+    s->state = SLOT_WRITE;
+}
+
+/* returns 1 if the file is done (or failed) */
+static int slot_complete(uring *u, uring_slot *s, int slot, int overwrite, int res, int *err)
+{
+    if (res == -EINTR || res == -EAGAIN)
+    {
+        if (s->state == SLOT_CLOSE)
+        {
+            *err = 0; /* the fd is gone anyway */
+            return 1;
+        }
+        if (s->state == SLOT_OPEN)
+        {
+            slot_open(u, s, slot, overwrite);
+            return 0;
+        }
+        slot_next(u, s, slot);
+        return 0;
+    }
+
+    if (res < 0)
+    {
+        *err = -res;
+        if (s->state != SLOT_OPEN && s->state != SLOT_CLOSE)
+        {
+            close(s->fd);
+        }
+        return 1;
+    }
+
+    switch (s->state)
+    {
+        case SLOT_OPEN:
+            s->fd = res;
+            io_count(IO_FILES_CREATED, 0);
+            break;
+
+        case SLOT_READ:
+            if (res == 0)
+            {
+                *err = EIO; /* unexpected EOF */
+                close(s->fd);
+                return 1;
+            }
+            io_count(IO_READS, res);
+            s->chunk_size = res;
+            s->chunk_done = 0;
+            break;
+
+        case SLOT_WRITE:
+        {
+            size_t header_written = s->j.header_size - s->header_done;
+            if (header_written > res) header_written = res;
+            io_count(IO_WRITES, res);
+
+            /* summed once written, so partial writes that get requeued aren't counted twice */
+            if (s->j.sums)
+            {
+                const unsigned char *data = s->j.infile->map ? s->j.infile->map + s->j.offset + s->data_done : s->j.buf + s->chunk_done;
+                checksum_update(s->j.sums, s->j.header + s->header_done, header_written);
+                checksum_update(s->j.sums, data, res - header_written);
+            }
+
+            s->header_done += header_written;
+            s->data_done += res - header_written;
+            s->chunk_done += res - header_written;
+            break;
+        }
+
+        case SLOT_CLOSE:
+            *err = 0;
+            return 1;
+    }
+
+    slot_next(u, s, slot);
+    return 0;
+}
+
+// gives the slot the next job that has something to write, returns 0 if there are none left
+static int slot_start(uring *u, uring_slot *s, int slot, int overwrite, int *next_job, int job_count, uring_prepare_fn prepare, uring_done_fn done, void *ctx)
+{
+    while (*next_job < job_count)
+    {
+        memset(s, 0, sizeof(uring_slot));
+        s->job = (*next_job)++;
+        prepare(ctx, s->job, slot, &s->j);
+        if (s->j.skip)
+        {
+            done(ctx, s->job, slot, 0);
+            continue;
+        }
+
+        /* the open is O_TRUNC then, which would rewrite a hardlink shared with other outputs */
+        if (overwrite && unlink_for_overwrite(s->j.name) != 0)
+        {
+            done(ctx, s->job, slot, errno);
+            continue;
+        }
+
+        slot_open(u, s, slot, overwrite);
+        return 1;
+    }
+
+    return 0;
+}
+
+int uring_run(int depth, int overwrite, int job_count, uring_prepare_fn prepare, uring_done_fn done, void *ctx, uring_stats *stats)
+{
+    uring u;
+    uring_slot *slots;
+    int next_job = 0, active = 0, files = 0;
+    uint64_t bytes = 0;
+    struct timespec start, end;
+
+    if (depth < 1) depth = 1;
+
+    if (!uring_setup(&u, depth))
+    {
+        return 0;
+    }
+    if (!uring_supports_ops(&u))
+    {
+        uring_teardown(&u);
+        return 0;
+    }
+    /* one operation per slot is queued at a time, so the ring must have room for all of them */
+    if (depth > (int)u.sq_entries) depth = u.sq_entries;
+
+    slots = calloc(depth, sizeof(uring_slot));
+    CHECK_ERRNO(!slots, "calloc");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < depth; i++)
+    {
+        active += slot_start(&u, &slots[i], i, overwrite, &next_job, job_count, prepare, done, ctx);
+    }
+
+    while (active > 0)
+    {
+        unsigned head, tail;
+
+        uring_submit_and_wait(&u, 1);
+
+        head = *u.cq_head;
+        tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &u.cqes[head & *u.cq_mask];
+            int slot = (int)cqe->user_data;
+            uring_slot *s = &slots[slot];
+            int err = 0;
+
+            if (!slot_complete(&u, s, slot, overwrite, cqe->res, &err))
+            {
+                continue;
+            }
+
+            if (!err)
+            {
+                files++;
+                bytes += s->j.header_size + s->j.size;
+            }
+            done(ctx, s->job, slot, err);
+
+            /* reuse the slot for the next file */
+            active--;
+            active += slot_start(&u, s, slot, overwrite, &next_job, job_count, prepare, done, ctx);
+        }
+        __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (stats)
+    {
+        stats->depth = depth;
+        stats->files = files;
+        stats->bytes = bytes;
+        stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+
+    free(slots);
+    uring_teardown(&u);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _URING_H_INCLUDED
+#define _URING_H_INCLUDED
+
+#include "util.h"
+
+// one output file: header followed by a section of infile
+typedef struct {
+    const char *name;
+    const unsigned char *header;
+    size_t header_size;
+    reader *infile;
+    off_t offset;
+    size_t size;
+    unsigned char *buf; /* scratch space when infile isn't mmap'd */
+    size_t buf_size;
+    checksum_state *sums; /* updated with everything written if not NULL */
+    int skip; /* nothing to write (such as outputs already written when resuming), done is called right away */
+} uring_job;
+
+typedef struct {
+    int depth; /* files in flight, less than asked if that's over the kernel's ring size */
+    int files;
+    uint64_t bytes;
+    double seconds;
+} uring_stats;
+
+// fill a job; slot (0..depth-1) is free until that job is done, so per-slot buffers can be reused
+typedef void (*uring_prepare_fn)(void *ctx, int job, int slot, uring_job *out);
+// job finished (slot is reused after this returns), err is 0 or an errno value (such as EEXIST when not overwriting)
+typedef void (*uring_done_fn)(void *ctx, int job, int slot, int err);
+
+// write job_count files from one thread with io_uring, keeping up to depth files in flight
+// (each file goes open > read/write... > close, data is read and written at explicit offsets)
+// depth is clamped to the kernel's max ring size (stats->depth has the one used)
+// returns 0 without doing anything if io_uring isn't usable (not Linux, old kernel, disabled),
+// so the caller can fall back to normal writes
+int uring_run(int depth, int overwrite, int job_count, uring_prepare_fn prepare, uring_done_fn done, void *ctx, uring_stats *stats);
+
+#endif /* _URING_H_INCLUDED */
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
@@ -5,33 +7,649 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <fcntl.h>
 #ifdef __MINGW32__
 #include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#endif
+#include <time.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE
+#endif
 #endif
 #include <sys/stat.h>
+#include <dirent.h>
+#include <ctype.h>
 
 #include "error_stuff.h"
 #include "util.h"
 
-#define DUMP_BUF 0x80000
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifdef __MINGW32__
+/* reads at offset through the OS handle with OVERLAPPED, so concurrent reads don't race on a seek;
+ * the handle's position still moves (it's a synchronous handle), so nothing may rely on it.
+ * Reads may be short: ReadFile takes a DWORD count and ssize_t is 32-bit here */
+static ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    OVERLAPPED ov;
+    DWORD bytes_read = 0;
+
+    if (count > 0x40000000) count = 0x40000000;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (uint64_t)offset & 0xFFFFFFFF;
+    ov.OffsetHigh = (uint64_t)offset >> 32;
+
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), buf, count, &bytes_read, &ov)) {
+        if (GetLastError() == ERROR_HANDLE_EOF)
+            return 0;
+        errno = EIO;
+        return -1;
+    }
+    return bytes_read;
+}
+#endif
+
+static int dump_method = DUMP_AUTO;
+
+static int io_counting_enabled;
+static io_counters io_totals;
+
+void io_counting(int enable)
+{
+    io_counting_enabled = enable;
+}
+
+void io_count(int counter, uint64_t bytes)
+{
+    if (!io_counting_enabled)
+    {
+        return;
+    }
+    /* from several threads */
+    __sync_fetch_and_add(&io_totals.calls[counter], 1);
+    __sync_fetch_and_add(&io_totals.bytes[counter], bytes);
+}
+
+void io_counters_get(io_counters *counters)
+{
+    for (int i = 0; i < IO_COUNTERS; i++)
+    {
+        counters->calls[i] = __sync_fetch_and_add(&io_totals.calls[i], 0);
+        counters->bytes[i] = __sync_fetch_and_add(&io_totals.bytes[i], 0);
+    }
+}
+
+void get_times(double *wall, double *cpu)
+{
+#ifdef __MINGW32__
+    LARGE_INTEGER counter, frequency;
+    FILETIME creation, exit, kernel, user;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    *wall = (double)counter.QuadPart / frequency.QuadPart;
+
+    *cpu = 0.0;
+    if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    {
+        /* 100ns units */
+        *cpu = (((uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+                ((uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime)) / 1e7;
+    }
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *wall = ts.tv_sec + ts.tv_nsec / 1e9;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    *cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+void process_usage(double *cpu, uint64_t *peak_rss_kb)
+{
+#ifdef __MINGW32__
+    FILETIME creation, exit, kernel, user;
+
+    *cpu = 0.0;
+    *peak_rss_kb = 0;
+    if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    {
+        *cpu = (((uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+                ((uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime)) / 1e7;
+    }
+#else
+    struct rusage usage;
+
+    *cpu = 0.0;
+    *peak_rss_kb = 0;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return;
+    }
+    *cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+    *peak_rss_kb = usage.ru_maxrss / 1024; /* bytes there */
+#else
+    *peak_rss_kb = usage.ru_maxrss;
+#endif
+#endif
+}
+
+void set_dump_method(int method)
+{
+    dump_method = method;
+}
+
+#ifdef __linux__
+/* errors meaning the kernel can't copy between these files (rather than an I/O error) */
+static int is_copy_unsupported(int err)
+{
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == EBADF;
+}
+
+// copy inside the kernel so the data doesn't go through user space, and filesystems
+// that support it (btrfs, xfs, nfs, etc) can share extents instead of copying
+// writes at out_offset, returns 0 if not possible for these files so the caller can fall back
+static int dump_kernel(reader *infile, off_t offset, int out_fd, off_t out_offset, size_t size)
+{
+    size_t done = 0;
+    int method = dump_method;
+#ifndef HAVE_COPY_FILE_RANGE
+    if (method == DUMP_AUTO) method = DUMP_SENDFILE;
+#else
+    if (method == DUMP_AUTO) method = DUMP_COPY_RANGE;
+#endif
+
+    if (method == DUMP_SENDFILE)
+    {
+        CHECK_ERRNO(lseek(out_fd, out_offset, SEEK_SET) < 0, "lseek");
+        io_count(IO_SEEKS, 0);
+    }
+
+    while (done < size)
+    {
+        size_t bytes_to_copy = size - done;
+        off_t in_pos = offset + done;
+        ssize_t bytes_copied;
+
+        if (bytes_to_copy > 0x40000000) bytes_to_copy = 0x40000000;
+
+#ifdef HAVE_COPY_FILE_RANGE
+        if (method == DUMP_COPY_RANGE)
+        {
+            off_t out_pos = out_offset + done;
+            bytes_copied = copy_file_range(infile->fd, &in_pos, out_fd, &out_pos, bytes_to_copy, 0);
+        }
+        else
+#endif
+        {
+            bytes_copied = sendfile(out_fd, infile->fd, &in_pos, bytes_to_copy);
+        }
+
+        if (bytes_copied < 0 && errno == EINTR) continue;
+
+        if (bytes_copied < 0 && done == 0 && dump_method == DUMP_AUTO && is_copy_unsupported(errno))
+        {
+            if (method != DUMP_COPY_RANGE)
+            {
+                return 0;
+            }
+            /* try sendfile before giving up */
+            method = DUMP_SENDFILE;
+            CHECK_ERRNO(lseek(out_fd, out_offset, SEEK_SET) < 0, "lseek");
+            io_count(IO_SEEKS, 0);
+            continue;
+        }
+        CHECK_ERRNO(bytes_copied < 0, method == DUMP_SENDFILE ? "sendfile" : "copy_file_range");
+        CHECK_ERROR(bytes_copied == 0, "unexpected EOF");
+        io_count(IO_KERNEL_COPIES, bytes_copied);
+
+        done += bytes_copied;
+    }
+
+    return 1;
+}
+#endif
+
+/* write both parts with as few calls as possible */
+static void write_pair(int fd, const unsigned char *head, size_t head_size, const unsigned char *data, size_t data_size)
+{
+#ifndef __MINGW32__
+    struct iovec iov[2];
+
+    iov[0].iov_base = (void *)head;
+    iov[0].iov_len = head_size;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = data_size;
+
+    while (iov[0].iov_len + iov[1].iov_len > 0)
+    {
+        ssize_t bytes_written = writev(fd, iov, 2);
+        if (bytes_written < 0 && errno == EINTR) continue;
+        CHECK_ERRNO(bytes_written < 0, "writev");
+        io_count(IO_WRITES, bytes_written);
+
+        /* partial write, skip what's done */
+        for (int i = 0; i < 2; i++)
+        {
+            size_t skip = (size_t)bytes_written < iov[i].iov_len ? (size_t)bytes_written : iov[i].iov_len;
+            iov[i].iov_base = (unsigned char *)iov[i].iov_base + skip;
+            iov[i].iov_len -= skip;
+            bytes_written -= skip;
+        }
+    }
+#else
+    const unsigned char *parts[2] = {head, data};
+    size_t sizes[2] = {head_size, data_size};
+
+    for (int i = 0; i < 2; i++)
+    {
+        while (sizes[i] > 0)
+        {
+            int bytes_written = write(fd, parts[i], sizes[i]);
+            if (bytes_written < 0 && errno == EINTR) continue;
+            CHECK_ERRNO(bytes_written < 0, "write");
+            io_count(IO_WRITES, bytes_written);
+            parts[i] += bytes_written;
+            sizes[i] -= bytes_written;
+        }
+    }
+#endif
+}
+
+void dump_with_header(int outfd, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, unsigned char *buf, size_t buf_size, checksum_state *sums)
+{
+    CHECK_ERROR(offset < 0 || offset > infile->size || size > (uint64_t)(infile->size - offset), "dump out of bounds");
+
+    if (sums)
+    {
+        checksum_update(sums, header, header_size);
+    }
+
+    /* small data (the common case in SFX banks) goes out with the header in one call */
+    if (size <= buf_size || (infile->map && dump_method == DUMP_BUFFERED && !sums))
+    {
+        const unsigned char *data = infile->map ? infile->map + offset : buf;
+        if (!infile->map)
+        {
+            get_bytes_at(offset, infile, buf, size);
+        }
+        if (sums)
+        {
+            checksum_update(sums, data, size);
+        }
+        write_pair(outfd, header, header_size, data, size);
+        return;
+    }
+
+    write_pair(outfd, header, header_size, NULL, 0);
+
+#ifdef __linux__
+    /* kernel copies never pass the data through here, so they can't be checksummed */
+    if (!sums && dump_method != DUMP_BUFFERED && dump_kernel(infile, offset, outfd, header_size, size))
+    {
+        return;
+    }
+
+    /* reserve space for big copies to limit fragmentation, failure is harmless */
+    fallocate(outfd, FALLOC_FL_KEEP_SIZE, header_size, size);
+    CHECK_ERRNO(lseek(outfd, header_size, SEEK_SET) < 0, "lseek");
+    io_count(IO_SEEKS, 0);
+#endif
+
+    if (infile->map && !sums)
+    {
+        write_pair(outfd, infile->map + offset, size, NULL, 0);
+        return;
+    }
+
+    /* when checksumming, each piece is summed right before it's written, while still in cache */
+    while (size > 0)
+    {
+        size_t bytes_to_copy = buf_size;
+        const unsigned char *data = infile->map ? infile->map + offset : buf;
+        if (bytes_to_copy > size) bytes_to_copy = size;
+
+        if (!infile->map)
+        {
+            get_bytes_at(offset, infile, buf, bytes_to_copy);
+        }
+        if (sums)
+        {
+            checksum_update(sums, data, bytes_to_copy);
+        }
+        write_pair(outfd, data, bytes_to_copy, NULL, 0);
+
+        offset += bytes_to_copy;
+        size -= bytes_to_copy;
+    }
+}
+
+void append_with_header(int outfd, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, unsigned char *buf, size_t buf_size)
+{
+    CHECK_ERROR(offset < 0 || offset > infile->size || size > (uint64_t)(infile->size - offset), "dump out of bounds");
+
+    if (infile->map)
+    {
+        write_pair(outfd, header, header_size, infile->map + offset, size);
+        return;
+    }
+
+    /* header goes out with the first piece */
+    while (header_size > 0 || size > 0)
+    {
+        size_t bytes_to_copy = buf_size;
+        if (bytes_to_copy > size) bytes_to_copy = size;
+
+        get_bytes_at(offset, infile, buf, bytes_to_copy);
+        write_pair(outfd, header, header_size, buf, bytes_to_copy);
+        header_size = 0;
+
+        offset += bytes_to_copy;
+        size -= bytes_to_copy;
+    }
+}
+
+void dump_swap16(int outfd, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, unsigned char *buf, size_t buf_size)
+{
+    CHECK_ERROR(offset < 0 || offset > infile->size || size > (uint64_t)(infile->size - offset), "dump out of bounds");
+
+    /* whole samples per piece, so no pair is split between reads */
+    buf_size &= ~(size_t)1;
+
+    /* header goes out with the first piece */
+    while (header_size > 0 || size > 0)
+    {
+        size_t bytes_to_copy = buf_size;
+        if (bytes_to_copy > size) bytes_to_copy = size;
+
+        get_bytes_at(offset, infile, buf, bytes_to_copy);
+        for (size_t i = 0; i + 1 < bytes_to_copy; i += 2)
+        {
+            unsigned char c = buf[i];
+            buf[i] = buf[i + 1];
+            buf[i + 1] = c;
+        }
+        write_pair(outfd, header, header_size, buf, bytes_to_copy);
+        header_size = 0;
+
+        offset += bytes_to_copy;
+        size -= bytes_to_copy;
+    }
+}
+
+int unlink_for_overwrite(const char *name)
+{
+#ifndef __MINGW32__
+    struct stat st;
+
+    /* devices and pipes are written as they are (there's nothing to share) */
+    if (lstat(name, &st) == 0 && S_ISREG(st.st_mode) && unlink(name) != 0 && errno != ENOENT)
+    {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+int create_file(const char *name, int overwrite)
+{
+    int fd;
+
+    if (overwrite && unlink_for_overwrite(name) != 0)
+    {
+        return -1;
+    }
+
+    fd = open(name, O_WRONLY | O_CREAT | O_BINARY | (overwrite ? O_TRUNC : O_EXCL), 0644);
+    if (fd >= 0)
+    {
+        io_count(IO_FILES_CREATED, 0);
+    }
+    return fd;
+}
+
+int take_stdout(void)
+{
+    int fd;
+
+    fflush(stdout);
+    fd = dup(fileno(stdout));
+    if (fd < 0 || dup2(fileno(stderr), fileno(stdout)) < 0)
+    {
+        return -1;
+    }
+#ifdef __MINGW32__
+    setmode(fd, O_BINARY);
+#endif
+    return fd;
+}
+
+int link_file(const char *src, const char *dst, int reflink, int overwrite)
+{
+#ifdef __MINGW32__
+    errno = ENOSYS;
+    return -1;
+#else
+    if (overwrite && unlink(dst) != 0 && errno != ENOENT)
+    {
+        return -1;
+    }
+
+#if defined(__linux__) && defined(FICLONE)
+    if (reflink)
+    {
+        int in_fd, out_fd, cloned;
+
+        in_fd = open(src, O_RDONLY | O_BINARY);
+        if (in_fd < 0)
+        {
+            return -1;
+        }
+        out_fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+        if (out_fd < 0)
+        {
+            int err = errno;
+            close(in_fd);
+            errno = err;
+            return -1;
+        }
+
+        cloned = ioctl(out_fd, FICLONE, in_fd) == 0;
+        close(out_fd);
+        close(in_fd);
+        if (cloned)
+        {
+            io_count(IO_FILES_CREATED, 0);
+            return 0;
+        }
+
+        /* filesystem can't share extents, hardlink instead */
+        unlink(dst);
+    }
+#endif
+
+    if (link(src, dst) != 0)
+    {
+        return -1;
+    }
+    io_count(IO_FILES_CREATED, 0);
+    return 0;
+#endif
+}
+
+int file_matches(const char *name, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, int check_content, unsigned char *buf, size_t buf_size)
+{
+    struct stat st;
+    size_t half = buf_size / 2, pos = 0, total = header_size + size;
+    int fd, same = 1;
+
+    if (stat(name, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size != total)
+    {
+        return 0;
+    }
+    if (!check_content)
+    {
+        return 1;
+    }
+    if (size > 0 && (offset < 0 || offset > infile->size || size > (uint64_t)(infile->size - offset)))
+    {
+        return 0;
+    }
+
+    fd = open(name, O_RDONLY | O_BINARY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    /* file chunks go to the first half of buf, the expected data (when not mmap'd) to the second */
+    while (same && pos < total)
+    {
+        size_t chunk = total - pos > half ? half : total - pos;
+        size_t done = 0;
+
+        if (read_bytes(fd, buf, chunk) != chunk)
+        {
+            same = 0;
+            break;
+        }
+
+        if (pos < header_size)
+        {
+            done = header_size - pos > chunk ? chunk : header_size - pos;
+            same = memcmp(buf, header + pos, done) == 0;
+        }
+        if (same && done < chunk)
+        {
+            off_t data_pos = offset + (pos + done - header_size);
+            const unsigned char *expected = infile->map ? infile->map + data_pos : buf + half;
+            if (!infile->map)
+            {
+                get_bytes_at(data_pos, infile, buf + half, chunk - done);
+            }
+            same = memcmp(buf + done, expected, chunk - done) == 0;
+        }
+
+        pos += chunk;
+    }
+
+    close(fd);
+    return same;
+}
+
+int64_t stat_mtime_ns(const struct stat *st)
+{
+#if defined(__MINGW32__)
+    return (int64_t)st->st_mtime * 1000000000;
+#elif defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
 
-void dump(FILE *infile, FILE *outfile, long offset, size_t size)
+/* like read_bytes, but returns -1 with errno on read errors */
+static ssize_t read_fully(int fd, unsigned char *buf, size_t byte_count)
 {
-    unsigned char buf[DUMP_BUF];
+    size_t done = 0;
 
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    while (done < byte_count)
+    {
+        ssize_t bytes_read = read(fd, buf + done, byte_count - done);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read < 0) return -1;
+        io_count(IO_READS, bytes_read);
+        if (bytes_read == 0) break;
+
+        done += bytes_read;
+    }
+
+    return done;
+}
+
+size_t read_bytes(int fd, unsigned char *buf, size_t byte_count)
+{
+    ssize_t done = read_fully(fd, buf, byte_count);
+    CHECK_ERRNO(done < 0, "read");
+    return done;
+}
+
+void write_bytes(int fd, const unsigned char *buf, size_t byte_count)
+{
+    write_pair(fd, buf, byte_count, NULL, 0);
+}
+
+void close_file(int fd)
+{
+    CHECK_ERRNO(close(fd) != 0, "close");
+}
+
+void dump(reader *infile, FILE *outfile, off_t offset, size_t size, unsigned char *buf, size_t buf_size)
+{
+    CHECK_ERROR(offset < 0 || offset > infile->size || size > (uint64_t)(infile->size - offset), "dump out of bounds");
+
+    if (size == 0)
+    {
+        return;
+    }
+
+#ifdef __linux__
+    if (dump_method != DUMP_BUFFERED)
+    {
+        CHECK_FILE(fflush(outfile) != 0, outfile, "fflush");
+        const off_t out_offset = ftello(outfile);
+        CHECK_ERRNO(out_offset < 0, "ftello");
+
+        if (dump_kernel(infile, offset, fileno(outfile), out_offset, size))
+        {
+            /* the FILE doesn't know the fd moved */
+            CHECK_ERRNO(fseeko(outfile, out_offset + size, SEEK_SET) != 0, "fseeko");
+            io_count(IO_SEEKS, 0);
+            return;
+        }
+    }
+
+    if (size > buf_size)
+    {
+        /* reserve space for big copies to limit fragmentation, failure is harmless */
+        CHECK_FILE(fflush(outfile) != 0, outfile, "fflush");
+        fallocate(fileno(outfile), FALLOC_FL_KEEP_SIZE, ftello(outfile), size);
+    }
+#endif
+
+    if (infile->map)
+    {
+        put_bytes(outfile, infile->map + offset, size);
+        io_count(IO_WRITES, size);
+        return;
+    }
 
     while (size > 0)
     {
-        size_t bytes_to_copy = sizeof(buf);
+        size_t bytes_to_copy = buf_size;
         if (bytes_to_copy > size) bytes_to_copy = size;
 
-        size_t bytes_read = fread(buf, 1, bytes_to_copy, infile);
-        CHECK_FILE(bytes_read != bytes_to_copy, infile, "fread");
+        get_bytes_at(offset, infile, buf, bytes_to_copy);
 
         size_t bytes_written = fwrite(buf, 1, bytes_to_copy, outfile);
         CHECK_FILE(bytes_written != bytes_to_copy, outfile, "fwrite");
+        io_count(IO_WRITES, bytes_written);
 
+        offset += bytes_to_copy;
         size -= bytes_to_copy;
     }
 }
@@ -48,6 +666,12 @@ uint16_t read_16_le(const unsigned char bytes[2])
     for (int i=1; i>=0; i--) result = (result << 8) | bytes[i];
     return result;
 }
+uint64_t read_64_le(const unsigned char bytes[8])
+{
+    uint64_t result = 0;
+    for (int i=7; i>=0; i--) result = (result << 8) | bytes[i];
+    return result;
+}
 uint64_t read_64_be(const unsigned char bytes[8])
 {
     uint64_t result = 0;
@@ -77,6 +701,11 @@ void write_32_le(uint32_t value, unsigned char bytes[4])
     for (int i=0; i<4; i++, value >>= 8) bytes[i] = value & 0xff;
 }
 
+void write_64_le(uint64_t value, unsigned char bytes[8])
+{
+    for (int i=0; i<8; i++, value >>= 8) bytes[i] = value & 0xff;
+}
+
 void write_16_be(uint16_t value, unsigned char bytes[2])
 {
     for (int i=1; i>=0; i--, value >>= 8) bytes[i] = value & 0xff;
@@ -96,9 +725,9 @@ uint8_t get_byte(FILE *infile)
 
     return buf[0];
 }
-uint8_t get_byte_seek(long offset, FILE *infile)
+uint8_t get_byte_seek(off_t offset, FILE *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(infile, offset, SEEK_SET) != 0, "fseeko");
 
     return get_byte(infile);
 }
@@ -111,9 +740,9 @@ uint16_t get_16_be(FILE *infile)
 
     return read_16_be(buf);
 }
-uint16_t get_16_be_seek(long offset, FILE *infile)
+uint16_t get_16_be_seek(off_t offset, FILE *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(infile, offset, SEEK_SET) != 0, "fseeko");
 
     return get_16_be(infile);
 }
@@ -125,9 +754,9 @@ uint16_t get_16_le(FILE *infile)
 
     return read_16_le(buf);
 }
-uint16_t get_16_le_seek(long offset, FILE *infile)
+uint16_t get_16_le_seek(off_t offset, FILE *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(infile, offset, SEEK_SET) != 0, "fseeko");
 
     return get_16_le(infile);
 }
@@ -139,9 +768,9 @@ uint32_t get_32_be(FILE *infile)
 
     return read_32_be(buf);
 }
-uint32_t get_32_be_seek(long offset, FILE *infile)
+uint32_t get_32_be_seek(off_t offset, FILE *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(infile, offset, SEEK_SET) != 0, "fseeko");
 
     return get_32_be(infile);
 }
@@ -153,9 +782,9 @@ uint32_t get_32_le(FILE *infile)
 
     return read_32_le(buf);
 }
-uint32_t get_32_le_seek(long offset, FILE *infile)
+uint32_t get_32_le_seek(off_t offset, FILE *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(infile, offset, SEEK_SET) != 0, "fseeko");
 
     return get_32_le(infile);
 }
@@ -167,9 +796,9 @@ uint64_t get_64_be(FILE *infile)
 
     return read_64_be(buf);
 }
-uint64_t get_64_be_seek(long offset, FILE *infile)
+uint64_t get_64_be_seek(off_t offset, FILE *infile)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(infile, offset, SEEK_SET) != 0, "fseeko");
 
     return get_64_be(infile);
 }
@@ -180,12 +809,268 @@ void get_bytes(FILE *infile, unsigned char *buf, size_t byte_count)
     CHECK_FILE(bytes_read != byte_count, infile, "fread");
 }
 
-void get_bytes_seek(long offset, FILE *infile, unsigned char *buf, size_t byte_count)
+void get_bytes_seek(off_t offset, FILE *infile, unsigned char *buf, size_t byte_count)
 {
-    CHECK_ERRNO(fseek(infile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(infile, offset, SEEK_SET) != 0, "fseeko");
     get_bytes(infile, buf, byte_count);
 }
 
+reader *reader_open(const char *name, int use_mmap)
+{
+    reader *infile;
+    int fd = open(name, O_RDONLY | O_BINARY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    infile = reader_open_fd(fd, use_mmap);
+    if (!infile)
+    {
+        close(fd);
+        return NULL;
+    }
+    infile->keep_fd = 0;
+
+    return infile;
+}
+
+reader *reader_open_fd(int fd, int use_mmap)
+{
+    struct stat st;
+    reader *infile = calloc(1, sizeof(reader));
+    if (!infile)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        free(infile);
+        return NULL;
+    }
+    infile->fd = fd;
+    infile->keep_fd = 1;
+    infile->size = st.st_size;
+
+#ifndef __MINGW32__
+    /* mmap may fail for huge files on 32-bit builds or odd filesystems, pread still works then */
+    if (use_mmap && infile->size > 0 && (uint64_t)infile->size <= SIZE_MAX)
+    {
+        void *map = mmap(NULL, infile->size, PROT_READ, MAP_PRIVATE, infile->fd, 0);
+        if (map != MAP_FAILED)
+        {
+            infile->map = map;
+        }
+    }
+#endif
+
+    return infile;
+}
+
+reader *reader_open_memory(const void *buf, size_t size)
+{
+    reader *infile = calloc(1, sizeof(reader));
+    if (!infile)
+    {
+        return NULL;
+    }
+
+    infile->fd = -1;
+    infile->map = buf;
+    infile->size = size;
+    infile->is_memory = 1;
+    return infile;
+}
+
+reader *reader_open_pipe(int fd)
+{
+    reader *infile = calloc(1, sizeof(reader));
+    if (!infile)
+    {
+        return NULL;
+    }
+
+#ifdef __MINGW32__
+    setmode(fd, O_BINARY);
+#endif
+    infile->fd = fd;
+    infile->is_pipe = 1;
+    return infile;
+}
+
+/* failure that exits, or sets failed for soft readers */
+static int reader_fail(reader *infile, const char *message)
+{
+    CHECK_ERROR(!infile->soft_errors, message);
+    infile->failed = 1;
+    return -1;
+}
+
+int reader_fill(reader *infile, off_t size)
+{
+    uint8_t *buf;
+    ssize_t bytes_read;
+
+    if (!infile->is_pipe)
+    {
+        return reader_fail(infile, "not a pipe");
+    }
+    if (size <= infile->size)
+    {
+        return 0;
+    }
+    if ((uint64_t)size > SIZE_MAX)
+    {
+        return reader_fail(infile, "pipe header too big");
+    }
+
+    buf = realloc(infile->buf, size);
+    if (!buf)
+    {
+        return reader_fail(infile, "out of memory");
+    }
+    infile->buf = buf;
+    infile->map = buf;
+
+    bytes_read = read_fully(infile->fd, buf + infile->size, size - infile->size);
+    if (bytes_read < 0)
+    {
+        return reader_fail(infile, strerror(errno));
+    }
+    if (bytes_read != size - infile->size)
+    {
+        infile->size += bytes_read;
+        return reader_fail(infile, "unexpected EOF");
+    }
+    infile->size = size;
+    return 0;
+}
+
+void reader_close(reader *infile)
+{
+    if (!infile)
+    {
+        return;
+    }
+    if (infile->is_pipe || infile->is_memory)
+    {
+        free(infile->buf);
+        free(infile);
+        return;
+    }
+#ifndef __MINGW32__
+    if (infile->map)
+    {
+        munmap((void *)infile->map, infile->size);
+    }
+#endif
+    if (!infile->keep_fd)
+    {
+        close(infile->fd);
+    }
+    free(infile);
+}
+
+off_t reader_size(const reader *infile)
+{
+    return infile->size;
+}
+
+/* bounds check, either fatal or sticky depending on the reader */
+static int is_out_of_bounds(off_t offset, reader *infile, size_t byte_count)
+{
+    int out = offset < 0 || offset > infile->size || byte_count > (uint64_t)(infile->size - offset);
+
+    if (out)
+    {
+        reader_fail(infile, "read out of bounds");
+    }
+    return out;
+}
+
+void get_bytes_at(off_t offset, reader *infile, unsigned char *buf, size_t byte_count)
+{
+    if (is_out_of_bounds(offset, infile, byte_count))
+    {
+        memset(buf, 0, byte_count);
+        return;
+    }
+
+    if (infile->map)
+    {
+        memcpy(buf, infile->map + offset, byte_count);
+        return;
+    }
+
+    while (byte_count > 0)
+    {
+        ssize_t bytes_read = pread(infile->fd, buf, byte_count, offset);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        CHECK_ERRNO(bytes_read < 0 && !infile->soft_errors, "pread");
+        if (bytes_read <= 0)
+        {
+            /* read error or the file shrank */
+            reader_fail(infile, "unexpected EOF");
+            memset(buf, 0, byte_count);
+            return;
+        }
+        io_count(IO_READS, bytes_read);
+
+        buf += bytes_read;
+        offset += bytes_read;
+        byte_count -= bytes_read;
+    }
+}
+
+/* points straight into the map when possible, otherwise reads into buf */
+static const unsigned char *get_ptr_at(off_t offset, reader *infile, unsigned char *buf, size_t byte_count)
+{
+    if (infile->map && !is_out_of_bounds(offset, infile, byte_count))
+    {
+        return infile->map + offset;
+    }
+
+    get_bytes_at(offset, infile, buf, byte_count);
+    return buf;
+}
+
+uint8_t get_byte_at(off_t offset, reader *infile)
+{
+    unsigned char buf[1];
+    return get_ptr_at(offset, infile, buf, 1)[0];
+}
+uint16_t get_16_be_at(off_t offset, reader *infile)
+{
+    unsigned char buf[2];
+    return read_16_be(get_ptr_at(offset, infile, buf, 2));
+}
+uint16_t get_16_le_at(off_t offset, reader *infile)
+{
+    unsigned char buf[2];
+    return read_16_le(get_ptr_at(offset, infile, buf, 2));
+}
+uint32_t get_32_be_at(off_t offset, reader *infile)
+{
+    unsigned char buf[4];
+    return read_32_be(get_ptr_at(offset, infile, buf, 4));
+}
+uint32_t get_32_le_at(off_t offset, reader *infile)
+{
+    unsigned char buf[4];
+    return read_32_le(get_ptr_at(offset, infile, buf, 4));
+}
+uint64_t get_64_be_at(off_t offset, reader *infile)
+{
+    unsigned char buf[8];
+    return read_64_be(get_ptr_at(offset, infile, buf, 8));
+}
+uint64_t get_64_le_at(off_t offset, reader *infile)
+{
+    unsigned char buf[8];
+    return read_64_le(get_ptr_at(offset, infile, buf, 8));
+}
+
 void put_byte(uint8_t value, FILE *outfile)
 {
     unsigned char buf[1];
@@ -194,9 +1079,9 @@ void put_byte(uint8_t value, FILE *outfile)
     size_t bytes_written = fwrite(buf, 1, 1, outfile);
     CHECK_FILE(bytes_written != 1, outfile, "fwrite");
 }
-void put_byte_seek(uint8_t value, long offset, FILE *outfile)
+void put_byte_seek(uint8_t value, off_t offset, FILE *outfile)
 {
-    CHECK_ERRNO(fseek(outfile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(outfile, offset, SEEK_SET) != 0, "fseeko");
 
     put_byte(value, outfile);
 }
@@ -208,9 +1093,9 @@ void put_16_be(uint16_t value, FILE *outfile)
     size_t bytes_written = fwrite(buf, 1, 2, outfile);
     CHECK_FILE(bytes_written != 2, outfile, "fwrite");
 }
-void put_16_be_seek(uint16_t value, long offset, FILE *outfile)
+void put_16_be_seek(uint16_t value, off_t offset, FILE *outfile)
 {
-    CHECK_ERRNO(fseek(outfile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(outfile, offset, SEEK_SET) != 0, "fseeko");
 
     put_16_be(value, outfile);
 }
@@ -221,9 +1106,9 @@ void put_16_le(uint16_t value, FILE *outfile)
     size_t bytes_written = fwrite(buf, 1, 2, outfile);
     CHECK_FILE(bytes_written != 2, outfile, "fwrite");
 }
-void put_16_le_seek(uint16_t value, long offset, FILE *outfile)
+void put_16_le_seek(uint16_t value, off_t offset, FILE *outfile)
 {
-    CHECK_ERRNO(fseek(outfile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(outfile, offset, SEEK_SET) != 0, "fseeko");
 
     put_16_le(value, outfile);
 }
@@ -234,9 +1119,9 @@ void put_32_be(uint32_t value, FILE *outfile)
     size_t bytes_written = fwrite(buf, 1, 4, outfile);
     CHECK_FILE(bytes_written != 4, outfile, "fwrite");
 }
-void put_32_be_seek(uint32_t value, long offset, FILE *outfile)
+void put_32_be_seek(uint32_t value, off_t offset, FILE *outfile)
 {
-    CHECK_ERRNO(fseek(outfile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(outfile, offset, SEEK_SET) != 0, "fseeko");
 
     put_32_be(value, outfile);
 }
@@ -247,9 +1132,9 @@ void put_32_le(uint32_t value, FILE *outfile)
     size_t bytes_written = fwrite(buf, 1, 4, outfile);
     CHECK_FILE(bytes_written != 4, outfile, "fwrite");
 }
-void put_32_le_seek(uint32_t value, long offset, FILE *outfile)
+void put_32_le_seek(uint32_t value, off_t offset, FILE *outfile)
 {
-    CHECK_ERRNO(fseek(outfile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(outfile, offset, SEEK_SET) != 0, "fseeko");
 
     put_32_le(value, outfile);
 }
@@ -259,9 +1144,9 @@ void put_bytes(FILE *outfile, const unsigned char *buf, size_t byte_count)
     CHECK_FILE(bytes_written != byte_count, outfile, "fwrite");
 }
 
-void put_bytes_seek(long offset, FILE *outfile, const unsigned char *buf, size_t byte_count)
+void put_bytes_seek(off_t offset, FILE *outfile, const unsigned char *buf, size_t byte_count)
 {
-    CHECK_ERRNO(fseek(outfile, offset, SEEK_SET) != 0, "fseek");
+    CHECK_ERRNO(fseeko(outfile, offset, SEEK_SET) != 0, "fseeko");
     put_bytes(outfile, buf, byte_count);
 }
 
@@ -278,9 +1163,9 @@ long read_long(char *text)
     return result;
 }
 
-long pad(long current_offset, long pad_amount, FILE *outfile)
+off_t pad(off_t current_offset, off_t pad_amount, FILE *outfile)
 {
-    long new_offset = (current_offset + pad_amount-1) / pad_amount * pad_amount;
+    off_t new_offset = (current_offset + pad_amount-1) / pad_amount * pad_amount;
 
     for (; current_offset < new_offset; current_offset++)
     {
@@ -352,11 +1237,16 @@ FILE * open_file_in_directory(const char *base_name, const char *dir_name, const
 
 void make_directory(const char *name)
 {
+    int ret;
 #ifdef __MINGW32__
-    mkdir(name);//_mkdir(name);
+    ret = mkdir(name);//_mkdir(name);
 #else
-    mkdir(name, 0755);
+    ret = mkdir(name, 0755);
 #endif
+    if (ret == 0)
+    {
+        io_count(IO_DIRS_CREATED, 0);
+    }
 }
 
 const char *strip_path(const char *path)
@@ -374,12 +1264,131 @@ const char *strip_path(const char *path)
     }
 }
 
-uint8_t * get_whole_file(FILE *infile, long *file_size_p)
+static void add_file(char ***list, int *count, const char *name)
+{
+    char *copy = malloc(strlen(name) + 1);
+    CHECK_ERRNO(!copy, "malloc");
+    strcpy(copy, name);
+
+    /* grow in powers of 2 */
+    if ((*count & (*count - 1)) == 0)
+    {
+        char **new_list = realloc(*list, (*count ? *count * 2 : 1) * sizeof(char *));
+        CHECK_ERRNO(!new_list, "realloc");
+        *list = new_list;
+    }
+    (*list)[(*count)++] = copy;
+}
+
+static int has_ext(const char *name, const char *ext)
+{
+    size_t name_len = strlen(name);
+    size_t ext_len = strlen(ext);
+
+    if (name_len < ext_len)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < ext_len; i++)
+    {
+        if (tolower((unsigned char)name[name_len - ext_len + i]) != tolower((unsigned char)ext[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// a dir next to a (dir)ext file is that file's split output, not more input
+static int is_output_dir(char **entries, int entries_count, const char *dir, const char *ext)
+{
+    size_t dir_len = strlen(dir);
+
+    for (int i = 0; i < entries_count; i++)
+    {
+        if (entries[i] && strlen(entries[i]) == dir_len + strlen(ext) && strncmp(entries[i], dir, dir_len) == 0 &&
+            has_ext(entries[i], ext))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void find_files(const char *path, const char *ext, char ***list, int *count)
+{
+    struct stat st;
+    DIR *dir;
+    struct dirent *entry;
+    char **entries = NULL;
+    int entries_count = 0;
+
+    CHECK_ERRNO(stat(path, &st) != 0, path);
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        add_file(list, count, path);
+        return;
+    }
+
+    dir = opendir(path);
+    CHECK_ERRNO(!dir, path);
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char *full_name = malloc(strlen(path) + 1 + strlen(entry->d_name) + 1);
+        CHECK_ERRNO(!full_name, "malloc");
+        sprintf(full_name, "%s%c%s", path, DIRSEP, entry->d_name);
+        add_file(&entries, &entries_count, full_name);
+        free(full_name);
+    }
+    closedir(dir);
+
+    /* readdir order is arbitrary */
+    if (entries_count)
+    {
+        qsort(entries, entries_count, sizeof(char *), compare_names);
+    }
+
+    for (int i = 0; i < entries_count; i++)
+    {
+        CHECK_ERRNO(stat(entries[i], &st) != 0, entries[i]);
+
+        if (S_ISDIR(st.st_mode))
+        {
+            if (!is_output_dir(entries, entries_count, entries[i], ext))
+            {
+                find_files(entries[i], ext, list, count);
+            }
+        }
+        else if (has_ext(entries[i], ext))
+        {
+            add_file(list, count, entries[i]);
+        }
+        free(entries[i]);
+        entries[i] = NULL;
+    }
+    free(entries);
+}
+
+uint8_t * get_whole_file(FILE *infile, off_t *file_size_p)
 {
     // get input file size
-    CHECK_ERRNO(-1 == fseek(infile, 0, SEEK_END), "fseek");
-    const long file_size = ftell(infile);
-    CHECK_ERRNO(-1 == file_size, "ftell");
+    CHECK_ERRNO(-1 == fseeko(infile, 0, SEEK_END), "fseeko");
+    const off_t file_size = ftello(infile);
+    CHECK_ERRNO(-1 == file_size, "ftello");
+    CHECK_ERROR((uint64_t)file_size > SIZE_MAX, "file too big for memory");
 
     if (file_size_p)
     {
@@ -446,8 +1455,8 @@ int strip_filename(char *buf, int buf_size, const char * name) {
     return 0;
 }
 
-int get_streamfile_size(FILE * streamFile) {
-    size_t current, size = 0;
+off_t get_streamfile_size(FILE * streamFile) {
+    off_t current, size = 0;
 
     current = ftello(streamFile);
     fseeko(streamFile,0,SEEK_END);
@@ -6,8 +6,11 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "error_stuff.h"
+#include "hash.h"
 
 #ifdef __MINGW32__
 #define DIRSEP '\\'
@@ -18,56 +21,155 @@
 // endian-neutral integer reads
 uint32_t read_32_le(const unsigned char bytes[4]);
 uint16_t read_16_le(const unsigned char bytes[2]);
+uint64_t read_64_le(const unsigned char bytes[8]);
 uint64_t read_64_be(const unsigned char bytes[8]);
 uint32_t read_32_be(const unsigned char bytes[4]);
 uint16_t read_16_be(const unsigned char bytes[2]);
 // endian-neutral integer writes
 void write_32_be(uint32_t value, unsigned char bytes[4]);
 void write_32_le(uint32_t value, unsigned char bytes[4]);
+void write_64_le(uint64_t value, unsigned char bytes[8]);
 void write_16_be(uint16_t value, unsigned char bytes[2]);
 void write_16_le(uint16_t value, unsigned char bytes[2]);
 
 // self-checking file reads
 uint8_t get_byte(FILE *infile);
-uint8_t get_byte_seek(long offset, FILE *infile);
+uint8_t get_byte_seek(off_t offset, FILE *infile);
 uint16_t get_16_be(FILE *infile);
-uint16_t get_16_be_seek(long offset, FILE *infile);
+uint16_t get_16_be_seek(off_t offset, FILE *infile);
 uint16_t get_16_le(FILE *infile);
-uint16_t get_16_le_seek(long offset, FILE *infile);
+uint16_t get_16_le_seek(off_t offset, FILE *infile);
 uint32_t get_32_be(FILE *infile);
-uint32_t get_32_be_seek(long offset, FILE *infile);
+uint32_t get_32_be_seek(off_t offset, FILE *infile);
 uint32_t get_32_le(FILE *infile);
-uint32_t get_32_le_seek(long offset, FILE *infile);
+uint32_t get_32_le_seek(off_t offset, FILE *infile);
 uint64_t get_64_be(FILE *infile);
-uint64_t get_64_be_seek(long offset, FILE *infile);
+uint64_t get_64_be_seek(off_t offset, FILE *infile);
 void get_bytes(FILE *infile, unsigned char *buf, size_t byte_count);
-void get_bytes_seek(long offset, FILE *infile, unsigned char *buf, size_t byte_count);
-
-uint8_t *get_whole_file(FILE *infile, long *file_size_p);
+void get_bytes_seek(off_t offset, FILE *infile, unsigned char *buf, size_t byte_count);
+
+uint8_t *get_whole_file(FILE *infile, off_t *file_size_p);
+
+// positional reader over a whole file, either read-only mmap'd or served by pread;
+// there is no shared file position so one reader can be used from several threads
+typedef struct {
+    int fd; /* -1 for memory */
+    const uint8_t *map; /* NULL when using pread */
+    off_t size;
+    uint8_t *buf; /* bytes read so far, for pipes */
+    int is_pipe;
+    int is_memory; /* map is the caller's buffer */
+    int keep_fd; /* fd is the caller's, not closed */
+    int soft_errors; /* failed reads (out of bounds, I/O errors, EOF) set failed and return zeroes instead of exiting */
+    int failed;
+} reader;
+
+reader *reader_open(const char *name, int use_mmap);
+// reader over the caller's open fd (left open on close)
+reader *reader_open_fd(int fd, int use_mmap);
+// reader over the caller's buffer (must outlive the reader)
+reader *reader_open_memory(const void *buf, size_t size);
+// reader over a non-seekable fd (such as stdin), only the bytes read with reader_fill can be
+// read positionally (from memory), anything after that must be read in order from fd
+reader *reader_open_pipe(int fd);
+// read from the pipe until the first size bytes are in memory, returns 0 or -1 if it can't
+// (only for soft_errors readers, others exit)
+int reader_fill(reader *infile, off_t size);
+void reader_close(reader *infile);
+off_t reader_size(const reader *infile);
+
+// self-checking positional reads (bounds-checked against the reader size)
+uint8_t get_byte_at(off_t offset, reader *infile);
+uint16_t get_16_be_at(off_t offset, reader *infile);
+uint16_t get_16_le_at(off_t offset, reader *infile);
+uint32_t get_32_be_at(off_t offset, reader *infile);
+uint32_t get_32_le_at(off_t offset, reader *infile);
+uint64_t get_64_be_at(off_t offset, reader *infile);
+uint64_t get_64_le_at(off_t offset, reader *infile);
+void get_bytes_at(off_t offset, reader *infile, unsigned char *buf, size_t byte_count);
 
 // self-checking file writes 
 void put_byte(uint8_t value, FILE *outfile);
-void put_byte_seek(uint8_t value, long offset, FILE *outfile);
+void put_byte_seek(uint8_t value, off_t offset, FILE *outfile);
 void put_16_be(uint16_t value, FILE *outfile);
-void put_16_be_seek(uint16_t value, long offset, FILE *outfile);
+void put_16_be_seek(uint16_t value, off_t offset, FILE *outfile);
 void put_16_le(uint16_t value, FILE *outfile);
-void put_16_le_seek(uint16_t value, long offset, FILE *outfile);
+void put_16_le_seek(uint16_t value, off_t offset, FILE *outfile);
 void put_32_be(uint32_t value, FILE *outfile);
-void put_32_be_seek(uint32_t value, long offset, FILE *outfile);
+void put_32_be_seek(uint32_t value, off_t offset, FILE *outfile);
 void put_32_le(uint32_t value, FILE *outfile);
-void put_32_le_seek(uint32_t value, long offset, FILE *outfile);
+void put_32_le_seek(uint32_t value, off_t offset, FILE *outfile);
 void put_bytes(FILE *outfile, const unsigned char *buf, size_t byte_count);
-void put_bytes_seek(long offset, FILE *outfile, const unsigned char *buf, size_t byte_count);
+void put_bytes_seek(off_t offset, FILE *outfile, const unsigned char *buf, size_t byte_count);
 
 // self-checking wrapper for strtol
 // not const due to strtol's 2nd arg
 long read_long(char *text);
 
-// dump a section of file
-void dump(FILE *infile, FILE *outfile, long offset, size_t size);
+// dump a section of file, buf is the caller's scratch space for buffered copies
+#define DUMP_BUF 0x80000
+void dump(reader *infile, FILE *outfile, off_t offset, size_t size, unsigned char *buf, size_t buf_size);
+
+// write header then a section of file to a new fd, with as few calls as possible
+// (header and data go out together if the data is small or the reader is mmap'd);
+// if sums isn't NULL it's updated with everything written, copying through buf (not in the kernel)
+void dump_with_header(int outfd, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, unsigned char *buf, size_t buf_size, checksum_state *sums);
+
+// write header then a section of file at the fd's current position (so also to pipes or into a bigger
+// file), with plain writes through buf unless the reader is mmap'd
+void append_with_header(int outfd, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, unsigned char *buf, size_t buf_size);
+
+// write header then a section of file to a new fd, swapping the bytes of each 16-bit sample
+// (big-endian PCM to little-endian); always through buf, since the data must be changed
+void dump_swap16(int outfd, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, unsigned char *buf, size_t buf_size);
+
+// create a binary file for writing, failing with EEXIST if it exists unless overwriting
+// (an existing file is replaced by a new one rather than truncated); returns the fd or -1
+int create_file(const char *name, int overwrite);
+// remove name before it's overwritten if it's a regular file, so other hardlinks to it (-L hard
+// outputs of other banks) keep their data; returns 0 or -1 with errno
+int unlink_for_overwrite(const char *name);
+// take over stdout for binary output: returns a new fd for it (or -1) and points stdout at stderr,
+// so later printfs don't get mixed into the data
+int take_stdout(void);
+// make dst the same file as src: a reflink (separate file sharing the data, on btrfs/xfs) when
+// asked and supported, a hardlink otherwise; returns 0 or -1 with errno (EEXIST unless overwriting)
+int link_file(const char *src, const char *dst, int reflink, int overwrite);
+// check if a file already is header then a section of file (just its size unless check_content),
+// buf is the caller's scratch space; returns 1 if so, 0 if missing or different
+int file_matches(const char *name, const unsigned char *header, size_t header_size, reader *infile, off_t offset, size_t size, int check_content, unsigned char *buf, size_t buf_size);
+// a stat's mtime in ns since the epoch (whole seconds where the OS keeps nothing finer)
+int64_t stat_mtime_ns(const struct stat *st);
+// self-checking read from an fd, returns less than byte_count only at EOF
+size_t read_bytes(int fd, unsigned char *buf, size_t byte_count);
+// self-checking write of a whole buffer to an fd
+void write_bytes(int fd, const unsigned char *buf, size_t byte_count);
+// self-checking close
+void close_file(int fd);
+
+// counters of the I/O done by the helpers here (and the io_uring writer), kept once enabled;
+// bytes are read, written or copied, and seeks/files/dirs only count calls
+enum { IO_READS, IO_WRITES, IO_KERNEL_COPIES, IO_SEEKS, IO_FILES_CREATED, IO_DIRS_CREATED, IO_COUNTERS };
+typedef struct {
+    uint64_t calls[IO_COUNTERS];
+    uint64_t bytes[IO_COUNTERS];
+} io_counters;
+void io_counting(int enable);
+void io_count(int counter, uint64_t bytes);
+void io_counters_get(io_counters *counters);
+
+// wall clock and this thread's CPU time, in seconds (only differences are meaningful)
+void get_times(double *wall, double *cpu);
+// CPU time of the whole process (user + system, all threads) in seconds and its peak resident memory in KB, 0 if unknown
+void process_usage(double *cpu, uint64_t *peak_rss_kb);
+
+// copy method used by dump() and dump_with_header(), auto tries copy_file_range, then sendfile, then buffered
+// (the kernel methods are Linux only, forcing one fails if the kernel refuses it)
+enum { DUMP_AUTO, DUMP_COPY_RANGE, DUMP_SENDFILE, DUMP_BUFFERED };
+void set_dump_method(int method);
 
 // pad a file out to some multiple, conservatively
-long pad(long current_offset, long pad_amount, FILE *outfile);
+off_t pad(off_t current_offset, off_t pad_amount, FILE *outfile);
 
 // create a directory
 void make_directory(const char *name);
@@ -83,16 +185,21 @@ char * number_name(const char * name_head, const char * name_tail, unsigned int
 // given a path to a file, return the filename part of the path
 const char * strip_path(const char * path);
 
+// if path is a file add it to the list, if it's a directory add all files inside ending in ext
+// (case insensitive, recursively, sorted by name), skipping dirs next to a (dir)ext file since they
+// are that file's split output; list and names are malloc'd
+void find_files(const char *path, const char *ext, char ***list, int *count);
+
 ///////extra
 
 int strip_ext(char *buf, int buf_size, const char * name);
 int strip_filename(char *buf, int buf_size, const char * name);
-int get_streamfile_size(FILE * streamFile);
+off_t get_streamfile_size(FILE * streamFile);
 
-#define read_32bitBE get_32_be_seek
-#define read_32bitLE get_32_le_seek
-#define read_16bitBE get_16_be_seek
-#define read_16bitLE get_16_le_seek
-#define read_8bit get_byte_seek
+#define read_32bitBE get_32_be_at
+#define read_32bitLE get_32_le_at
+#define read_16bitBE get_16_be_at
+#define read_16bitLE get_16_le_at
+#define read_8bit get_byte_at
 
 #endif /* _UTIL_H_INCLUDED */
@@ -0,0 +1,1822 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "xwb.h"
+
+/* vector paths for unpacking compact entries: AVX2 checked at runtime, SSE2 always there on x86-64, NEON on ARM64 */
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define UNPACK_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__)
+#define UNPACK_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define UNPACK_NEON
+#include <arm_neon.h>
+#endif
+
+/* sets the error message and returns the code (function must have a ctx) */
+#define CHECK_XWB(code, condition, ...) \
+    do {if (condition) { \
+        snprintf(ctx->error, sizeof(ctx->error), __VA_ARGS__); \
+        return (code); \
+    } } while (0)
+
+
+static int parse_xwb(xwb_context * ctx);
+static int decode_entries(xwb_header * xwb, const unsigned char * entries);
+static int parse_xsb(xwb_context * ctx);
+static int read_xsb(xwb_context * ctx);
+static int check_xsb(xwb_context * ctx);
+static int select_wavebank(xwb_context * ctx);
+static void resolve_names(xwb_context * ctx);
+static xsb_sound * find_unnamed_xsb_sound(xwb_header * xwb, off_t sound_offset);
+static int load_index(xwb_context * ctx, const xwb_options * opts, const char * index_name);
+static int save_index(xwb_context * ctx, const xwb_options * opts, const char * index_name);
+
+
+/* readers don't exit on bad offsets inside the library, so check once after each step */
+static int check_read(xwb_context * ctx, reader * infile) {
+    CHECK_XWB(XWB_ERROR_READ, infile && infile->failed, "ERROR: read out of bounds (truncated or corrupt file)");
+    return XWB_OK;
+}
+
+int xwb_open(xwb_context * ctx, const char * xwb_name, const char * xsb_name, const xwb_options * opts) {
+    reader * xwb_file;
+    reader * xsb_file = NULL;
+
+    memset(ctx,0,sizeof(xwb_context));
+
+    xwb_file = reader_open(xwb_name, 1);
+    CHECK_XWB(XWB_ERROR_OPEN, !xwb_file, "ERROR: failed opening input .xwb");
+
+    if (xsb_name && !opts->ignore_xsb_name && !opts->ignore_xsb_xwb_name) {
+        xsb_file = reader_open(xsb_name, 1);
+        if (!xsb_file) {
+            reader_close(xwb_file);
+            CHECK_XWB(XWB_ERROR_OPEN, 1, "ERROR: failed opening companion .xsb (use -x to specify or -i to ignore)");
+        }
+    }
+
+    return xwb_open_readers(ctx, xwb_file, xsb_file, opts);
+}
+
+int xwb_open_fd(xwb_context * ctx, int xwb_fd, int xsb_fd, const xwb_options * opts) {
+    reader * xwb_file;
+    reader * xsb_file = NULL;
+
+    memset(ctx,0,sizeof(xwb_context));
+
+    xwb_file = reader_open_fd(xwb_fd, 1);
+    CHECK_XWB(XWB_ERROR_OPEN, !xwb_file, "ERROR: failed opening input .xwb");
+
+    if (xsb_fd >= 0) {
+        xsb_file = reader_open_fd(xsb_fd, 1);
+        if (!xsb_file) {
+            reader_close(xwb_file);
+            CHECK_XWB(XWB_ERROR_OPEN, 1, "ERROR: failed opening .xsb");
+        }
+    }
+
+    return xwb_open_readers(ctx, xwb_file, xsb_file, opts);
+}
+
+int xwb_open_memory(xwb_context * ctx, const void * xwb_buf, size_t xwb_size, const void * xsb_buf, size_t xsb_size, const xwb_options * opts) {
+    reader * xwb_file;
+    reader * xsb_file = NULL;
+
+    memset(ctx,0,sizeof(xwb_context));
+
+    xwb_file = reader_open_memory(xwb_buf, xwb_size);
+    CHECK_XWB(XWB_ERROR_MEMORY, !xwb_file, "ERROR: out of memory");
+
+    if (xsb_buf) {
+        xsb_file = reader_open_memory(xsb_buf, xsb_size);
+        if (!xsb_file) {
+            reader_close(xwb_file);
+            CHECK_XWB(XWB_ERROR_MEMORY, 1, "ERROR: out of memory");
+        }
+    }
+
+    return xwb_open_readers(ctx, xwb_file, xsb_file, opts);
+}
+
+/**
+ * Adds the time since wall and cpu to a phase and restarts them from now
+ */
+static void phase_time(double * phase_wall, double * phase_cpu, double * wall, double * cpu) {
+    double now_wall, now_cpu;
+
+    get_times(&now_wall, &now_cpu);
+    *phase_wall += now_wall - *wall;
+    *phase_cpu += now_cpu - *cpu;
+    *wall = now_wall;
+    *cpu = now_cpu;
+}
+
+int xwb_open_readers(xwb_context * ctx, reader * xwb_file, reader * xsb_file, const xwb_options * opts) {
+    xwb_times * t = &ctx->times;
+    double wall, cpu;
+    int ret;
+
+    memset(ctx,0,sizeof(xwb_context));
+    ctx->opts = *opts;
+    ctx->xwb_file = xwb_file;
+    ctx->xsb_file = xsb_file;
+
+    xwb_file->soft_errors = 1;
+    if (xsb_file) {
+        xsb_file->soft_errors = 1;
+    }
+    else if (!opts->ignore_xsb_xwb_name) {
+        /* no .xsb means .xwb names */
+        ctx->opts.ignore_xsb_name = 1;
+    }
+
+    get_times(&wall, &cpu);
+    if (opts->index_name && load_index(ctx, opts, opts->index_name) == XWB_OK) {
+        phase_time(&t->xwb_wall, &t->xwb_cpu, &wall, &cpu);
+        return XWB_OK;
+    }
+
+    ret = parse_xwb(ctx);
+    phase_time(&t->xwb_wall, &t->xwb_cpu, &wall, &cpu);
+    if (ret != XWB_OK)
+        return ret;
+
+    ret = parse_xsb(ctx);
+    phase_time(&t->xsb_wall, &t->xsb_cpu, &wall, &cpu);
+    if (ret != XWB_OK)
+        return ret;
+
+    resolve_names(ctx);
+    phase_time(&t->names_wall, &t->names_cpu, &wall, &cpu);
+
+    /* a failed save only means parsing again next time */
+    if (opts->index_name && save_index(ctx, opts, opts->index_name) != XWB_OK)
+        ctx->error[0] = '\0';
+    return XWB_OK;
+}
+
+int xwb_open_xsb(xwb_context * ctx, const char * xsb_name, const xwb_options * opts) {
+    xwb_times * t = &ctx->times;
+    double wall, cpu;
+    int ret;
+
+    memset(ctx,0,sizeof(xwb_context));
+    ctx->opts = *opts;
+    ctx->opts.ignore_xsb_name = 0;
+    ctx->opts.ignore_xsb_xwb_name = 0;
+
+    ctx->xsb_file = reader_open(xsb_name, 1);
+    CHECK_XWB(XWB_ERROR_OPEN, !ctx->xsb_file, "ERROR: failed opening input .xsb");
+    ctx->xsb_file->soft_errors = 1;
+
+    get_times(&wall, &cpu);
+    ret = read_xsb(ctx);
+    phase_time(&t->xsb_wall, &t->xsb_cpu, &wall, &cpu);
+    return ret;
+}
+
+int xwb_open_shared(xwb_context * ctx, reader * xwb_file, const xwb_context * xsb, const xwb_options * opts) {
+    xwb_header * xwb = &ctx->xwb;
+    const xwb_header * shared = &xsb->xwb;
+    xwb_times * t = &ctx->times;
+    double wall, cpu;
+    int ret;
+
+    memset(ctx,0,sizeof(xwb_context));
+    ctx->opts = *opts;
+    ctx->opts.ignore_xsb_name = 0;
+    ctx->opts.ignore_xsb_xwb_name = 0;
+    ctx->xwb_file = xwb_file;
+    xwb_file->soft_errors = 1;
+
+    get_times(&wall, &cpu);
+    ret = parse_xwb(ctx);
+    phase_time(&t->xwb_wall, &t->xwb_cpu, &wall, &cpu);
+    if (ret != XWB_OK)
+        return ret;
+
+    /* the parsed tables are only read from now on, so every bank can point to the same ones */
+    xwb->xsb_shared = 1;
+    xwb->xsb_version = shared->xsb_version;
+    xwb->xsb_sounds = shared->xsb_sounds;
+    xwb->xsb_sounds_count = shared->xsb_sounds_count;
+    xwb->xsb_simple_sounds_count = shared->xsb_simple_sounds_count;
+    xwb->xsb_complex_sounds_count = shared->xsb_complex_sounds_count;
+    xwb->xsb_wavebanks = shared->xsb_wavebanks;
+    xwb->xsb_wavebanks_count = shared->xsb_wavebanks_count;
+    xwb->xsb_names = shared->xsb_names;
+
+    ret = check_xsb(ctx);
+    if (ret == XWB_OK)
+        ret = select_wavebank(ctx);
+    phase_time(&t->xsb_wall, &t->xsb_cpu, &wall, &cpu);
+    if (ret != XWB_OK)
+        return ret;
+
+    resolve_names(ctx);
+    phase_time(&t->names_wall, &t->names_cpu, &wall, &cpu);
+    return XWB_OK;
+}
+
+int xwb_get_bank_info(reader * xwb_file, char * name, size_t name_size, int * streams_count) {
+    uint32_t (*read_32bit)(off_t,reader*) = NULL;
+    unsigned char buf[0x40];
+    uint32_t version;
+    off_t off;
+    size_t size, i;
+
+    name[0] = '\0';
+    *streams_count = 0;
+    xwb_file->soft_errors = 1;
+    if (read_32bitBE(0x00,xwb_file) != 0x57424E44 && read_32bitBE(0x00,xwb_file) != 0x444E4257)
+        return XWB_ERROR_XWB;
+    read_32bit = read_32bitBE(0x00,xwb_file) == 0x57424E44 ? read_32bitLE : read_32bitBE;
+
+    version = read_32bit(0x04, xwb_file);
+    if (version == XACT_CRACKDOWN)
+        version = XACT2_2_MAX;
+
+    /* WAVEBANKDATA name, which XACT sets to the wavebank's name in the project (as in the .xsb) */
+    if (version <= XACT1_0_MAX) {
+        *streams_count = read_32bit(0x0c, xwb_file);
+        off = 0x10;
+        size = 0x40;
+    } else {
+        off = read_32bit(version <= XACT2_2_MAX ? 0x08 : 0x0c, xwb_file);
+        *streams_count = read_32bit(off + 0x04, xwb_file);
+        off += 0x08;
+        size = version <= XACT1_1_MAX ? 0x10 : 0x40;
+    }
+
+    get_bytes_at(off, xwb_file, buf, size);
+    if (xwb_file->failed)
+        return XWB_ERROR_READ;
+
+    for (i = 0; i < size && i < name_size - 1 && buf[i]; i++)
+        name[i] = buf[i];
+    name[i] = '\0';
+    return XWB_OK;
+}
+
+void xwb_close(xwb_context * ctx) {
+    reader_close(ctx->xwb_file);
+    reader_close(ctx->xsb_file);
+    free(ctx->xwb.xwb_streams);
+    free(ctx->xwb.xwb_names);
+    if (!ctx->xwb.xsb_shared) {
+        free(ctx->xwb.xsb_sounds);
+        free(ctx->xwb.xsb_wavebanks);
+        free(ctx->xwb.xsb_names);
+    }
+    free(ctx->xwb.header_template);
+    memset(ctx,0,sizeof(xwb_context));
+}
+
+const char * xwb_error(const xwb_context * ctx) {
+    return ctx->error;
+}
+
+int xwb_header_end(reader * streamFile, off_t * end) {
+    uint32_t (*read_32bit)(off_t,reader*) = NULL;
+    uint32_t version;
+    off_t off;
+    int i, segments;
+
+    *end = 0x10;
+    if (reader_size(streamFile) < *end)
+        return XWB_ERROR_READ;
+
+    if (read_32bitBE(0x00,streamFile) != 0x57424E44 && read_32bitBE(0x00,streamFile) != 0x444E4257)
+        return XWB_ERROR_XWB;
+    read_32bit = read_32bitBE(0x00,streamFile) == 0x57424E44 ? read_32bitLE : read_32bitBE;
+
+    version = read_32bit(0x04, streamFile);
+    if (version == XACT_CRACKDOWN)
+        version = XACT2_2_MAX;
+
+    if (version <= XACT1_0_MAX) {
+        *end = 0x50 + read_32bit(0x0c, streamFile) * 0x14;
+        return XWB_OK;
+    }
+
+    /* segments: BANKDATA, ENTRYMETADATA, extra1, (extra2), ENTRYWAVEDATA */
+    off = version <= XACT2_2_MAX ? 0x08 : 0x0c;
+    segments = version <= XACT1_1_MAX ? 4 : 5;
+    *end = off + segments*0x08;
+    if (reader_size(streamFile) < *end)
+        return XWB_ERROR_READ;
+
+    for (i = 0; i < segments; i++) {
+        off_t segment_end = read_32bit(off + i*0x08, streamFile);
+        if (i < segments - 1) /* only the start of the wave data */
+            segment_end += read_32bit(off + i*0x08 + 0x04, streamFile);
+        if (segment_end > *end)
+            *end = segment_end;
+    }
+
+    return XWB_OK;
+}
+
+static int parse_xwb(xwb_context * ctx) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_options * opts = &ctx->opts;
+    /*quick hack from xwb.c (probably slow)*/
+    reader * streamFile = ctx->xwb_file;
+    off_t off, suboff;
+    uint32_t (*read_32bit)(off_t,reader*) = NULL;
+    int i;
+
+    if ((read_32bitBE(0x00,streamFile) != 0x57424E44) &&    /* "WBND" (LE) */
+        (read_32bitBE(0x00,streamFile) != 0x444E4257))      /* "DNBW" (BE) */
+        goto fail;
+
+    xwb->little_endian = read_32bitBE(0x00,streamFile) == 0x57424E44;/* WBND */
+    if (xwb->little_endian) {
+        read_32bit = read_32bitLE;
+    } else {
+        read_32bit = read_32bitBE;
+    }
+
+    /* read main header (WAVEBANKHEADER) */
+    xwb->version = read_32bit(0x04, streamFile);
+
+    /* Crackdown 1 X360, essentially XACT2 but may have split header in some cases */
+    if (xwb->version == XACT_CRACKDOWN)
+        xwb->version = XACT2_2_MAX;
+
+    /* read segment offsets (SEGIDX) */
+    if (xwb->version <= XACT1_0_MAX) {
+        xwb->streams_count= read_32bit(0x0c, streamFile);
+        /* 0x10: bank name */
+        xwb->entry_elem_size = 0x14;
+        xwb->entry_offset= 0x50;
+        xwb->entry_size  = xwb->entry_elem_size * xwb->streams_count;
+        xwb->data_offset = xwb->entry_offset + xwb->entry_size;
+        xwb->data_size   = reader_size(streamFile) - xwb->data_offset; /* unknown (0) when streaming, but not needed */
+    }
+    else {
+        off = xwb->version <= XACT2_2_MAX ? 0x08 : 0x0c;
+        xwb->base_offset = read_32bit(off+0x00, streamFile);//BANKDATA
+        xwb->base_size   = read_32bit(off+0x04, streamFile);
+        xwb->entry_offset= read_32bit(off+0x08, streamFile);//ENTRYMETADATA
+        xwb->entry_size  = read_32bit(off+0x0c, streamFile);
+        xwb->extra1_offset= read_32bit(off+0x10, streamFile);//XACT1: ENTRYNAMES, XACT2: ? (SEEKTABLES in v40, ENTRYNAMES in doc), XACT3: SEEKTABLES
+        xwb->extra1_size  = read_32bit(off+0x14, streamFile);
+        if (xwb->version <= XACT1_1_MAX) {
+            xwb->data_offset    = read_32bit(off+0x18, streamFile);//ENTRYWAVEDATA
+            xwb->data_size      = read_32bit(off+0x1c, streamFile);
+        } else {
+            xwb->extra2_offset  = read_32bit(off+0x18, streamFile);//XACT2: ? (ENTRYNAMES in v40, EXTRA in doc), XACT3: ENTRYNAMES
+            xwb->extra2_size    = read_32bit(off+0x1c, streamFile);
+            xwb->data_offset    = read_32bit(off+0x20, streamFile);//ENTRYWAVEDATA
+            xwb->data_size      = read_32bit(off+0x24, streamFile);
+        }
+
+        /* for Techland's XWB with no data */
+        CHECK_XWB(XWB_ERROR_XWB, xwb->base_offset == 0 || xwb->data_offset == 0, "ERROR: no start found (fake XWB?)");
+
+        /* Stardew Valley (Switch/Vita) hijacks (needs weird size to detect) */
+        if (xwb->version == XACT3_0_MAX
+                && (xwb->data_size == 0x55951c1c || xwb->data_size == 0x4e0a1000)) {
+            xwb->is_stardew_valley = 1;
+        }
+
+        CHECK_XWB(XWB_ERROR_XWB, (xwb->data_offset + xwb->data_size) > reader_size(streamFile) && !xwb->is_stardew_valley && !streamFile->is_pipe, "ERROR: filesize mismatch");
+
+
+        //todo XACT2 < v40 may use extra1 as names offset
+        if (xwb->version <= XACT1_1_MAX) {
+            xwb->names_offset = xwb->extra1_offset;
+            xwb->names_size = xwb->extra1_size;
+        } else {
+            xwb->names_offset = xwb->extra2_offset;
+            xwb->names_size = xwb->extra2_size;
+        }
+
+        /* read base entry (WAVEBANKDATA) */
+        off = xwb->base_offset;
+        xwb->base_flags = (uint32_t)read_32bit(off+0x00, streamFile);
+        xwb->streams_count = read_32bit(off+0x04, streamFile);
+        /* 0x08 bank_name */
+        suboff = 0x08 + (xwb->version <= XACT1_1_MAX ? 0x10 : 0x40);
+        xwb->entry_elem_size = read_32bit(off+suboff+0x00, streamFile);
+        xwb->name_elem_size = read_32bit(off+suboff+0x04, streamFile);
+        xwb->entry_alignment = read_32bit(off+suboff+0x08, streamFile); /* usually 1 dvd sector */
+        //xwb->format = read_32bit(off+suboff+0x0c, streamFile); /* compact mode only */
+        /* suboff+0x10: build time 64b (XACT2/3) */
+    }
+
+    CHECK_XWB(XWB_ERROR_XWB, opts->multi_only && xwb->streams_count == 1, "ERROR: only one stream found");
+
+
+    /* parse xwb streams */
+    xwb->xwb_streams = calloc(xwb->streams_count, sizeof(xwb_stream));
+    if (!xwb->xwb_streams) goto fail;
+
+    /* whole entry segment at once, decoded in memory */
+    if (xwb->streams_count > 0) {
+        size_t entry_end = (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) ? 0x04 : (xwb->version <= XACT1_0_MAX ? 0x0c : 0x10);
+        size_t entries_size = (xwb->streams_count - 1) * xwb->entry_elem_size + entry_end;
+        unsigned char * entries_buf = NULL;
+        const unsigned char * entries;
+        int decoded;
+
+        CHECK_XWB(XWB_ERROR_READ, (xwb->streams_count - 1) > (SIZE_MAX - entry_end) / (xwb->entry_elem_size ? xwb->entry_elem_size : 1)
+                || xwb->entry_offset > reader_size(streamFile) || entries_size > (uint64_t)(reader_size(streamFile) - xwb->entry_offset),
+                "ERROR: read out of bounds (truncated or corrupt file)");
+
+        if (streamFile->map) {
+            entries = streamFile->map + xwb->entry_offset;
+        }
+        else {
+            entries_buf = malloc(entries_size);
+            if (!entries_buf) goto fail;
+            get_bytes_at(xwb->entry_offset, streamFile, entries_buf, entries_size);
+            entries = entries_buf;
+        }
+
+        decoded = decode_entries(xwb, entries);
+        free(entries_buf);
+        if (!decoded) goto fail;
+    }
+
+    /* load stream names with a single read, each stream then points into the table */
+    if (opts->ignore_xsb_name && !opts->ignore_xsb_xwb_name
+            && xwb->names_offset && xwb->names_size && xwb->name_elem_size) {
+        size_t names_size = xwb->streams_count * xwb->name_elem_size;
+        unsigned char * names = malloc(names_size);
+        if (!names) goto fail;
+
+        xwb->xwb_names = malloc(xwb->streams_count * (xwb->name_elem_size + 1));
+        if (!xwb->xwb_names) goto fail;
+
+        get_bytes_at(xwb->names_offset, streamFile, names, names_size);
+        for (i = 0; i < xwb->streams_count; i++) {
+            char * name = xwb->xwb_names + i * (xwb->name_elem_size + 1);
+            memcpy(name, names + i * xwb->name_elem_size, xwb->name_elem_size);
+            name[xwb->name_elem_size] = '\0'; /* just in case */
+            xwb->xwb_streams[i].name = name;
+        }
+        free(names);
+    }
+
+    if (opts->debug) {
+        for (i = 0; i < xwb->streams_count; i++) {
+            xwb_stream *s = &(xwb->xwb_streams[i]);;
+            printf("XWB s%04i: off=%08"PRIx64", size=%08"PRIx64"\n", i, (uint64_t)s->stream_offset, (uint64_t)s->stream_size);
+        }
+    }
+
+
+    if (opts->verbose)
+        printf("XWB has %i streams\n", (int)xwb->streams_count);
+
+    return check_read(ctx, ctx->xwb_file);
+
+fail:
+    CHECK_XWB(XWB_ERROR_XWB, 1, "error parsing XWB");
+    return XWB_ERROR_XWB;
+}
+
+/* compact entry: 21b offset within data in sectors, 11b padding for sector alignment in bytes */
+#define COMPACT_SECTOR_MASK     0x1FFFFF
+#define COMPACT_DEVIATION_SHIFT 21
+
+#ifdef UNPACK_AVX2
+__attribute__((target("avx2")))
+static int unpack_compact_avx2(const unsigned char * src, int count, int big_endian, uint32_t * sectors, uint32_t * deviations) {
+    const __m256i swap = _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12, 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+    const __m256i mask = _mm256_set1_epi32(COMPACT_SECTOR_MASK);
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m256i entries = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+        if (big_endian)
+            entries = _mm256_shuffle_epi8(entries, swap);
+        _mm256_storeu_si256((__m256i *)(sectors + i), _mm256_and_si256(entries, mask));
+        _mm256_storeu_si256((__m256i *)(deviations + i), _mm256_srli_epi32(entries, COMPACT_DEVIATION_SHIFT));
+    }
+    return i;
+}
+#endif
+
+#ifdef UNPACK_SSE2
+static int unpack_compact_sse2(const unsigned char * src, int count, int big_endian, uint32_t * sectors, uint32_t * deviations) {
+    const __m128i mask = _mm_set1_epi32(COMPACT_SECTOR_MASK);
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m128i entries = _mm_loadu_si128((const __m128i *)(src + i * 4));
+        if (big_endian) {
+            /* no byte shuffle in SSE2: swap the 16b halves, then the bytes in each half */
+            entries = _mm_shufflehi_epi16(_mm_shufflelo_epi16(entries, 0xB1), 0xB1);
+            entries = _mm_or_si128(_mm_slli_epi16(entries, 8), _mm_srli_epi16(entries, 8));
+        }
+        _mm_storeu_si128((__m128i *)(sectors + i), _mm_and_si128(entries, mask));
+        _mm_storeu_si128((__m128i *)(deviations + i), _mm_srli_epi32(entries, COMPACT_DEVIATION_SHIFT));
+    }
+    return i;
+}
+#endif
+
+#ifdef UNPACK_NEON
+static int unpack_compact_neon(const unsigned char * src, int count, int big_endian, uint32_t * sectors, uint32_t * deviations) {
+    const uint32x4_t mask = vdupq_n_u32(COMPACT_SECTOR_MASK);
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        uint8x16_t bytes = vld1q_u8(src + i * 4);
+        uint32x4_t entries;
+        if (big_endian)
+            bytes = vrev32q_u8(bytes);
+        entries = vreinterpretq_u32_u8(bytes);
+        vst1q_u32(sectors + i, vandq_u32(entries, mask));
+        vst1q_u32(deviations + i, vshrq_n_u32(entries, COMPACT_DEVIATION_SHIFT));
+    }
+    return i;
+}
+#endif
+
+/**
+ * Unpacks count contiguous compact entries (WAVEBANKENTRYCOMPACT) into sector offsets and size deviations.
+ */
+static void unpack_compact(const unsigned char * src, int count, int big_endian, uint32_t * sectors, uint32_t * deviations) {
+    int i = 0;
+
+#if defined(UNPACK_NEON)
+    i = unpack_compact_neon(src, count, big_endian, sectors, deviations);
+#else
+#ifdef UNPACK_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        i = unpack_compact_avx2(src, count, big_endian, sectors, deviations);
+#endif
+#ifdef UNPACK_SSE2
+    i += unpack_compact_sse2(src + i * 4, count - i, big_endian, sectors + i, deviations + i);
+#endif
+#endif
+
+    for (; i < count; i++) {
+        uint32_t entry = big_endian ? read_32_be(src + i * 4) : read_32_le(src + i * 4);
+        sectors[i] = entry & COMPACT_SECTOR_MASK;
+        deviations[i] = entry >> COMPACT_DEVIATION_SHIFT;
+    }
+}
+
+/**
+ * Fills the stream table from the whole entry segment (ENTRYMETADATA) in memory.
+ * Compact entries only have offsets, so sizes come from the next stream's offset (or the data end for the last).
+ */
+static int decode_entries(xwb_header * xwb, const unsigned char * entries) {
+    uint32_t (*read_32)(const unsigned char *) = xwb->little_endian ? read_32_le : read_32_be;
+    size_t i;
+
+    if (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) {
+        uint32_t * sectors = malloc(xwb->streams_count * 2 * sizeof(uint32_t));
+        uint32_t * deviations = sectors + xwb->streams_count;
+        if (!sectors)
+            return 0;
+
+        /* always 4 bytes, but spaced as the bank says */
+        if (xwb->entry_elem_size == 0x04) {
+            unpack_compact(entries, xwb->streams_count, !xwb->little_endian, sectors, deviations);
+        }
+        else {
+            for (i = 0; i < xwb->streams_count; i++) {
+                uint32_t entry = read_32(entries + i * xwb->entry_elem_size);
+                sectors[i] = entry & COMPACT_SECTOR_MASK;
+                deviations[i] = entry >> COMPACT_DEVIATION_SHIFT;
+            }
+        }
+
+        for (i = 0; i < xwb->streams_count; i++) {
+            xwb_stream *s = &(xwb->xwb_streams[i]);
+            off_t next_stream_offset;
+
+            s->stream_offset = xwb->data_offset + (off_t)sectors[i]*xwb->entry_alignment;
+            if (i+1 < xwb->streams_count)
+                next_stream_offset = xwb->data_offset + (off_t)sectors[i+1]*xwb->entry_alignment;
+            else /* for last entry (or first, when subsongs = 1) */
+                next_stream_offset = xwb->data_offset + xwb->data_size;
+            s->stream_size = next_stream_offset - s->stream_offset - deviations[i];
+        }
+
+        free(sectors);
+        return 1;
+    }
+
+    /* WAVEBANKENTRY: flags+duration, (format), play region offset + size, (loop region) */
+    for (i = 0; i < xwb->streams_count; i++) {
+        xwb_stream *s = &(xwb->xwb_streams[i]);
+        const unsigned char * entry = entries + i * xwb->entry_elem_size;
+
+        if (xwb->version <= XACT1_0_MAX) {
+            s->stream_offset   = xwb->data_offset + read_32(entry + 0x04);
+            s->stream_size     = read_32(entry + 0x08);
+        }
+        else {
+            s->stream_offset   = xwb->data_offset + read_32(entry + 0x08);
+            s->stream_size     = read_32(entry + 0x0c);
+        }
+    }
+    return 1;
+}
+
+static int parse_xsb(xwb_context * ctx) {
+    xwb_options * opts = &ctx->opts;
+    int ret;
+
+    if (opts->ignore_xsb_name || opts->ignore_xsb_xwb_name)
+        return XWB_OK;
+
+    ret = read_xsb(ctx);
+    if (ret != XWB_OK)
+        return ret;
+    return select_wavebank(ctx);
+}
+
+/**
+ * Checks the .xsb against the .xwb
+ */
+static int check_xsb(xwb_context * ctx) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_options * opts = &ctx->opts;
+
+    /* check XSB versions */
+    CHECK_XWB(XWB_ERROR_XSB,  (xwb->version <= XACT1_1_MAX && xwb->xsb_version > XSB_XACT1_MAX) || (xwb->version <= XACT2_2_MAX && xwb->xsb_version > XSB_XACT2_MAX)
+            , "ERROR: xsb and xwb are from different XACT versions (xsb v%i vs xwb v%i)", xwb->xsb_version, xwb->version);
+
+    CHECK_XWB(XWB_ERROR_XSB, !opts->ignore_names_not_found && xwb->xsb_sounds_count < xwb->streams_count, "ERROR: number of streams in xsb lower than xwb (xsb %i vs xwb %i), use -n to ignore", (int)xwb->xsb_sounds_count, (int)xwb->streams_count);
+    return XWB_OK;
+}
+
+/**
+ * Reads the .xsb sounds, names and wavebanks (checked against the .xwb when there is one)
+ */
+static int read_xsb(xwb_context * ctx) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_options * opts = &ctx->opts;
+    reader * streamFile = ctx->xsb_file;
+    off_t off, suboff;
+    int i;
+    int xsb_version, xsb_little_endian;
+    off_t names_start, wavebank_names_offset;
+    size_t names_size;
+    uint32_t (*read_32bit)(off_t,reader*) = NULL;
+    uint16_t (*read_16bit)(off_t,reader*) = NULL;
+
+
+    if ((read_32bitBE(0x00,streamFile) != 0x5344424B) &&    /* "SDBK" (LE) */
+        (read_32bitBE(0x00,streamFile) != 0x4B424453))      /* "KBDS" (BE) */
+        goto fail;
+
+
+    xsb_little_endian = read_32bitBE(0x00,streamFile) == 0x5344424B;/* SDBK */
+    if (xsb_little_endian) {
+        read_32bit = read_32bitLE;
+        read_16bit = read_16bitLE;
+    } else {
+        read_32bit = read_32bitBE;
+        read_16bit = read_16bitBE;
+    }
+
+
+    /* read main header (SoundBankHeader) */
+    xsb_version = read_16bit(0x04, streamFile);
+    xwb->xsb_version = xsb_version;
+
+    off = 0;
+    wavebank_names_offset = 0;
+    if (xsb_version <= XSB_XACT1_MAX) {
+        xwb->xsb_wavebanks_count = 1; //read_8bit(0x22, streamFile);
+        xwb->xsb_sounds_count = read_16bit(0x1e, streamFile);//@ 0x1a? 0x1c?
+        //xwb->xsb_names_size   = 0;
+        //xwb->xsb_names_offset = 0;
+        xwb->xsb_nameoffsets_offset = 0;
+        xwb->xsb_sounds_offset = 0x38;
+    } else if (xsb_version <= XSB_XACT2_MAX) {
+        xwb->xsb_simple_sounds_count = read_16bit(0x09, streamFile);
+        xwb->xsb_complex_sounds_count = read_16bit(0x0B, streamFile);
+        xwb->xsb_wavebanks_count = read_8bit(0x11, streamFile);
+        xwb->xsb_sounds_count = read_16bit(0x12, streamFile);
+        //0x14: 16b unk
+        //xwb->xsb_names_size   = read_32bit(0x16, streamFile);
+        xwb->xsb_simple_sounds_offset = read_32bit(0x1a, streamFile);
+        xwb->xsb_complex_sounds_offset = read_32bit(0x1e, streamFile); //todo 0x1e?
+        //xwb->xsb_names_offset = read_32bit(0x22, streamFile);
+        wavebank_names_offset = read_32bit(0x32, streamFile); /* XACT3's, moved like the others */
+        xwb->xsb_nameoffsets_offset = read_32bit(0x3a, streamFile);
+        xwb->xsb_sounds_offset = read_32bit(0x3e, streamFile);
+    } else {
+        xwb->xsb_simple_sounds_count = read_16bit(0x13, streamFile);
+        xwb->xsb_complex_sounds_count = read_16bit(0x15, streamFile);
+        xwb->xsb_wavebanks_count = read_8bit(0x1b, streamFile);
+        xwb->xsb_sounds_count = read_16bit(0x1c, streamFile);
+        //xwb->xsb_names_size   = read_32bit(0x1e, streamFile);
+        xwb->xsb_simple_sounds_offset = read_32bit(0x22, streamFile);
+        xwb->xsb_complex_sounds_offset = read_32bit(0x26, streamFile);
+        //xwb->xsb_names_offset = read_32bit(0x2a, streamFile);
+        wavebank_names_offset = read_32bit(0x3a, streamFile);
+        xwb->xsb_nameoffsets_offset = read_32bit(0x42, streamFile);
+        xwb->xsb_sounds_offset = read_32bit(0x46, streamFile);
+    }
+
+    if (ctx->xwb_file) {
+        int ret = check_xsb(ctx);
+        if (ret != XWB_OK)
+            return ret;
+    }
+
+    CHECK_XWB(XWB_ERROR_XSB, !opts->ignore_cue_totals && xwb->xsb_simple_sounds_count + xwb->xsb_complex_sounds_count != xwb->xsb_sounds_count, "ERROR: number of xsb sounds doesn't match simple + complex sounds (simple %i, complex %i, total %i), use -c to ignore", (int)xwb->xsb_simple_sounds_count, (int)xwb->xsb_complex_sounds_count, (int)xwb->xsb_sounds_count);
+
+    /* init stuff */
+    xwb->xsb_sounds = calloc(xwb->xsb_sounds_count, sizeof(xsb_sound));
+    if (!xwb->xsb_sounds) goto fail;
+
+    xwb->xsb_wavebanks = calloc(xwb->xsb_wavebanks_count, sizeof(xsb_wavebank));
+    if (!xwb->xsb_wavebanks) goto fail;
+
+    /* wavebank names (as the banks' own names), 0x40 each */
+    if (wavebank_names_offset && wavebank_names_offset + xwb->xsb_wavebanks_count * 0x40 <= reader_size(streamFile)) {
+        for (i = 0; i < xwb->xsb_wavebanks_count; i++) {
+            get_bytes_at(wavebank_names_offset + i*0x40, streamFile, (unsigned char *)xwb->xsb_wavebanks[i].name, 0x40);
+        }
+    }
+
+    /* The following is a bizarre soup of flags, tables, offsets to offsets and stuff, just to get the actual name.
+     * info: https://wiki.multimedia.cx/index.php/XACT */
+
+    /* parse xsb sounds */
+    off = xwb->xsb_sounds_offset;
+    for (i = 0; i < xwb->xsb_sounds_count; i++) {
+        xsb_sound *s = &(xwb->xsb_sounds[i]);
+        uint32_t flag;
+        size_t size;
+
+        if (xsb_version <= XSB_XACT1_MAX) {
+            /* The format seems constant */
+            flag = read_8bit(off+0x00, streamFile);
+            size = 0x14;
+
+            CHECK_XWB(XWB_ERROR_XSB, flag != 0x01, "ERROR: xsb flag 0x%x at offset 0x%08"PRIx64" not implemented", flag, (uint64_t)off);
+
+            s->wavebank     = 0; //read_8bit(off+suboff + 0x02, streamFile);
+            s->stream_index = read_16bit(off+0x02, streamFile);
+            s->sound_offset = off;
+            s->name_offset  = read_16bit(off+0x04, streamFile);
+        }
+        else {
+            /* Each XSB sound has a variable size and somewhere inside is the stream/wavebank index.
+             * Various flags control the sound layout, but I can't make sense of them so quick hack instead */
+            flag = read_8bit(off+0x00, streamFile);
+            //0x01 16b unk, 0x03: 8b unk 04: 16b unk, 06: 8b unk
+            size = read_16bit(off+0x07, streamFile);
+
+            if (!(flag & 0x01)) { /* simple sound */
+                suboff = 0x09;
+            } else { /* complex sound */
+                /* not very exact but seems to work */
+                if (flag==0x01 || flag==0x03 || flag==0x05 || flag==0x07) {
+                    if (size == 0x49) { //grotesque hack for Eschatos (these flags are way too complex)
+                        suboff = 0x23;
+                    } else if (size % 2 == 1 && read_16bit(off+size-0x2, streamFile)!=0) {
+                        suboff = size - 0x08 - 0x07; //7 unk bytes at the end
+                    } else {
+                        suboff = size - 0x08;
+                    }
+                } else {
+                    CHECK_XWB(XWB_ERROR_XSB, 1, "ERROR: xsb flag 0x%x at offset 0x%08"PRIx64" not implemented", flag, (uint64_t)off);
+                }
+            }
+
+            s->stream_index = read_16bit(off+suboff + 0x00, streamFile);
+            s->wavebank     =  read_8bit(off+suboff + 0x02, streamFile);
+            s->sound_offset = off;
+        }
+
+        CHECK_XWB(XWB_ERROR_XSB, s->wavebank+1 > xwb->xsb_wavebanks_count, "ERROR: unknown xsb wavebank id %i at offset 0x%"PRIx64, s->wavebank, (uint64_t)off);
+
+        xwb->xsb_wavebanks[s->wavebank].sound_count += 1;
+        off += size;
+    }
+
+
+    /* parse name offsets */
+    if (xsb_version > XSB_XACT1_MAX) {
+#if 1
+        /* "cue" name order: first simple sounds, then complex sounds
+         * Both aren't ordered like the sound entries, instead use a global offset to the entry
+         *
+         * ex. of a possible XSB:
+         *   name 1 = simple  sound 1 > sound entry 2 (points to xwb stream 4): stream 4 uses name 1
+         *   name 2 = simple  sound 2 > sound entry 1 (points to xwb stream 1): stream 1 uses name 2
+         *   name 3 = complex sound 1 > sound entry 3 (points to xwb stream 3): stream 3 uses name 3
+         *   name 4 = complex sound 2 > sound entry 4 (points to xwb stream 2): stream 2 uses name 4
+         *
+         * Multiple cues can point to the same sound entry but we only use the first name (meaning some won't be used) */
+        off_t n_off = xwb->xsb_nameoffsets_offset;
+
+        off = xwb->xsb_simple_sounds_offset;
+        for (i = 0; i < xwb->xsb_simple_sounds_count; i++) {
+            off_t sound_offset = read_32bit(off + 0x01, streamFile);
+            xsb_sound *s;
+            if (opts->debug) printf("XSB simple %i: off=%04"PRIx64", s.off=%04"PRIx64", n.off=%04"PRIx64"\n", i, (uint64_t)off, (uint64_t)sound_offset, (uint64_t)n_off);
+            off += 0x05;
+
+            /* find sound by offset and update with the current name offset */
+            s = find_unnamed_xsb_sound(xwb, sound_offset);
+            if (s) {
+                s->name_offset = read_32bit(n_off + 0x00, streamFile);
+                s->unk_index  = read_16bit(n_off + 0x04, streamFile);
+                n_off += 0x06;
+            }
+        }
+
+        off = xwb->xsb_complex_sounds_offset;
+        for (i = 0; i < xwb->xsb_complex_sounds_count; i++) {
+            off_t sound_offset = read_32bit(off + 0x01, streamFile);
+            xsb_sound *s;
+            if (opts->debug) printf("XSB complex %i: off=%04"PRIx64", s.off=%04"PRIx64", n.off=%04"PRIx64"\n", i, (uint64_t)off, (uint64_t)sound_offset, (uint64_t)n_off);
+            off += 0x0f;
+
+            /* find sound by offset and update with the current name offset */
+            s = find_unnamed_xsb_sound(xwb, sound_offset);
+            if (s) {
+                s->name_offset = read_32bit(n_off + 0x00, streamFile);
+                s->unk_index  = read_16bit(n_off + 0x04, streamFile);
+                n_off += 0x06;
+            }
+        }
+#endif
+#if 0
+        off = xwb->xsb_nameoffsets_offset;
+        /* lineal name order, disregarding wavebanks */
+        for (i = 0; i < xwb->xsb_sounds_count; i++) {
+            xsb_sound *s = &(xwb->xsb_sounds[i]);;
+
+            s->name_offset = read_32bit(off + 0x00, streamFile);
+            s->unk_index  = read_16bit(off + 0x04, streamFile);
+            off += 0x04 + 0x02;
+        }
+#endif
+#if 0
+        off = xwb->xsb_nameoffsets_offset;
+        /* wavebank name order: first all names from bank 0, then 1, etc
+         * rarely a XSB may bank sound0-bank0, sound1-bank1, sound2-bank0 etc */
+        for (i = 0; i < xwb->xsb_wavebanks_count; i++) { //wavebanks
+            int sound = 0;
+            for (int j = 0; j < xwb->xsb_wavebanks[i].sound_count; j++) { //sounds in wavebank
+                for (int k = sound; k < xwb->xsb_sounds_count; k++) {//find wavebank sound in global sound list
+                    xsb_sound *s = &(xwb->xsb_sounds[k]);
+                    if (s->wavebank==i) {
+                        s->name_offset = read_32bit(off + 0x00, streamFile);
+
+                        off += 0x04 + 0x02;
+                        sound = k+1;
+                        break;
+                    }
+                }
+            }
+        }
+#endif
+    }
+
+    /* load all names with a single read (they are null-terminated and placed near the end),
+     * each sound then points into the table */
+    names_start = 0;
+    for (i = 0; i < xwb->xsb_sounds_count; i++) {
+        xsb_sound *s = &(xwb->xsb_sounds[i]);
+        if (s->name_offset && (!names_start || s->name_offset < names_start))
+            names_start = s->name_offset;
+    }
+
+    if (names_start) {
+        CHECK_XWB(XWB_ERROR_XSB, names_start >= reader_size(streamFile), "ERROR: xsb name offset 0x%08"PRIx64" out of bounds", (uint64_t)names_start);
+
+        names_size = reader_size(streamFile) - names_start;
+        xwb->xsb_names = malloc(names_size + 1);
+        if (!xwb->xsb_names) goto fail;
+
+        get_bytes_at(names_start, streamFile, (unsigned char *)xwb->xsb_names, names_size);
+        xwb->xsb_names[names_size] = '\0';
+
+        for (i = 0; i < xwb->xsb_sounds_count; i++) {
+            xsb_sound *s = &(xwb->xsb_sounds[i]);
+            if (!s->name_offset)
+                continue;
+
+            CHECK_XWB(XWB_ERROR_XSB, s->name_offset >= reader_size(streamFile), "ERROR: xsb name offset 0x%08"PRIx64" out of bounds", (uint64_t)s->name_offset);
+            s->name = xwb->xsb_names + (s->name_offset - names_start);
+        }
+    }
+
+    if (opts->debug) {
+        for (i = 0; i < xwb->xsb_sounds_count; i++) {
+            xsb_sound *s = &(xwb->xsb_sounds[i]);;
+            printf("XSB w%i s%04i: stream %04i u.idx %04"PRIx64", s.off=%08"PRIx64", n.off=%08"PRIx64"\n", s->wavebank, i, s->stream_index, (uint64_t)s->unk_index, (uint64_t)s->sound_offset, (uint64_t)s->name_offset);
+        }
+    }
+
+
+    return check_read(ctx, ctx->xsb_file);
+fail:
+    CHECK_XWB(XWB_ERROR_XSB, 1, "ERROR: generic error parsing XSB");
+    return XWB_ERROR_XSB;
+}
+
+/**
+ * Selects the wavebank named for the .xwb, from -w or autodetected, and checks it against the .xwb
+ */
+static int select_wavebank(xwb_context * ctx) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_options * opts = &ctx->opts;
+    int i;
+
+    /* try to find correct wavebank, in cases of multiple */
+    if (!opts->selected_wavebank) {
+        for (i = 0; i < xwb->xsb_wavebanks_count; i++) {
+            xsb_wavebank *w = &(xwb->xsb_wavebanks[i]);
+            if (opts->verbose)
+                printf("XSB wavebank %i has %i sounds\n", i, w->sound_count);
+
+            //CHECK_XWB(XWB_ERROR_XSB, w->sound_count == 0, "ERROR: xsb wavebank %i has no sounds", i); //Ikaruga PC
+
+            if (w->sound_count == xwb->streams_count) {
+                CHECK_XWB(XWB_ERROR_XSB, opts->selected_wavebank, "ERROR: multiple xsb wavebanks with the same number of sounds, use -w to specify one of the wavebanks");
+
+                opts->selected_wavebank = i+1;
+            }
+        }
+    }
+
+    /* banks with different number of sounds but only one wavebank, just select the first */
+    if (!opts->selected_wavebank && xwb->xsb_wavebanks_count==1) {
+        opts->selected_wavebank = 1;
+    }
+
+    if (opts->verbose)
+        printf("Selected XSB wavebank %i\n", opts->selected_wavebank-1);
+
+    CHECK_XWB(XWB_ERROR_XSB, !opts->selected_wavebank, "ERROR: multiple xsb wavebanks but autodetect didn't work, use -w to specify one of the wavebanks");
+    CHECK_XWB(XWB_ERROR_XSB, xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count == 0, "ERROR: xsb selected wavebank %i has no sounds", opts->selected_wavebank-1);
+
+    if (opts->start_sound) {
+        CHECK_XWB(XWB_ERROR_XSB, xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count - (opts->start_sound-1) < xwb->streams_count, "ERROR: starting sound too high (max in selected wavebank is %i)", xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count - (int)xwb->streams_count + 1);
+    } else {
+        if (!opts->ignore_names_not_found)
+            CHECK_XWB(XWB_ERROR_XSB, xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count > xwb->streams_count, "ERROR: number of streams in xsb wavebank bigger than xwb (xsb %i vs xwb %i), use -s to specify (1=first)", xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count, (int)xwb->streams_count);
+        if (!opts->ignore_names_not_found)
+            CHECK_XWB(XWB_ERROR_XSB, xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count < xwb->streams_count, "ERROR: number of streams in xsb wavebank lower than xwb (xsb %i vs xwb %i), use -n to ignore (some names won't be extracted)", xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count, (int)xwb->streams_count);
+
+
+        //if (!opts->ignore_names_not_found)
+        //    CHECK_XWB(XWB_ERROR_XSB, xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count != xwb->streams_count, "ERROR: number of streams in xsb wavebank different than xwb (xsb %i vs xwb %i), use -s to specify (1=first)", xwb->xsb_wavebanks[opts->selected_wavebank-1].sound_count, xwb->streams_count);
+    }
+
+    return XWB_OK;
+}
+
+/**
+ * Sounds are parsed in file order, so xsb_sounds is already sorted by sound_offset and
+ * can be binary searched. Returns the first sound at that offset without a name yet.
+ */
+static xsb_sound * find_unnamed_xsb_sound(xwb_header * xwb, off_t sound_offset) {
+    size_t lo = 0, hi = xwb->xsb_sounds_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (xwb->xsb_sounds[mid].sound_offset < sound_offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (; lo < xwb->xsb_sounds_count && xwb->xsb_sounds[lo].sound_offset == sound_offset; lo++) {
+        if (!xwb->xsb_sounds[lo].name_offset)
+            return &(xwb->xsb_sounds[lo]);
+    }
+
+    return NULL;
+}
+
+/**
+ * Builds the part of the split header that is the same for every stream, once per bank.
+ * Each stream then copies it and patches its own values (see make_stream_header).
+ */
+int xwb_build_headers(xwb_context * ctx) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_options * opts = &ctx->opts;
+    void (*write_32bit)(uint32_t, unsigned char *) = NULL;
+    unsigned char * t;
+    size_t pos;
+
+    if (xwb->header_template)
+        return XWB_OK;
+
+    if (xwb->little_endian) {
+        write_32bit = write_32_le;
+    } else {
+        write_32bit = write_32_be;
+    }
+
+    if (xwb->version <= XACT1_0_MAX) {
+        /* main header + ENTRY segment (now single entry), as XACT v1 is very simple */
+        xwb->header_size = xwb->entry_offset + xwb->entry_elem_size;
+        xwb->header_entry_offset = xwb->entry_offset;
+        t = malloc(xwb->header_size);
+        CHECK_XWB(XWB_ERROR_MEMORY, !t, "ERROR: out of memory");
+
+        get_bytes_at(0x00, ctx->xwb_file, t, xwb->entry_offset);
+    }
+    else if (opts->alt_extraction) {
+        /* older extraction: main header as-is, even though we only need one of the streams (to simplify) */
+        xwb->header_size = xwb->data_offset;
+        t = malloc(xwb->header_size);
+        CHECK_XWB(XWB_ERROR_MEMORY, !t, "ERROR: out of memory");
+
+        get_bytes_at(0x00, ctx->xwb_file, t, xwb->header_size);
+    }
+    else {
+        /* creates a new header ignoring extra tables, less tested */
+        off_t new_entry_offset = xwb->base_offset + xwb->base_size;
+        off_t new_data_offset = new_entry_offset + xwb->entry_elem_size;  /*xwb->data_offset*/
+        size_t head_size = xwb->version <= XACT2_2_MAX ? 0x08 : 0x0c;
+        size_t segments_size = (xwb->version <= XACT1_1_MAX ? 0x08 : 0x0a) * 0x04;
+
+        xwb->header_size = head_size + segments_size + xwb->base_size + xwb->entry_elem_size;
+        t = calloc(1, xwb->header_size);
+        CHECK_XWB(XWB_ERROR_MEMORY, !t, "ERROR: out of memory");
+
+        /* copy base header */
+        get_bytes_at(0x00, ctx->xwb_file, t, head_size);
+        pos = head_size;
+
+        write_32bit(xwb->base_offset, t+pos);//BANKDATA
+        write_32bit(xwb->base_size, t+pos+0x04);
+        write_32bit(new_entry_offset, t+pos+0x08);//ENTRYMETADATA
+        write_32bit(xwb->entry_elem_size, t+pos+0x0c); /* single entry size */
+        pos += 0x10;
+
+        /* other segments (0 = unused) */
+        if (xwb->version <= XACT1_1_MAX) {
+            pos += 0x08;//XACT1: ENTRYNAMES //todo
+        } else if (xwb->version <= XACT2_2_MAX) {
+            pos += 0x08;//XACT2: ENTRYNAMES//todo
+            pos += 0x08;//XACT2: EXTRA//todo
+        } else {
+            pos += 0x08;//XACT3: SEEKTABLES//XWMA/XMA seek tables (not needed, though)
+            pos += 0x08;//XACT3: ENTRYNAMES//todo
+        }
+        write_32bit(new_data_offset, t+pos);//ENTRYWAVEDATA
+        xwb->header_data_size_offset = pos + 0x04; /* single entry data size, set per stream */
+        pos += 0x08;
+
+        /* copy base entry */
+        get_bytes_at(xwb->base_offset, ctx->xwb_file, t+pos, xwb->base_size);
+        pos += xwb->base_size;
+
+        /* main entry, set per stream */
+        xwb->header_entry_offset = pos;
+    }
+
+    xwb->header_template = t;
+    return check_read(ctx, ctx->xwb_file);
+}
+
+/* returns 0 if the value doesn't fit (with the error set) */
+static int patch_32bit(xwb_context * ctx, unsigned char * header, off_t offset, uint32_t value) {
+    xwb_header * xwb = &ctx->xwb;
+
+    if (offset < 0 || offset + 0x04 > xwb->header_size) {
+        snprintf(ctx->error, sizeof(ctx->error), "ERROR: split header value at 0x%"PRIx64" out of header bounds (try -a)", (uint64_t)offset);
+        return 0;
+    }
+
+    if (xwb->little_endian)
+        write_32_le(value, header + offset);
+    else
+        write_32_be(value, header + offset);
+    return 1;
+}
+
+int xwb_make_header(xwb_context * ctx, int num_stream, unsigned char ** buf, size_t * buf_size) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_options * opts = &ctx->opts;
+    unsigned char * h;
+    xwb_stream *s;
+    int ok = 1;
+    off_t entry_offset = xwb->entry_offset + num_stream*xwb->entry_elem_size;
+    off_t off;
+    /* use extra space in the base flags to store original num_stream and extra flag to identify split XWBs
+     *  (better to tell them apart when bugfixing) */
+    uint32_t flags = xwb->base_flags | 0x00008000 | ((num_stream>0xFF? 0xFF : num_stream)<<24);
+
+    CHECK_XWB(XWB_ERROR_ARGS, num_stream < 0 || num_stream >= xwb->streams_count, "ERROR: stream %i doesn't exist", num_stream);
+    s = &(xwb->xwb_streams[num_stream]);
+
+    if (!xwb->header_template) {
+        int ret = xwb_build_headers(ctx);
+        if (ret != XWB_OK)
+            return ret;
+    }
+
+    if (*buf_size < xwb->header_size) {
+        h = realloc(*buf, xwb->header_size);
+        CHECK_XWB(XWB_ERROR_MEMORY, !h, "ERROR: out of memory");
+        *buf = h;
+        *buf_size = xwb->header_size;
+    }
+    h = *buf;
+    memcpy(h, xwb->header_template, xwb->header_size);
+
+    if (xwb->version <= XACT1_0_MAX) {
+        /* ENTRY segment (now single entry) */
+        get_bytes_at(entry_offset, ctx->xwb_file, h + xwb->header_entry_offset, xwb->entry_elem_size);
+
+        ok &= patch_32bit(ctx, h, 0x0c, 1); /* 1 stream */
+    }
+    else if (opts->alt_extraction) {
+        /* change the few offsets needed to point to the stream */
+        off = 0x04 + (xwb->version <= XACT2_2_MAX ? 0x04 : 0x08) + 0x04+0x04; //segments offset
+
+        /* ENTRY segment (now single entry) */
+        ok &= patch_32bit(ctx, h, off+0x00, entry_offset);
+        ok &= patch_32bit(ctx, h, off+0x04, xwb->entry_elem_size);
+
+        /* other segments */
+        if (xwb->version <= XACT1_1_MAX) {
+            if (xwb->extra1_offset && xwb->extra1_size) {//XACT1: ENTRYNAMES
+                ok &= patch_32bit(ctx, h, off+0x08, xwb->extra1_offset + num_stream*xwb->name_elem_size);
+                ok &= patch_32bit(ctx, h, off+0x0c, xwb->name_elem_size);
+            }
+            off += 0x10;
+        } else if (xwb->version <= XACT2_2_MAX) {//todo XACT2 < v40 may use extra1 as names offset
+            if (xwb->extra1_offset && xwb->extra1_size) {//XACT2: SEEKTABLES (v40)
+                //0x08, 0x0c: no idea
+            }
+            if (xwb->extra2_offset && xwb->extra2_size) {//XACT2: ENTRYNAMES
+                ok &= patch_32bit(ctx, h, off+0x10, xwb->extra2_offset + num_stream*xwb->name_elem_size);
+                ok &= patch_32bit(ctx, h, off+0x14, xwb->name_elem_size);
+            }
+            off += 0x18;
+        } else {
+            if (xwb->extra1_offset && xwb->extra1_size) {//XACT3: SEEKTABLES
+                //0x08, 0x0c: no idea
+            }
+            if (xwb->extra2_offset && xwb->extra2_size) {//XACT3: ENTRYNAMES
+                ok &= patch_32bit(ctx, h, off+0x10, xwb->extra2_offset + num_stream*xwb->name_elem_size);//XACT2: EXTRA
+                ok &= patch_32bit(ctx, h, off+0x14, xwb->name_elem_size);
+            }
+            off += 0x18;
+        }
+
+        /* ENTRYWAVEDATA segment */
+        //patch_32bit(ctx, h, off+0x00, xwb->data_offset);
+        ok &= patch_32bit(ctx, h, off+0x04, s->stream_size);
+
+        /* stream entry, now at offset 0 */
+        if (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) {
+            ok &= patch_32bit(ctx, h, entry_offset+0x00, 0);
+        } else {
+            ok &= patch_32bit(ctx, h, entry_offset+0x08, 0);
+        }
+
+        ok &= patch_32bit(ctx, h, xwb->base_offset, flags);
+        ok &= patch_32bit(ctx, h, xwb->base_offset+0x04, 1); /* only 1 stream now */
+
+        //todo offset to seek tables 
+        // format: 
+        // - stream X has N ints
+        // - when int is less than prev: new stream Y
+    }
+    else {
+        off_t new_entry_offset = xwb->base_offset + xwb->base_size;
+        size_t new_data_size = s->stream_size;
+        if (xwb->is_stardew_valley) {
+            new_data_size = xwb->data_size;
+        }
+
+        ok &= patch_32bit(ctx, h, xwb->header_data_size_offset, new_data_size); /* single entry data size */
+
+        /* main entry */
+        get_bytes_at(entry_offset, ctx->xwb_file, h + xwb->header_entry_offset, xwb->entry_elem_size);
+
+        ok &= patch_32bit(ctx, h, xwb->base_offset, flags);
+        ok &= patch_32bit(ctx, h, xwb->base_offset+0x04, 1); /* only 1 stream now */
+
+        /* change starting offset to 0 */
+        if (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) { /* compact entry */
+            /* read original compact entry and remove 21b of sector offset, leaving size_deviation */
+            uint32_t entry = xwb->little_endian ? read_32bitLE(entry_offset+0x00, ctx->xwb_file) : read_32bitBE(entry_offset+0x00, ctx->xwb_file);
+            entry = (entry & 0xFFE00000);
+
+            ok &= patch_32bit(ctx, h, new_entry_offset+0x00, entry);
+        }
+        else {
+            ok &= patch_32bit(ctx, h, new_entry_offset+0x08, 0);
+        }
+    }
+
+    if (!ok)
+        return XWB_ERROR_HEADER;
+    return check_read(ctx, ctx->xwb_file);
+}
+
+/* codecs of WAVEBANKMINIWAVEFORMAT's tag, which changes meaning between XACT versions */
+enum {
+    CODEC_PCM,
+    CODEC_XBOX_ADPCM,   /* XACT1 */
+    CODEC_MSADPCM,      /* XACT2/3 */
+    CODEC_XMA1,         /* XACT2 */
+    CODEC_XMA2,         /* XACT3 */
+    CODEC_WMA,
+};
+
+static const char * codec_names[] = { "PCM", "Xbox ADPCM", "MS ADPCM", "XMA1", "XMA2", "WMA" };
+
+#define XMA2_BLOCK_SIZE         0x10000     /* fixed in XACT */
+#define ADPCM_BLOCK_ALIGN_BASE  22          /* MS ADPCM wBlockAlign is stored minus this, per channel */
+#define SEEK_NONE               0xFFFFFFFF
+
+static const int16_t msadpcm_coefs[7][2] = {
+    {256, 0}, {512, -256}, {0, 0}, {192, 64}, {240, 0}, {460, -208}, {392, -232}
+};
+
+/* default speaker layouts for 0..8 channels */
+static const uint32_t channel_masks[9] = { 0, 0x4, 0x3, 0x7, 0x33, 0x37, 0x3F, 0x13F, 0x63F };
+
+/**
+ * A stream's format, from its WAVEBANKMINIWAVEFORMAT (or the bank's, for compact banks) and entry.
+ */
+typedef struct {
+    int codec;
+    int channels;
+    int sample_rate;
+    int block_align; /* as stored, meaning depends on the codec */
+    int bits; /* PCM: 1 = 16-bit, 0 = 8-bit */
+    uint32_t samples; /* 0 if unknown (XACT1, compact) */
+    uint32_t loop_start; /* samples, XACT3 only */
+    uint32_t loop_length;
+} riff_format;
+
+static void read_format(xwb_context * ctx, int num_stream, riff_format * fmt) {
+    xwb_header * xwb = &ctx->xwb;
+    reader * streamFile = ctx->xwb_file;
+    uint32_t (*read_32bit)(off_t,reader*) = xwb->little_endian ? read_32bitLE : read_32bitBE;
+    off_t entry_offset = xwb->entry_offset + num_stream*xwb->entry_elem_size;
+    uint32_t format, info = 0;
+    int tag;
+
+    memset(fmt, 0, sizeof(riff_format));
+
+    if (xwb->version <= XACT1_0_MAX) {
+        format = read_32bit(entry_offset+0x00, streamFile);
+    }
+    else if (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) {
+        /* one format for the whole bank, after the alignment in WAVEBANKDATA */
+        off_t suboff = 0x08 + (xwb->version <= XACT1_1_MAX ? 0x10 : 0x40);
+        format = read_32bit(xwb->base_offset+suboff+0x0c, streamFile);
+    }
+    else {
+        info = read_32bit(entry_offset+0x00, streamFile);
+        format = read_32bit(entry_offset+0x04, streamFile);
+        if (xwb->version > XACT2_2_MAX && xwb->entry_elem_size >= 0x18) {
+            fmt->loop_start = read_32bit(entry_offset+0x10, streamFile);
+            fmt->loop_length = read_32bit(entry_offset+0x14, streamFile);
+        }
+    }
+
+    if (xwb->version <= XACT1_1_MAX) {
+        /* Xbox: 2b tag, 3b channels, 26b sample rate, 1b bits */
+        tag = format & 0x3;
+        fmt->channels = (format >> 2) & 0x7;
+        fmt->sample_rate = (format >> 5) & 0x3FFFFFF;
+        fmt->bits = (format >> 31) & 0x1;
+        fmt->codec = tag == 0 ? CODEC_PCM : (tag == 1 ? CODEC_XBOX_ADPCM : CODEC_WMA);
+        return;
+    }
+
+    /* 2b tag, 3b channels, 18b sample rate, 8b block align, 1b bits. X360 banks store the same
+     * values byte-swapped (XACT swaps the whole dword), like the compact entries' bitfields */
+    tag = format & 0x3;
+    fmt->channels = (format >> 2) & 0x7;
+    fmt->sample_rate = (format >> 5) & 0x3FFFF;
+    fmt->block_align = (format >> 23) & 0xFF;
+    fmt->bits = (format >> 31) & 0x1;
+    fmt->samples = info >> 4; /* after 4b flags */
+
+    switch (tag) {
+        case 0: fmt->codec = CODEC_PCM; break;
+        case 1: fmt->codec = xwb->version <= XACT2_2_MAX ? CODEC_XMA1 : CODEC_XMA2; break;
+        case 2: fmt->codec = CODEC_MSADPCM; break;
+        default: fmt->codec = CODEC_WMA; break;
+    }
+}
+
+/**
+ * Finds the stream's XACT3 seek table (SEEKTABLES: an offset per stream, then each table as
+ * a count and that many values), returns the values' offset or 0 if there isn't one.
+ */
+static off_t find_seek_table(xwb_context * ctx, int num_stream, uint32_t * count) {
+    xwb_header * xwb = &ctx->xwb;
+    reader * streamFile = ctx->xwb_file;
+    uint32_t (*read_32bit)(off_t,reader*) = xwb->little_endian ? read_32bitLE : read_32bitBE;
+    off_t tables = xwb->extra1_offset + xwb->streams_count * 0x04;
+    off_t end = xwb->extra1_offset + xwb->extra1_size;
+    uint32_t table_offset;
+
+    *count = 0;
+    if (xwb->version <= XACT2_2_MAX || !xwb->extra1_offset || tables + 0x04 > end)
+        return 0;
+
+    table_offset = read_32bit(xwb->extra1_offset + num_stream*0x04, streamFile);
+    if (table_offset == SEEK_NONE || tables + table_offset + 0x04 > end)
+        return 0;
+
+    *count = read_32bit(tables + table_offset, streamFile);
+    if (*count > (end - tables - table_offset - 0x04) / 0x04) {
+        *count = 0;
+        return 0;
+    }
+    return tables + table_offset + 0x04;
+}
+
+static void put_riff_chunk(unsigned char * h, const char * id, uint32_t size) {
+    memcpy(h, id, 4);
+    write_32_le(size, h + 0x04);
+}
+
+/* WAVEFORMATEX, cbSize is set by the caller when there is more */
+static void put_waveformatex(unsigned char * h, int tag, int channels, int sample_rate, int block_align, int bits, uint32_t avg_bytes) {
+    write_16_le(tag, h + 0x00);
+    write_16_le(channels, h + 0x02);
+    write_32_le(sample_rate, h + 0x04);
+    write_32_le(avg_bytes, h + 0x08);
+    write_16_le(block_align, h + 0x0c);
+    write_16_le(bits, h + 0x0e);
+}
+
+int xwb_riff_swap16(xwb_context * ctx, int num_stream) {
+    riff_format fmt;
+
+    if (ctx->xwb.little_endian || num_stream < 0 || num_stream >= ctx->xwb.streams_count)
+        return 0;
+    read_format(ctx, num_stream, &fmt);
+    return fmt.codec == CODEC_PCM && fmt.bits;
+}
+
+int xwb_make_riff(xwb_context * ctx, int num_stream, unsigned char ** buf, size_t * buf_size, size_t * header_size) {
+    xwb_header * xwb = &ctx->xwb;
+    riff_format fmt;
+    xwb_stream * s;
+    unsigned char * h;
+    size_t fmt_size, size;
+    off_t seek_offset = 0;
+    uint32_t seek_count = 0, i;
+    int block_align, samples_per_block;
+    int ret;
+
+    CHECK_XWB(XWB_ERROR_ARGS, num_stream < 0 || num_stream >= xwb->streams_count, "ERROR: stream %i doesn't exist", num_stream);
+    s = &(xwb->xwb_streams[num_stream]);
+
+    read_format(ctx, num_stream, &fmt);
+    ret = check_read(ctx, ctx->xwb_file);
+    if (ret != XWB_OK)
+        return ret;
+
+    CHECK_XWB(XWB_ERROR_HEADER, fmt.codec != CODEC_PCM && fmt.codec != CODEC_XBOX_ADPCM && fmt.codec != CODEC_MSADPCM && fmt.codec != CODEC_XMA2,
+            "ERROR: stream %i is %s, which can't be written as RIFF", num_stream, codec_names[fmt.codec]);
+    CHECK_XWB(XWB_ERROR_HEADER, fmt.channels == 0 || fmt.sample_rate == 0, "ERROR: stream %i has a bad format", num_stream);
+    CHECK_XWB(XWB_ERROR_HEADER, s->stream_size > 0xFFFFFFFF - 0x1000, "ERROR: stream %i too big for RIFF", num_stream);
+
+    switch (fmt.codec) {
+        case CODEC_PCM: fmt_size = 0x10; break;
+        case CODEC_XBOX_ADPCM: fmt_size = 0x14; break;
+        case CODEC_MSADPCM: fmt_size = 0x32; break;
+        default: /* XMA2 */
+            fmt_size = 0x34;
+            seek_offset = find_seek_table(ctx, num_stream, &seek_count);
+            break;
+    }
+
+    /* RIFF, fmt, (seek,) data header */
+    size = 0x0c + 0x08 + fmt_size + (seek_offset ? 0x08 + seek_count * 0x04 : 0) + 0x08;
+    if (*buf_size < size) {
+        h = realloc(*buf, size);
+        CHECK_XWB(XWB_ERROR_MEMORY, !h, "ERROR: out of memory");
+        *buf = h;
+        *buf_size = size;
+    }
+    h = *buf;
+    memset(h, 0, size);
+
+    /* odd data chunks are followed by a pad byte, counted in RIFF but not in data */
+    put_riff_chunk(h + 0x00, "RIFF", size - 0x08 + s->stream_size + (s->stream_size & 1));
+    memcpy(h + 0x08, "WAVE", 4);
+    put_riff_chunk(h + 0x0c, "fmt ", fmt_size);
+    h += 0x14;
+
+    switch (fmt.codec) {
+        case CODEC_PCM:
+            block_align = fmt.channels * (fmt.bits ? 2 : 1);
+            put_waveformatex(h, 0x0001, fmt.channels, fmt.sample_rate, block_align, fmt.bits ? 16 : 8, fmt.sample_rate * block_align);
+            break;
+
+        case CODEC_XBOX_ADPCM:
+            block_align = 0x24 * fmt.channels;
+            put_waveformatex(h, 0x0069, fmt.channels, fmt.sample_rate, block_align, 4, fmt.sample_rate * block_align / 64);
+            write_16_le(0x02, h + 0x10);
+            write_16_le(64, h + 0x12); /* samples per block */
+            break;
+
+        case CODEC_MSADPCM:
+            block_align = (fmt.block_align + ADPCM_BLOCK_ALIGN_BASE) * fmt.channels;
+            samples_per_block = block_align * 2 / fmt.channels - 12;
+            put_waveformatex(h, 0x0002, fmt.channels, fmt.sample_rate, block_align, 4, fmt.sample_rate * block_align / samples_per_block);
+            write_16_le(0x20, h + 0x10);
+            write_16_le(samples_per_block, h + 0x12);
+            write_16_le(7, h + 0x14);
+            for (i = 0; i < 7; i++) {
+                write_16_le(msadpcm_coefs[i][0], h + 0x16 + i*0x04);
+                write_16_le(msadpcm_coefs[i][1], h + 0x18 + i*0x04);
+            }
+            break;
+
+        default: /* XMA2WAVEFORMATEX */
+            block_align = fmt.channels * 2;
+            put_waveformatex(h, 0x0166, fmt.channels, fmt.sample_rate, block_align, 16, fmt.sample_rate * block_align);
+            write_16_le(0x22, h + 0x10);
+            write_16_le((fmt.channels + 1) / 2, h + 0x12); /* streams */
+            write_32_le(channel_masks[fmt.channels], h + 0x14);
+            write_32_le(fmt.samples, h + 0x18);
+            write_32_le(XMA2_BLOCK_SIZE, h + 0x1c);
+            /* 0x20: play begin, 0x24: play length (0 = whole stream) */
+            if (fmt.loop_length) {
+                write_32_le(fmt.loop_start, h + 0x28);
+                write_32_le(fmt.loop_length, h + 0x2c);
+                h[0x30] = 0xFF; /* loop forever */
+            }
+            h[0x31] = 4; /* encoder version */
+            write_16_le((s->stream_size + XMA2_BLOCK_SIZE - 1) / XMA2_BLOCK_SIZE, h + 0x32);
+            break;
+    }
+    h += fmt_size;
+
+    /* XMA2 seek table: samples decoded by the end of each block, always big endian */
+    if (seek_offset) {
+        put_riff_chunk(h, "seek", seek_count * 0x04);
+        h += 0x08;
+        get_bytes_at(seek_offset, ctx->xwb_file, h, seek_count * 0x04);
+        for (i = 0; i < seek_count; i++, h += 0x04) {
+            write_32_be(xwb->little_endian ? read_32_le(h) : read_32_be(h), h);
+        }
+    }
+
+    put_riff_chunk(h, "data", s->stream_size);
+
+    *header_size = size;
+    return check_read(ctx, ctx->xwb_file);
+}
+
+
+/**
+ * Sets each stream's XSB name once, so naming a stream doesn't need to search.
+ */
+static void resolve_names(xwb_context * ctx) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_options * opts = &ctx->opts;
+    int i;
+    int start_sound = opts->start_sound ? opts->start_sound-1 : 0;
+
+    if (opts->ignore_xsb_name || opts->ignore_xsb_xwb_name)
+        return;
+
+    /* each stream uses the first sound of the selected wavebank that points to it (from the start sound),
+     * so go backwards and let earlier sounds overwrite later ones */
+    for (i = xwb->xsb_sounds_count - 1; i >= start_sound; i--) {
+        xsb_sound *s = &(xwb->xsb_sounds[i]);
+        xwb_stream *stream;
+
+        if (s->wavebank != opts->selected_wavebank-1 || s->stream_index >= xwb->streams_count)
+            continue;
+
+        stream = &(xwb->xwb_streams[s->stream_index]);
+        stream->name = s->name;
+        stream->name_offset = s->name_offset;
+    }
+}
+
+/* sidecar index: the parse result (stream table, names, header info) keyed by both files and the options */
+#define INDEX_MAGIC         0x49425758  /* "XWBI" */
+#define INDEX_VERSION       2
+#define INDEX_HASH_CHUNK    0x10000     /* bytes read at a time to hash the files */
+#define INDEX_KEYS          11
+#define INDEX_FIELDS        22
+#define INDEX_HEADER_SIZE   (0x08 + (INDEX_KEYS + INDEX_FIELDS + 1) * 0x08)
+#define INDEX_STREAM_SIZE   0x20        /* offset, size, xsb name offset, name position + padding */
+#define INDEX_NO_NAME       0xFFFFFFFF
+
+/**
+ * Gets what the index must match: size and mtime (to the ns where the OS has it) of both files,
+ * a hash of every byte parsing reads (the .xwb up to its wave data, the whole .xsb; catches changes
+ * that keep both) and the options that change the result.
+ * Returns 0 if the files can't be keyed (memory or pipe readers).
+ */
+static int get_index_key(xwb_context * ctx, const xwb_options * opts, uint64_t * key) {
+    reader * files[2];
+    xxh64_state hash;
+    unsigned char * buf;
+    int i;
+
+    files[0] = ctx->xwb_file;
+    files[1] = ctx->xsb_file;
+
+    buf = malloc(INDEX_HASH_CHUNK);
+    if (!buf)
+        return 0;
+    xxh64_init(&hash, 0);
+
+    memset(key,0,INDEX_KEYS * sizeof(uint64_t));
+    for (i = 0; i < 2; i++) {
+        reader * infile = files[i];
+        struct stat st;
+        off_t pos, end;
+
+        if (!infile)
+            continue;
+        if (infile->fd < 0 || infile->is_pipe || fstat(infile->fd, &st) != 0) {
+            free(buf);
+            return 0;
+        }
+
+        end = reader_size(infile);
+        /* a bad .xwb fails parsing anyway, the whole file will do for it */
+        if (i == 0 && xwb_header_end(infile, &end) == XWB_OK && end > reader_size(infile))
+            end = reader_size(infile);
+        for (pos = 0; pos < end; pos += INDEX_HASH_CHUNK) {
+            size_t size = end - pos < INDEX_HASH_CHUNK ? end - pos : INDEX_HASH_CHUNK;
+            get_bytes_at(pos, infile, buf, size);
+            xxh64_update(&hash, buf, size);
+        }
+
+        key[i*2 + 0] = st.st_size;
+        key[i*2 + 1] = stat_mtime_ns(&st);
+    }
+    free(buf);
+
+    key[4] = xxh64_digest(&hash);
+    key[5] = opts->selected_wavebank;
+    key[6] = opts->start_sound;
+    key[7] = opts->ignore_cue_totals;
+    key[8] = opts->ignore_xsb_name;
+    key[9] = opts->ignore_xsb_xwb_name;
+    key[10] = opts->multi_only;
+    return 1;
+}
+
+/* copies the parse values to or from the index, in index order */
+#define INDEX_FIELD(field) \
+    do { if (load) field = fields[i]; else fields[i] = field; i++; } while (0)
+
+static void copy_index_fields(xwb_context * ctx, uint64_t * fields, int load) {
+    xwb_header * xwb = &ctx->xwb;
+    int i = 0;
+
+    INDEX_FIELD(ctx->opts.selected_wavebank);
+    INDEX_FIELD(ctx->opts.ignore_xsb_name);
+    INDEX_FIELD(xwb->little_endian);
+    INDEX_FIELD(xwb->version);
+    INDEX_FIELD(xwb->base_offset);
+    INDEX_FIELD(xwb->base_size);
+    INDEX_FIELD(xwb->entry_offset);
+    INDEX_FIELD(xwb->entry_size);
+    INDEX_FIELD(xwb->extra1_offset);
+    INDEX_FIELD(xwb->extra1_size);
+    INDEX_FIELD(xwb->extra2_offset);
+    INDEX_FIELD(xwb->extra2_size);
+    INDEX_FIELD(xwb->data_offset);
+    INDEX_FIELD(xwb->data_size);
+    INDEX_FIELD(xwb->names_offset);
+    INDEX_FIELD(xwb->names_size);
+    INDEX_FIELD(xwb->base_flags);
+    INDEX_FIELD(xwb->entry_elem_size);
+    INDEX_FIELD(xwb->name_elem_size);
+    INDEX_FIELD(xwb->entry_alignment);
+    INDEX_FIELD(xwb->streams_count);
+    INDEX_FIELD(xwb->is_stardew_valley);
+}
+
+/**
+ * Loads the parse from the index if it matches the open files and options.
+ * On failure ctx is left as it was, so the bank can be parsed normally.
+ */
+static int load_index(xwb_context * ctx, const xwb_options * opts, const char * index_name) {
+    xwb_header * xwb = &ctx->xwb;
+    uint64_t key[INDEX_KEYS];
+    uint64_t fields[INDEX_FIELDS];
+    reader * index;
+    off_t off;
+    size_t names_size, streams_count;
+    char * names = NULL;
+    xwb_stream * streams = NULL;
+    int i;
+
+    if (!get_index_key(ctx, opts, key))
+        return XWB_ERROR_OPEN;
+
+    index = reader_open(index_name, 1);
+    if (!index)
+        return XWB_ERROR_OPEN;
+    index->soft_errors = 1;
+
+    if (reader_size(index) < INDEX_HEADER_SIZE
+            || get_32_le_at(0x00, index) != INDEX_MAGIC
+            || get_32_le_at(0x04, index) != INDEX_VERSION)
+        goto fail;
+
+    off = 0x08;
+    for (i = 0; i < INDEX_KEYS; i++, off += 0x08) {
+        if (get_64_le_at(off, index) != key[i])
+            goto fail;
+    }
+    for (i = 0; i < INDEX_FIELDS; i++, off += 0x08) {
+        fields[i] = get_64_le_at(off, index);
+    }
+    names_size = get_64_le_at(off, index);
+    off += 0x08;
+
+    streams_count = fields[INDEX_FIELDS - 2];
+    if (streams_count > (reader_size(index) - INDEX_HEADER_SIZE) / INDEX_STREAM_SIZE
+            || INDEX_HEADER_SIZE + streams_count * INDEX_STREAM_SIZE + names_size != reader_size(index))
+        goto fail;
+
+    streams = calloc(streams_count ? streams_count : 1, sizeof(xwb_stream));
+    names = malloc(names_size + 1);
+    if (!streams || !names)
+        goto fail;
+    get_bytes_at(off + streams_count * INDEX_STREAM_SIZE, index, (unsigned char *)names, names_size);
+    names[names_size] = '\0';
+
+    for (i = 0; i < streams_count; i++, off += INDEX_STREAM_SIZE) {
+        xwb_stream * s = &streams[i];
+        uint32_t name_pos = get_32_le_at(off + 0x18, index);
+
+        s->stream_offset = get_64_le_at(off + 0x00, index);
+        s->stream_size = get_64_le_at(off + 0x08, index);
+        s->name_offset = get_64_le_at(off + 0x10, index);
+        if (name_pos != INDEX_NO_NAME) {
+            if (name_pos >= names_size)
+                goto fail;
+            s->name = names + name_pos;
+        }
+    }
+
+    if (index->failed)
+        goto fail;
+    reader_close(index);
+
+    copy_index_fields(ctx, fields, 1);
+    xwb->xwb_streams = streams;
+    xwb->xwb_names = names;
+
+    if (ctx->opts.verbose)
+        printf("XWB has %i streams (from index)\n", (int)xwb->streams_count);
+    return XWB_OK;
+
+fail:
+    free(streams);
+    free(names);
+    reader_close(index);
+    return XWB_ERROR_OPEN;
+}
+
+/**
+ * Saves the parse to the index (to a temp file first so readers never see a partial one).
+ */
+static int save_index(xwb_context * ctx, const xwb_options * opts, const char * index_name) {
+    xwb_header * xwb = &ctx->xwb;
+    uint64_t key[INDEX_KEYS];
+    uint64_t fields[INDEX_FIELDS];
+    unsigned char * buf, * p;
+    char * temp_name;
+    size_t names_size = 0, buf_size, written;
+    uint32_t name_pos = 0;
+    FILE * outfile;
+    int i;
+
+    if (!get_index_key(ctx, opts, key))
+        return XWB_ERROR_OPEN;
+    copy_index_fields(ctx, fields, 0);
+
+    for (i = 0; i < xwb->streams_count; i++) {
+        if (xwb->xwb_streams[i].name)
+            names_size += strlen(xwb->xwb_streams[i].name) + 1;
+    }
+    CHECK_XWB(XWB_ERROR_ARGS, names_size >= INDEX_NO_NAME, "ERROR: names too big for index");
+
+    buf_size = INDEX_HEADER_SIZE + xwb->streams_count * INDEX_STREAM_SIZE + names_size;
+    buf = calloc(1, buf_size);
+    temp_name = malloc(strlen(index_name) + 5);
+    if (!buf || !temp_name) {
+        free(buf);
+        free(temp_name);
+        CHECK_XWB(XWB_ERROR_MEMORY, 1, "ERROR: out of memory");
+    }
+
+    write_32_le(INDEX_MAGIC, buf + 0x00);
+    write_32_le(INDEX_VERSION, buf + 0x04);
+    p = buf + 0x08;
+    for (i = 0; i < INDEX_KEYS; i++, p += 0x08) {
+        write_64_le(key[i], p);
+    }
+    for (i = 0; i < INDEX_FIELDS; i++, p += 0x08) {
+        write_64_le(fields[i], p);
+    }
+    write_64_le(names_size, p);
+    p += 0x08;
+
+    for (i = 0; i < xwb->streams_count; i++, p += INDEX_STREAM_SIZE) {
+        xwb_stream * s = &(xwb->xwb_streams[i]);
+        unsigned char * name = buf + INDEX_HEADER_SIZE + xwb->streams_count * INDEX_STREAM_SIZE + name_pos;
+
+        write_64_le(s->stream_offset, p + 0x00);
+        write_64_le(s->stream_size, p + 0x08);
+        write_64_le(s->name_offset, p + 0x10);
+        if (s->name) {
+            write_32_le(name_pos, p + 0x18);
+            strcpy((char *)name, s->name);
+            name_pos += strlen(s->name) + 1;
+        }
+        else {
+            write_32_le(INDEX_NO_NAME, p + 0x18);
+        }
+    }
+
+    strcpy(temp_name, index_name);
+    strcat(temp_name, ".tmp");
+    outfile = fopen(temp_name, "wb");
+    written = outfile ? fwrite(buf, 1, buf_size, outfile) : 0;
+    if (!outfile || fclose(outfile) != 0 || written != buf_size || rename(temp_name, index_name) != 0) {
+        remove(temp_name);
+        free(buf);
+        free(temp_name);
+        CHECK_XWB(XWB_ERROR_OPEN, 1, "ERROR: failed writing index");
+    }
+
+    free(buf);
+    free(temp_name);
+    return XWB_OK;
+}
+
+int xwb_get_stream(xwb_context * ctx, int stream, xwb_stream_info * info, unsigned char ** buf, size_t * buf_size) {
+    xwb_header * xwb = &ctx->xwb;
+    xwb_stream * s;
+
+    CHECK_XWB(XWB_ERROR_ARGS, stream < 0 || stream >= xwb->streams_count, "ERROR: stream %i doesn't exist", stream);
+    s = &(xwb->xwb_streams[stream]);
+
+    memset(info,0,sizeof(xwb_stream_info));
+    info->index = stream;
+    info->offset = s->stream_offset;
+    info->size = s->stream_size;
+    if (!ctx->opts.ignore_xsb_xwb_name)
+        info->name = s->name;
+
+    if (buf) {
+        int ret = xwb_make_header(ctx, stream, buf, buf_size);
+        if (ret != XWB_OK)
+            return ret;
+        info->header = *buf;
+        info->header_size = xwb->header_size;
+    }
+
+    return XWB_OK;
+}
+
+void xwb_iter_init(xwb_iterator * it, xwb_context * ctx, int with_headers) {
+    memset(it,0,sizeof(xwb_iterator));
+    it->ctx = ctx;
+    it->with_headers = with_headers;
+}
+
+int xwb_iter_next(xwb_iterator * it, xwb_stream_info * info) {
+    if (it->next >= it->ctx->xwb.streams_count)
+        return 0;
+
+    if (xwb_get_stream(it->ctx, it->next, info, it->with_headers ? &it->header : NULL, &it->header_size) != XWB_OK)
+        return -1;
+
+    it->next++;
+    return 1;
+}
+
+void xwb_iter_free(xwb_iterator * it) {
+    free(it->header);
+    it->header = NULL;
+    it->header_size = 0;
+}
@@ -0,0 +1,232 @@
+#ifndef _XWB_H_INCLUDED
+#define _XWB_H_INCLUDED
+
+/**
+ * libxwb: parses XWB banks (plus XSB names) and makes single stream split headers.
+ *
+ * Usage: open a bank with one of the xwb_open* functions, then get each stream's info
+ * (payload range in the .xwb, resolved name and split header) with xwb_get_stream or an
+ * xwb_iterator. A split stream is its header followed by its payload. Functions return
+ * XWB_OK or an error code, and xwb_error has the message. Nothing exits or reads stdin.
+ */
+
+#include "util.h"
+
+/* the x.x version is just to make it clearer, MS only classifies XACT as 1/2/3 */
+#define XACT1_0_MAX     1           /* Project Gotham Racing 2 (v1), Silent Hill 4 (v1) */
+#define XACT1_1_MAX     3           /* Unreal Championship (v2), The King of Fighters 2003 (v3) */
+#define XACT2_0_MAX     34          /* Dead or Alive 4 (v17), Kameo (v23), Table Tennis (v34) */ // v35/36/37 too?
+#define XACT2_1_MAX     38          /* Prey (v38) */ // v39 too?
+#define XACT2_2_MAX     41          /* Blue Dragon (v40) */
+#define XACT3_0_MAX     46          /* Ninja Blade (t43 v42), Persona 4 Ultimax NESSICA (t45 v43) */
+#define XACT_TECHLAND   0x10000     /* Sniper Ghost Warrior, Nail'd (PS3/X360) */
+#define XACT_CRACKDOWN  0x87        /* Crackdown 1, equivalent to XACT2_2 */
+#define XSB_XACT1_MAX   11
+#define XSB_XACT2_MAX   41
+
+#define WAVEBANK_FLAGS_COMPACT              0x00020000  // Bank uses compact format
+
+enum {
+    XWB_OK = 0,
+    XWB_ERROR_MEMORY,   /* out of memory */
+    XWB_ERROR_OPEN,     /* can't open a file */
+    XWB_ERROR_READ,     /* read out of bounds (truncated or corrupt file) */
+    XWB_ERROR_XWB,      /* bad or unsupported .xwb */
+    XWB_ERROR_XSB,      /* bad or unsupported .xsb, or it doesn't match the .xwb */
+    XWB_ERROR_HEADER,   /* can't make a split header */
+    XWB_ERROR_ARGS,     /* bad stream index or similar */
+};
+
+/**
+ * Parse options, same as the xwb_split flags
+ */
+typedef struct {
+    int selected_wavebank;      /* -w: wavebank in a multi .xsb (1=first), 0 to autodetect */
+    int start_sound;            /* -s: first xsb sound (1=first), 0 for default */
+    int ignore_cue_totals;      /* -c */
+    int ignore_names_not_found; /* -n */
+    int ignore_xsb_name;        /* -i: no .xsb, use .xwb names */
+    int ignore_xsb_xwb_name;    /* -I: no names at all */
+    int multi_only;             /* -m: fail on single stream banks */
+    int alt_extraction;         /* -a: split headers keep the original header */
+    int debug;                  /* -d: print parse info to stdout */
+    int verbose;                /* print bank info (stream count, selected wavebank) to stdout */
+    const char * index_name;    /* -k: sidecar index to load the parse from, or save it to when missing
+                                 * or stale (.xwb/.xsb size, mtime or parsed bytes changed), NULL for none */
+} xwb_options;
+
+/**
+ * XWB contain stream info (channels, loop, data etc), often from multiple streams.
+ * XSBs contain info about how to play sounds (volume, pitch, name, etc) from XWBs (music or SFX).
+ * We only need to parse the XSB for the stream names.
+ */
+typedef struct {
+    int sound_count;
+    char name[0x40+1]; /* from the xsb's wavebank name table, empty if it has none */
+} xsb_wavebank;
+
+typedef struct {
+    int stream_index; /* stream id in the xwb (doesn't need to match xsb sound order) */
+    int wavebank; /* xwb id, if the xsb has multiple wavebanks */
+    off_t name_index; /* name order */
+    off_t name_offset; /* global offset to the name string */
+    off_t sound_offset; /* global offset to the xsb sound */
+    off_t unk_index; /* some kind of number up to sound_count or 0xffff */
+    const char * name; /* points into the xsb names table, NULL if not found */
+} xsb_sound;
+
+typedef struct {
+    off_t stream_offset;
+    size_t stream_size;
+    const char * name; /* points into the xwb or xsb names table, NULL if not found */
+    off_t name_offset; /* xsb name offset, 0 if not found */
+} xwb_stream;
+
+typedef struct {
+    /* XWB header info */
+    int little_endian;
+    int version;
+
+    /* segments (sizes are off_t too, XACT1 v1 data goes to the end of the file) */
+    off_t base_offset;
+    off_t base_size;
+    off_t entry_offset;
+    off_t entry_size;
+    off_t extra1_offset;
+    off_t extra1_size;
+    off_t extra2_offset;
+    off_t extra2_size;
+    off_t data_offset;
+    off_t data_size;
+
+    off_t names_offset;
+    off_t names_size;
+
+    uint32_t base_flags;
+    size_t entry_elem_size;
+    size_t name_elem_size;
+    size_t entry_alignment;
+
+    xwb_stream * xwb_streams; /* array of stream info from the xwb, simplified */
+    size_t streams_count;
+    int is_stardew_valley;
+
+    char * xwb_names; /* ENTRYNAMES loaded at once, one null-terminated name per stream */
+
+
+    /* XSB header info */
+    int xsb_version;
+    int xsb_shared; /* the xsb tables belong to the xwb_open_xsb context given to xwb_open_shared */
+    xsb_sound * xsb_sounds; /* array of sounds info from the xsb, simplified */
+    xsb_wavebank * xsb_wavebanks; /* array of wavebank info from the xsb, simplified */
+    char * xsb_names; /* xsb name strings loaded at once, from the first name to EOF */
+
+    off_t xsb_sounds_offset;
+    size_t xsb_sounds_count;
+
+    size_t xsb_simple_sounds_offset; /* sound cues */
+    size_t xsb_simple_sounds_count;
+    size_t xsb_complex_sounds_offset;
+    size_t xsb_complex_sounds_count;
+
+    size_t xsb_wavebanks_count;
+    off_t xsb_nameoffsets_offset;
+
+    /* split header shared by all streams, see xwb_build_headers */
+    unsigned char * header_template;
+    size_t header_size;
+    off_t header_entry_offset; /* where the stream's entry goes */
+    off_t header_data_size_offset; /* where the stream's data size goes (new header only) */
+} xwb_header;
+
+/**
+ * Time spent opening a bank, in seconds (wall and this thread's CPU)
+ */
+typedef struct {
+    double xwb_wall, xwb_cpu; /* .xwb parsing, or loading the index */
+    double xsb_wall, xsb_cpu;
+    double names_wall, names_cpu;
+} xwb_times;
+
+/**
+ * An open bank
+ */
+typedef struct {
+    xwb_options opts; /* selected_wavebank is set when autodetected */
+    reader * xwb_file;
+    reader * xsb_file; /* NULL when ignoring .xsb names */
+    xwb_header xwb;
+    xwb_times times;
+    char error[512];
+} xwb_context;
+
+/**
+ * A stream's info, pointers are valid until the next call that fills it (or xwb_close)
+ */
+typedef struct {
+    int index;
+    off_t offset; /* payload range in the .xwb */
+    size_t size;
+    const char * name; /* xsb or xwb name (per options), NULL if not found */
+    const unsigned char * header; /* split header, NULL if not requested */
+    size_t header_size;
+} xwb_stream_info;
+
+typedef struct {
+    xwb_context * ctx;
+    int next;
+    int with_headers;
+    unsigned char * header; /* header buffer */
+    size_t header_size;
+} xwb_iterator;
+
+
+// open a bank from paths (xsb_name may be NULL when ignoring .xsb names)
+int xwb_open(xwb_context * ctx, const char * xwb_name, const char * xsb_name, const xwb_options * opts);
+// open a bank from the caller's fds (xsb_fd -1 when ignoring .xsb names), which are left open
+int xwb_open_fd(xwb_context * ctx, int xwb_fd, int xsb_fd, const xwb_options * opts);
+// open a bank from the caller's buffers (xsb NULL when ignoring .xsb names), which must outlive the context
+int xwb_open_memory(xwb_context * ctx, const void * xwb_buf, size_t xwb_size, const void * xsb_buf, size_t xsb_size, const xwb_options * opts);
+// open a bank from readers, which the context now owns (even on error)
+int xwb_open_readers(xwb_context * ctx, reader * xwb_file, reader * xsb_file, const xwb_options * opts);
+// parse a .xsb alone, to see its wavebanks (xwb.xsb_wavebanks, with their names) and then open
+// each of them with xwb_open_shared without parsing the .xsb again
+int xwb_open_xsb(xwb_context * ctx, const char * xsb_name, const xwb_options * opts);
+// open a bank from a reader (which the context now owns, even on error) named by an xwb_open_xsb
+// context, which must stay open until this one is closed; opts->selected_wavebank is the bank's
+// wavebank in the .xsb. Several banks can be opened from the same .xsb in parallel
+int xwb_open_shared(xwb_context * ctx, reader * xwb_file, const xwb_context * xsb, const xwb_options * opts);
+// the bank name stored in a .xwb (in WAVEBANKDATA, empty if it has none) and its number of streams,
+// without parsing the rest
+int xwb_get_bank_info(reader * xwb_file, char * name, size_t name_size, int * streams_count);
+// free everything (also after a failed open)
+void xwb_close(xwb_context * ctx);
+
+// last error message
+const char * xwb_error(const xwb_context * ctx);
+
+// how much of the start of a .xwb is needed to parse it and make headers (everything but the wave data)
+int xwb_header_end(reader * xwb_file, off_t * end);
+
+// make the split header template; done on the first header otherwise, but call it
+// before making headers from several threads
+int xwb_build_headers(xwb_context * ctx);
+// make a stream's split header in a caller's buffer, which grows as needed (free it when done)
+int xwb_make_header(xwb_context * ctx, int stream, unsigned char ** buf, size_t * buf_size);
+// make a stream's RIFF header (fmt, XMA2 seek and data chunk header) in a caller's buffer, which grows
+// as needed, and set header_size; the stream's payload follows it as the data chunk, then a 0 pad byte
+// if the payload size is odd. Works for PCM, Xbox/MS ADPCM and XMA2, other codecs give XWB_ERROR_HEADER
+int xwb_make_riff(xwb_context * ctx, int stream, unsigned char ** buf, size_t * buf_size, size_t * header_size);
+// 1 if the stream's payload must be written byte-swapped after its RIFF header (16-bit PCM from
+// a big-endian bank, as RIFF PCM is little-endian), 0 if it's copied as is
+int xwb_riff_swap16(xwb_context * ctx, int stream);
+
+// stream info, with the split header in the caller's buffer if buf isn't NULL
+int xwb_get_stream(xwb_context * ctx, int stream, xwb_stream_info * info, unsigned char ** buf, size_t * buf_size);
+
+// iterate streams in order: xwb_iter_next returns 1 with the next stream's info, 0 when done, <0 on error
+void xwb_iter_init(xwb_iterator * it, xwb_context * ctx, int with_headers);
+int xwb_iter_next(xwb_iterator * it, xwb_stream_info * info);
+void xwb_iter_free(xwb_iterator * it);
+
+#endif /* _XWB_H_INCLUDED */
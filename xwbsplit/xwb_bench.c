@@ -0,0 +1,1398 @@
+/**
+ * Benchmarks xwb_split over generated banks, so parsing and splitting costs can be compared between builds.
+ *
+ * "gen" writes synthetic but valid .xwb/.xsb pairs for each layout the parser handles, and "run" times
+ * parsing (in-process with libxwb) and the split modes (running xwb_split) on every bank of a dir.
+ */
+#define _GNU_SOURCE
+
+#include "util.h"
+#include "xwb.h"
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <time.h>
+#ifdef __MINGW32__
+#include <windows.h>
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+enum { MAX_PATH = 32768 };
+
+#define BENCH_SECONDS   0.25        /* each measurement is repeated for about this long, keeping the best */
+#define BENCH_MAX_RUNS  20
+#define DATA_ALIGNMENT  0x800       /* ENTRYWAVEDATA start, 1 dvd sector like most banks */
+#define COMPACT_ALIGNMENT 0x200     /* compact entry sectors, smaller than usual to keep 100k stream banks small */
+#define XSB_MAX_SOUNDS  0xFFFF      /* 16-bit sound counts and stream indexes */
+#define ALT_MAX_BYTES   0x40000000  /* -a copies the whole original header per stream, skipped over this total */
+#define COMPACT_MAX_SECTORS 0x200000 /* 21-bit sector offsets */
+#define LARGE_DATA_START 0xFFF00000 /* check -l bank data, so most streams are past 4GB */
+#define LARGE_STREAMS   8
+#define LARGE_AVG_SIZE  0x800000
+
+
+#define CHECK_EXIT(condition, ...) \
+    do {if (condition) { \
+       fflush(stdout); \
+       fprintf(stderr, __VA_ARGS__); \
+       fprintf(stderr, "\n"); \
+       exit(1); \
+    } } while (0)
+
+
+/**
+ * A bank layout to generate
+ */
+typedef struct {
+    const char * name;
+    int xwb_version;
+    int xsb_version;
+    int little_endian;
+    int compact;
+    int multi; /* xsb has other wavebanks around the bank's */
+} bench_layout;
+
+static const bench_layout layouts[] = {
+    { "x1_le",      1,  11, 1, 0, 0 },  /* XACT1 v1 */
+    { "x11_be",     3,  11, 0, 0, 0 },  /* XACT1.1 */
+    { "x2_le",      40, 40, 1, 0, 0 },  /* XACT2 */
+    { "x2c_be",     41, 41, 0, 1, 0 },
+    { "x3_le",      46, 46, 1, 0, 0 },  /* XACT3 */
+    { "x3_be",      46, 46, 0, 0, 0 },
+    { "x3c_le",     46, 46, 1, 1, 0 },
+    { "x3c_be",     46, 46, 0, 1, 0 },
+    { "x3_multi",   46, 46, 1, 0, 1 },
+};
+
+/**
+ * Growable output buffer, files are built in memory then written at once
+ */
+typedef struct {
+    unsigned char * data;
+    size_t size;
+    size_t max;
+    int little_endian;
+} bench_buf;
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng_next(void) {
+    /* xorshift32, same banks on every platform */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void buf_reserve(bench_buf * buf, size_t size) {
+    if (buf->size + size <= buf->max)
+        return;
+    while (buf->size + size > buf->max) {
+        buf->max = buf->max ? buf->max * 2 : 0x10000;
+    }
+    buf->data = realloc(buf->data, buf->max);
+    CHECK_EXIT(!buf->data, "ERROR: out of memory");
+}
+
+static void put_zeroes(bench_buf * buf, size_t size) {
+    buf_reserve(buf, size);
+    memset(buf->data + buf->size, 0, size);
+    buf->size += size;
+}
+
+static void put_bytes_buf(bench_buf * buf, const void * bytes, size_t size) {
+    buf_reserve(buf, size);
+    memcpy(buf->data + buf->size, bytes, size);
+    buf->size += size;
+}
+
+static void put_u32(bench_buf * buf, uint32_t value) {
+    buf_reserve(buf, 4);
+    if (buf->little_endian)
+        write_32_le(value, buf->data + buf->size);
+    else
+        write_32_be(value, buf->data + buf->size);
+    buf->size += 4;
+}
+
+static void put_u16(bench_buf * buf, uint16_t value) {
+    buf_reserve(buf, 2);
+    if (buf->little_endian)
+        write_16_le(value, buf->data + buf->size);
+    else
+        write_16_be(value, buf->data + buf->size);
+    buf->size += 2;
+}
+
+static void set_u32(bench_buf * buf, size_t offset, uint32_t value) {
+    if (buf->little_endian)
+        write_32_le(value, buf->data + offset);
+    else
+        write_32_be(value, buf->data + offset);
+}
+
+static void set_u16(bench_buf * buf, size_t offset, uint16_t value) {
+    if (buf->little_endian)
+        write_16_le(value, buf->data + offset);
+    else
+        write_16_be(value, buf->data + offset);
+}
+
+static void put_name(bench_buf * buf, const char * name, size_t size) {
+    size_t len = strlen(name);
+    put_bytes_buf(buf, name, len < size ? len : size);
+    if (len < size)
+        put_zeroes(buf, size - len);
+}
+
+/**
+ * Writes the buffer, followed by hole_size zeroes left as a hole (sparse file) where supported.
+ */
+static void save_buf(bench_buf * buf, const char * name, uint64_t hole_size) {
+    FILE * outfile = fopen(name, "wb");
+    CHECK_EXIT(!outfile, "ERROR: can't create %s", name);
+    CHECK_EXIT(fwrite(buf->data, 1, buf->size, outfile) != buf->size, "ERROR: can't write %s", name);
+    if (hole_size > 0) {
+        /* seeking past the end and writing the last byte leaves the rest unallocated */
+        CHECK_EXIT(fseeko(outfile, hole_size - 1, SEEK_CUR) != 0 || fputc(0, outfile) == EOF, "ERROR: can't write %s", name);
+    }
+    CHECK_EXIT(fclose(outfile) != 0, "ERROR: can't write %s", name);
+}
+
+/**
+ * Lays out streams of random sizes (1..2*avg_size), aligning each start for compact entries, and adds
+ * random data for them to data (NULL to leave the data out, for sparse banks).
+ * Returns the data size, and each stream's offset within the data and size in offsets/sizes,
+ * or 0 if the data doesn't fit the entries (32-bit offsets, or 21-bit sectors when compact).
+ */
+static uint64_t put_stream_data(bench_buf * data, int streams, uint64_t avg_size, int compact, uint32_t * offsets, uint32_t * sizes) {
+    uint64_t pos = 0, alignment = compact ? COMPACT_ALIGNMENT : 4;
+    int i;
+
+    for (i = 0; i < streams; i++) {
+        uint64_t size = 1 + rng_next() % (avg_size * 2), j;
+
+        if (compact)
+            pos = (pos + alignment - 1) / alignment * alignment;
+        if (pos + size > UINT32_MAX || (compact && pos / COMPACT_ALIGNMENT >= COMPACT_MAX_SECTORS))
+            return 0;
+        offsets[i] = pos;
+        sizes[i] = size;
+
+        if (data) {
+            put_zeroes(data, pos - data->size);
+            buf_reserve(data, size);
+            for (j = 0; j < size; j += 4) {
+                uint32_t value = rng_next();
+                memcpy(data->data + data->size + j, &value, size - j < 4 ? size - j : 4);
+            }
+            data->size += size;
+        }
+        pos += size;
+
+        if (!compact)
+            pos = (pos + alignment - 1) / alignment * alignment;
+    }
+    pos = (pos + alignment - 1) / alignment * alignment;
+    if (pos > UINT32_MAX)
+        return 0;
+    if (data)
+        put_zeroes(data, pos - data->size);
+    return pos;
+}
+
+/**
+ * A WAVEBANKMINIWAVEFORMAT that -W can write, cycling PCM16, PCM8, ADPCM and (XACT3) XMA2 by stream.
+ * BE banks store the same value, written BE like the rest.
+ */
+static uint32_t stream_format(int version, int stream) {
+    if (version <= XACT1_1_MAX) {
+        /* Xbox: 2b tag, 3b channels, 26b sample rate, 1b bits */
+        switch (stream % 3) {
+            case 0: return 0 | (2 << 2) | (44100 << 5) | (1u << 31);
+            case 1: return 0 | (1 << 2) | (22050 << 5);
+            default: return 1 | (2 << 2) | (44100 << 5);
+        }
+    }
+
+    /* 2b tag, 3b channels, 18b sample rate, 8b block align (MS ADPCM: per channel - 22), 1b bits */
+    switch (stream % (version > XACT2_2_MAX ? 4 : 3)) {
+        case 0: return 0 | (2 << 2) | (44100 << 5) | (4 << 23) | (1u << 31);
+        case 1: return 0 | (1 << 2) | (22050 << 5) | (1 << 23);
+        case 2: return 2 | (2 << 2) | (44100 << 5) | (48 << 23);
+        default: return 1 | (2 << 2) | (48000 << 5);
+    }
+}
+
+/**
+ * Writes a .xwb with the layout's version, endianness and entry format, with the stream data
+ * as a hole when sparse. The data starts at data_start if past the header (segmented versions,
+ * sparse only; for data beyond 4GB). Returns 0 if the data is too big for the entries.
+ */
+static int make_xwb(const bench_layout * layout, int streams, uint64_t avg_size, int sparse, uint32_t data_start, const char * name) {
+    bench_buf out = {0}, data = {0};
+    uint32_t * offsets = malloc(streams * sizeof(uint32_t));
+    uint32_t * sizes = malloc(streams * sizeof(uint32_t));
+    int version = layout->xwb_version, i;
+    char stream_name[64];
+    uint64_t data_size, hole_size = 0;
+
+    CHECK_EXIT(!offsets || !sizes, "ERROR: out of memory");
+    out.little_endian = layout->little_endian;
+    data_size = put_stream_data(sparse ? NULL : &data, streams, avg_size, layout->compact, offsets, sizes);
+    if (data_size == 0) {
+        free(data.data);
+        free(offsets);
+        free(sizes);
+        return 0;
+    }
+
+    put_bytes_buf(&out, layout->little_endian ? "WBND" : "DNBW", 4);
+    put_u32(&out, version);
+
+    if (version <= XACT1_0_MAX) {
+        /* fixed header, entries and data right after */
+        put_u32(&out, 0);
+        put_u32(&out, streams);
+        put_name(&out, "bench", 0x40);
+        for (i = 0; i < streams; i++) {
+            put_u32(&out, stream_format(version, i));
+            put_u32(&out, offsets[i]);
+            put_u32(&out, sizes[i]);
+            put_u32(&out, 0); /* loop start */
+            put_u32(&out, 0); /* loop length */
+        }
+    }
+    else {
+        int segments = version <= XACT1_1_MAX ? 4 : 5;
+        size_t base_offset, base_size, entry_offset, entry_elem, entry_size, names_offset, names_size, data_offset;
+
+        if (version > XACT2_2_MAX)
+            put_u32(&out, 43); /* tool version */
+
+        base_offset = out.size + segments * 0x08;
+        base_size = version <= XACT1_1_MAX ? 0x28 : 0x60;
+        entry_offset = base_offset + base_size;
+        entry_elem = layout->compact ? 0x04 : 0x18;
+        entry_size = entry_elem * streams;
+        names_offset = entry_offset + entry_size;
+        names_size = 0x40 * streams;
+        data_offset = (names_offset + names_size + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+        if (sparse && data_start > data_offset)
+            data_offset = data_start / DATA_ALIGNMENT * DATA_ALIGNMENT;
+
+        /* segments: BANKDATA, ENTRYMETADATA, (SEEKTABLES,) ENTRYNAMES, ENTRYWAVEDATA */
+        put_u32(&out, base_offset);
+        put_u32(&out, base_size);
+        put_u32(&out, entry_offset);
+        put_u32(&out, entry_size);
+        if (version > XACT1_1_MAX) {
+            put_u32(&out, 0);
+            put_u32(&out, 0);
+        }
+        put_u32(&out, names_offset);
+        put_u32(&out, names_size);
+        put_u32(&out, data_offset);
+        put_u32(&out, data_size);
+
+        /* WAVEBANKDATA */
+        put_u32(&out, (layout->compact ? WAVEBANK_FLAGS_COMPACT : 0) | 0x01); /* streaming bank */
+        put_u32(&out, streams);
+        put_name(&out, "bench", version <= XACT1_1_MAX ? 0x10 : 0x40);
+        put_u32(&out, entry_elem);
+        put_u32(&out, 0x40); /* name size */
+        put_u32(&out, layout->compact ? COMPACT_ALIGNMENT : DATA_ALIGNMENT);
+        put_u32(&out, stream_format(version, 0)); /* compact: one format for all */
+        put_zeroes(&out, entry_offset - out.size);
+
+        for (i = 0; i < streams; i++) {
+            if (layout->compact) {
+                /* 21-bit sector offset, 11-bit padding after the data */
+                uint32_t padding = (COMPACT_ALIGNMENT - sizes[i] % COMPACT_ALIGNMENT) % COMPACT_ALIGNMENT;
+                put_u32(&out, (offsets[i] / COMPACT_ALIGNMENT) | (padding << 21));
+            }
+            else {
+                put_u32(&out, 0x00010000 + i); /* flags + duration */
+                put_u32(&out, stream_format(version, i));
+                put_u32(&out, offsets[i]);
+                put_u32(&out, sizes[i]);
+                put_u32(&out, 0); /* loop start */
+                put_u32(&out, 0); /* loop length */
+            }
+        }
+
+        for (i = 0; i < streams; i++) {
+            snprintf(stream_name, sizeof(stream_name), "wave_%i", i);
+            put_name(&out, stream_name, 0x40);
+        }
+        if (sparse)
+            hole_size = data_offset - out.size;
+        else
+            put_zeroes(&out, data_offset - out.size);
+    }
+
+    put_bytes_buf(&out, data.data, data.size);
+    save_buf(&out, name, sparse ? hole_size + data_size : 0);
+
+    free(out.data);
+    free(data.data);
+    free(offsets);
+    free(sizes);
+    return 1;
+}
+
+/**
+ * Writes a .xsb naming the streams of each wavebank (wavebank_streams[i] per bank), with sounds
+ * in a shuffled order and a mix of simple and complex cues. Returns 0 if the streams don't fit the format.
+ */
+static int make_xsb(const bench_layout * layout, const int * wavebank_streams, int wavebanks, const char * name) {
+    bench_buf out = {0};
+    int * sound_bank, * sound_stream, * order;
+    uint32_t * sound_offsets;
+    int sounds = 0, simple = 0, complex = 0, i, j;
+    char cue_name[64];
+
+    for (i = 0; i < wavebanks; i++) {
+        sounds += wavebank_streams[i];
+    }
+    if (sounds > XSB_MAX_SOUNDS)
+        return 0;
+
+    sound_bank = malloc(sounds * sizeof(int));
+    sound_stream = malloc(sounds * sizeof(int));
+    order = malloc(sounds * sizeof(int));
+    sound_offsets = malloc(sounds * sizeof(uint32_t));
+    CHECK_EXIT(!sound_bank || !sound_stream || !order || !sound_offsets, "ERROR: out of memory");
+
+    sounds = 0;
+    for (i = 0; i < wavebanks; i++) {
+        for (j = 0; j < wavebank_streams[i]; j++) {
+            sound_bank[sounds] = i;
+            sound_stream[sounds] = j;
+            sounds++;
+        }
+    }
+    for (i = sounds - 1; i > 0; i--) {
+        int k = rng_next() % (i + 1), tmp;
+        tmp = sound_bank[i]; sound_bank[i] = sound_bank[k]; sound_bank[k] = tmp;
+        tmp = sound_stream[i]; sound_stream[i] = sound_stream[k]; sound_stream[k] = tmp;
+    }
+
+    out.little_endian = layout->little_endian;
+
+    if (layout->xsb_version <= XSB_XACT1_MAX) {
+        /* fixed 0x14 sounds with 16-bit name offsets */
+        size_t names_offset = 0x38 + 0x14 * sounds, names_size = 0;
+
+        for (i = 0; i < sounds; i++) {
+            names_size += snprintf(cue_name, sizeof(cue_name), "cue_%i_%i", sound_bank[i], sound_stream[i]) + 1;
+        }
+        if (names_offset + names_size > 0xFFFF)
+            goto fail;
+
+        put_bytes_buf(&out, layout->little_endian ? "SDBK" : "KBDS", 4);
+        put_zeroes(&out, 0x38 - 4);
+        set_u16(&out, 0x04, layout->xsb_version);
+        set_u16(&out, 0x1e, sounds);
+
+        for (i = 0; i < sounds; i++) {
+            put_zeroes(&out, 1);
+            out.data[out.size - 1] = 0x01;
+            put_zeroes(&out, 1);
+            put_u16(&out, sound_stream[i]);
+            put_u16(&out, names_offset);
+            put_zeroes(&out, 0x14 - 0x06);
+            names_offset += snprintf(cue_name, sizeof(cue_name), "cue_%i_%i", sound_bank[i], sound_stream[i]) + 1;
+        }
+        for (i = 0; i < sounds; i++) {
+            snprintf(cue_name, sizeof(cue_name), "cue_%i_%i", sound_bank[i], sound_stream[i]);
+            put_bytes_buf(&out, cue_name, strlen(cue_name) + 1);
+        }
+    }
+    else {
+        size_t sounds_offset = 0x100, simple_offset, complex_offset, nameoffsets_offset, names_offset;
+        int * is_complex = order; /* reused: 1 for complex cues */
+
+        put_bytes_buf(&out, layout->little_endian ? "SDBK" : "KBDS", 4);
+        put_zeroes(&out, sounds_offset - 4);
+
+        /* sounds: simple ones with the stream at 0x09, complex ones at size - 0x08 */
+        for (i = 0; i < sounds; i++) {
+            is_complex[i] = rng_next() % 10 < 3;
+            sound_offsets[i] = out.size;
+            if (is_complex[i]) {
+                complex++;
+                put_zeroes(&out, 0x14);
+                out.data[sound_offsets[i]] = 0x01;
+                set_u16(&out, sound_offsets[i] + 0x07, 0x14);
+                set_u16(&out, sound_offsets[i] + 0x0c, sound_stream[i]);
+                out.data[sound_offsets[i] + 0x0e] = sound_bank[i];
+            }
+            else {
+                simple++;
+                put_zeroes(&out, 0x0c);
+                set_u16(&out, sound_offsets[i] + 0x07, 0x0c);
+                set_u16(&out, sound_offsets[i] + 0x09, sound_stream[i]);
+                out.data[sound_offsets[i] + 0x0b] = sound_bank[i];
+            }
+        }
+
+        /* cues, pointing to sounds (in sound order, the parser doesn't care) */
+        simple_offset = out.size;
+        for (i = 0; i < sounds; i++) {
+            if (is_complex[i])
+                continue;
+            put_zeroes(&out, 1);
+            put_u32(&out, sound_offsets[i]);
+        }
+        complex_offset = out.size;
+        for (i = 0; i < sounds; i++) {
+            if (!is_complex[i])
+                continue;
+            put_zeroes(&out, 1);
+            put_u32(&out, sound_offsets[i]);
+            put_zeroes(&out, 0x0f - 0x05);
+        }
+
+        /* name offsets in cue order (simple then complex), then names */
+        nameoffsets_offset = out.size;
+        names_offset = nameoffsets_offset + 0x06 * sounds;
+        for (j = 0; j < 2; j++) {
+            for (i = 0; i < sounds; i++) {
+                if (is_complex[i] != j)
+                    continue;
+                put_u32(&out, names_offset);
+                put_u16(&out, 0xFFFF);
+                names_offset += snprintf(cue_name, sizeof(cue_name), "cue_%i_%i", sound_bank[i], sound_stream[i]) + 1;
+            }
+        }
+        for (j = 0; j < 2; j++) {
+            for (i = 0; i < sounds; i++) {
+                if (is_complex[i] != j)
+                    continue;
+                snprintf(cue_name, sizeof(cue_name), "cue_%i_%i", sound_bank[i], sound_stream[i]);
+                put_bytes_buf(&out, cue_name, strlen(cue_name) + 1);
+            }
+        }
+
+        set_u16(&out, 0x04, layout->xsb_version);
+        if (layout->xsb_version <= XSB_XACT2_MAX) {
+            set_u16(&out, 0x09, simple);
+            set_u16(&out, 0x0b, complex);
+            out.data[0x11] = wavebanks;
+            set_u16(&out, 0x12, sounds);
+            set_u32(&out, 0x1a, simple_offset);
+            set_u32(&out, 0x1e, complex_offset);
+            set_u32(&out, 0x3a, nameoffsets_offset);
+            set_u32(&out, 0x3e, sounds_offset);
+        }
+        else {
+            set_u16(&out, 0x13, simple);
+            set_u16(&out, 0x15, complex);
+            out.data[0x1b] = wavebanks;
+            set_u16(&out, 0x1c, sounds);
+            set_u32(&out, 0x22, simple_offset);
+            set_u32(&out, 0x26, complex_offset);
+            set_u32(&out, 0x42, nameoffsets_offset);
+            set_u32(&out, 0x46, sounds_offset);
+        }
+    }
+
+    save_buf(&out, name, 0);
+
+    free(out.data);
+    free(sound_bank);
+    free(sound_stream);
+    free(order);
+    free(sound_offsets);
+    return 1;
+
+fail:
+    free(out.data);
+    free(sound_bank);
+    free(sound_stream);
+    free(order);
+    free(sound_offsets);
+    return 0;
+}
+
+/**
+ * Writes every layout with each stream count.
+ */
+static void generate(const char * dir, int * counts, int counts_total, uint64_t avg_size, int sparse) {
+    char name[MAX_PATH];
+    int i, l;
+
+    make_directory(dir);
+
+    for (i = 0; i < counts_total; i++) {
+        for (l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+            const bench_layout * layout = &layouts[l];
+            int wavebank_streams[3];
+            int wavebanks = 1, ret;
+
+            /* same banks on every run */
+            rng_state = 0x12345678 + counts[i] * 31 + l;
+
+            ret = snprintf(name, MAX_PATH, "%s%c%06i_%s.xwb", dir, DIRSEP, counts[i], layout->name);
+            CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+            if (!make_xwb(layout, counts[i], avg_size, sparse, 0, name)) {
+                printf("%s: %i streams, skipped (data too big for the format)\n", name, counts[i]);
+                continue;
+            }
+
+            /* other wavebanks with different sizes, so the bank's is autodetected */
+            wavebank_streams[0] = counts[i];
+            if (layout->multi) {
+                wavebank_streams[0] = counts[i] == 3 ? 4 : 3;
+                wavebank_streams[1] = counts[i];
+                wavebank_streams[2] = counts[i] == 7 ? 8 : 7;
+                wavebanks = 3;
+            }
+
+            strcpy(name + strlen(name) - 4, ".xsb");
+            if (make_xsb(layout, wavebank_streams, wavebanks, name))
+                printf("%s: %i streams\n", name, counts[i]);
+            else
+                printf("%s: %i streams, no .xsb (too many for the format)\n", name, counts[i]);
+        }
+    }
+}
+
+
+static double now_seconds(void) {
+#ifdef __MINGW32__
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/**
+ * Reads a whole file, returns NULL if it can't be opened.
+ */
+static uint8_t * load_file(const char * name, off_t * size) {
+    FILE * infile = fopen(name, "rb");
+    uint8_t * data;
+
+    if (!infile)
+        return NULL;
+    data = get_whole_file(infile, size);
+    fclose(infile);
+    return data;
+}
+
+/**
+ * Hashes every .xwb inside dir (sorted by name), returns how many.
+ */
+static int hash_outputs(const char * dir, uint64_t ** hashes) {
+    char ** names = NULL;
+    int names_count = 0, i;
+
+    find_files(dir, ".xwb", &names, &names_count);
+    *hashes = malloc((names_count + 1) * sizeof(uint64_t));
+    CHECK_EXIT(!*hashes, "ERROR: out of memory");
+
+    for (i = 0; i < names_count; i++) {
+        off_t size;
+        uint8_t * data = load_file(names[i], &size);
+
+        CHECK_EXIT(!data, "ERROR: can't open %s", names[i]);
+        (*hashes)[i] = xxh64(data, size, 0);
+        free(data);
+        free(names[i]);
+    }
+
+    free(names);
+    return names_count;
+}
+
+typedef int (*bench_fn)(void * ctx);
+
+#define SKIPPED -2.0
+#define MISMATCH -3.0
+
+/**
+ * Best time of several runs (fewer for slow ones), or a negative value if a run failed.
+ */
+static double best_time(bench_fn fn, void * ctx) {
+    double best = -1.0, total = 0.0;
+    int runs;
+
+    for (runs = 0; runs < BENCH_MAX_RUNS && total < BENCH_SECONDS; runs++) {
+        double start = now_seconds(), elapsed;
+        if (!fn(ctx))
+            return -1.0;
+        elapsed = now_seconds() - start;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+        total += elapsed;
+    }
+    return best;
+}
+
+typedef struct {
+    const char * xwb_name;
+    const char * xsb_name; /* NULL if missing */
+    int with_names;
+    const char * split_path;
+    const char * flags;
+    int xsb_missing;
+} bench_bank;
+
+static int bench_parse(void * ctx) {
+    bench_bank * bank = ctx;
+    xwb_context xwb;
+    xwb_options opts;
+    xwb_iterator it;
+    xwb_stream_info info;
+    int ret;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.ignore_cue_totals = 1;
+    if (!bank->with_names)
+        opts.ignore_xsb_xwb_name = 1;
+    else if (!bank->xsb_name)
+        opts.ignore_xsb_name = 1;
+
+    ret = xwb_open(&xwb, bank->xwb_name, bank->xsb_name, &opts);
+    if (ret == XWB_OK && bank->with_names) {
+        /* names are resolved per stream */
+        xwb_iter_init(&it, &xwb, 0);
+        while ((ret = xwb_iter_next(&it, &info)) > 0) {
+        }
+        xwb_iter_free(&it);
+        ret = ret < 0 ? XWB_ERROR_ARGS : XWB_OK;
+    }
+    if (ret != XWB_OK)
+        fprintf(stderr, "%s: %s\n", bank->xwb_name, xwb_error(&xwb));
+    xwb_close(&xwb);
+    return ret == XWB_OK;
+}
+
+static int bench_split(void * ctx) {
+    bench_bank * bank = ctx;
+    char command[MAX_PATH];
+    int ret;
+
+    ret = snprintf(command, MAX_PATH, "\"%s\" -c %s%s \"%s\" < " NULL_DEVICE " > " NULL_DEVICE,
+            bank->split_path, bank->xsb_missing ? "-i " : "", bank->flags, bank->xwb_name);
+    CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+
+    ret = system(command);
+    if (ret != 0)
+        fprintf(stderr, "%s: failed (%s)\n", bank->xwb_name, command);
+    return ret == 0;
+}
+
+static void print_ms(double seconds) {
+    if (seconds == SKIPPED)
+        printf(" %10s", "skipped");
+    else if (seconds == MISMATCH)
+        printf(" %10s", "mismatch");
+    else if (seconds < 0)
+        printf(" %10s", "failed");
+    else
+        printf(" %10.3f", seconds * 1000.0);
+}
+
+static void print_rate(double amount, double seconds) {
+    if (seconds == SKIPPED)
+        printf(" %10s", "skipped");
+    else if (seconds == MISMATCH)
+        printf(" %10s", "mismatch");
+    else if (seconds < 0)
+        printf(" %10s", "failed");
+    else
+        printf(" %10.1f", seconds > 0 ? amount / seconds : 0.0);
+}
+
+/* xwb_split -C copy methods and writers, each timed with the default split */
+static const char * split_modes[] = { "-C auto", "-C copy_range", "-C sendfile", "-C buffered", "-j 4", "-u 4" };
+static const char * split_columns[] = { "auto MB/s", "range MB/s", "sendf MB/s", "buf MB/s", "-j4 MB/s", "-u4 MB/s" };
+#define SPLIT_MODES 6
+
+/**
+ * Keeps a split's time only if its outputs (from the last run) match the reference split's,
+ * so a broken mode shows up as a mismatch instead of a fast time.
+ */
+static double check_outputs(const char * out_dir, const uint64_t * reference, int reference_count, double seconds) {
+    uint64_t * hashes;
+    int same;
+
+    if (seconds < 0)
+        return seconds;
+    if (reference_count < 0)
+        return -1.0;
+
+    same = hash_outputs(out_dir, &hashes) == reference_count && memcmp(hashes, reference, reference_count * sizeof(uint64_t)) == 0;
+    free(hashes);
+    return same ? seconds : MISMATCH;
+}
+
+/**
+ * Times every bank directly inside dir.
+ */
+static void run(const char * dir, const char * split_path) {
+    char ** names = NULL;
+    int names_count = 0, i, mode;
+
+    find_files(dir, ".xwb", &names, &names_count);
+    CHECK_EXIT(names_count == 0, "ERROR: no .xwb found (make them with gen)");
+
+    printf("%-22s %8s %10s %10s %10s %10s", "bank", "streams", "parse ms", "names ms", "names/s", "-l ms");
+    for (mode = 0; mode < SPLIT_MODES; mode++) {
+        printf(" %10s", split_columns[mode]);
+    }
+    printf(" %10s\n", "-a MB/s");
+
+    for (i = 0; i < names_count; i++) {
+        bench_bank bank;
+        xwb_context xwb;
+        xwb_options opts;
+        char xsb_name[MAX_PATH], out_dir[MAX_PATH];
+        double parse, naming, list, split[SPLIT_MODES], alt;
+        char flags[64];
+        uint64_t data_size = 0, * reference = NULL;
+        int reference_count = -1;
+        size_t stream;
+        reader * xsb_file;
+
+        /* skip split outputs from earlier runs, in each bank's subdir */
+        if (strchr(names[i] + strlen(dir) + 1, '/') || strchr(names[i] + strlen(dir) + 1, DIRSEP)) {
+            free(names[i]);
+            continue;
+        }
+
+        memset(&bank, 0, sizeof(bench_bank));
+        bank.xwb_name = names[i];
+        bank.split_path = split_path;
+
+        strip_ext(xsb_name, MAX_PATH, names[i]);
+        strcat(xsb_name, ".xsb");
+        xsb_file = reader_open(xsb_name, 0);
+        if (xsb_file) {
+            reader_close(xsb_file);
+            bank.xsb_name = xsb_name;
+        }
+        bank.xsb_missing = !bank.xsb_name;
+
+        /* -a headers are the original one, so their size is known after parsing */
+        memset(&opts, 0, sizeof(opts));
+        opts.ignore_xsb_xwb_name = 1;
+        opts.alt_extraction = 1;
+        CHECK_EXIT(xwb_open(&xwb, names[i], NULL, &opts) != XWB_OK, "%s: %s", names[i], xwb_error(&xwb));
+        CHECK_EXIT(xwb_build_headers(&xwb) != XWB_OK, "%s: %s", names[i], xwb_error(&xwb));
+        for (stream = 0; stream < xwb.xwb.streams_count; stream++) {
+            data_size += xwb.xwb.xwb_streams[stream].stream_size;
+        }
+
+        bank.with_names = 0;
+        parse = best_time(bench_parse, &bank);
+        bank.with_names = 1;
+        naming = best_time(bench_parse, &bank);
+        if (naming >= 0 && parse >= 0)
+            naming = naming > parse ? naming - parse : 0.0;
+
+        bank.flags = "-l";
+        list = best_time(bench_split, &bank);
+
+        /* outputs go to (bank)/, the reference is the plain serial copy */
+        strip_ext(out_dir, MAX_PATH, names[i]);
+        bank.flags = "-o -C buffered";
+        if (bench_split(&bank))
+            reference_count = hash_outputs(out_dir, &reference);
+
+        for (mode = 0; mode < SPLIT_MODES; mode++) {
+            snprintf(flags, sizeof(flags), "-o %s", split_modes[mode]);
+            bank.flags = flags;
+            split[mode] = check_outputs(out_dir, reference, reference_count, best_time(bench_split, &bank));
+        }
+        free(reference);
+        bank.flags = "-a -o";
+        alt = SKIPPED;
+        if ((uint64_t)xwb.xwb.header_size * xwb.xwb.streams_count + data_size <= ALT_MAX_BYTES)
+            alt = best_time(bench_split, &bank);
+
+        printf("%-22s %8i", strip_path(names[i]), (int)xwb.xwb.streams_count);
+        print_ms(parse);
+        print_ms(naming);
+        print_rate(xwb.xwb.streams_count, naming);
+        print_ms(list);
+        for (mode = 0; mode < SPLIT_MODES; mode++) {
+            print_rate(data_size / 1048576.0, split[mode]);
+        }
+        print_rate(data_size / 1048576.0, alt);
+        printf("\n");
+        fflush(stdout);
+
+        xwb_close(&xwb);
+        free(names[i]);
+    }
+
+    free(names);
+}
+
+/**
+ * snprintf to a MAX_PATH buffer, exiting if it doesn't fit.
+ */
+static void format_path(char * out, const char * format, ...) {
+    va_list args;
+    int ret;
+
+    va_start(args, format);
+    ret = vsnprintf(out, MAX_PATH, format, args);
+    va_end(args);
+    CHECK_EXIT(ret < 0 || ret >= MAX_PATH, "ERROR: buffer overflow");
+}
+
+/**
+ * Runs xwb_split with args (paths quoted by the caller), returns 1 if it exited as expected
+ * (0, or an error when should_fail).
+ */
+static int run_split_expecting(const char * split_path, const char * args, int should_fail) {
+    char command[MAX_PATH];
+    int ret;
+
+    ret = snprintf(command, MAX_PATH, "\"%s\" %s < " NULL_DEVICE " > " NULL_DEVICE " 2>&1", split_path, args);
+    CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+
+    ret = system(command);
+    if ((ret != 0) != should_fail)
+        printf("    %s: %s\n", should_fail ? "didn't fail" : "failed", command);
+    return (ret != 0) == should_fail;
+}
+
+/**
+ * Runs xwb_split with args (paths quoted by the caller), returns 1 if it succeeded.
+ */
+static int run_split(const char * split_path, const char * args) {
+    return run_split_expecting(split_path, args, 0);
+}
+
+/**
+ * Writes a .xwb/.xsb pair of the layout as name.xwb/name.xsb, the same bank for the same seed.
+ */
+static void make_bank(const bench_layout * layout, int streams, uint32_t seed, const char * name) {
+    char file_name[MAX_PATH];
+
+    rng_state = seed;
+    format_path(file_name, "%s.xwb", name);
+    CHECK_EXIT(!make_xwb(layout, streams, 1024, 0, 0, file_name), "ERROR: can't make %s", file_name);
+    format_path(file_name, "%s.xsb", name);
+    CHECK_EXIT(!make_xsb(layout, &streams, 1, file_name), "ERROR: can't make %s", file_name);
+}
+
+/**
+ * Overwriting outputs hardlinked by -L hard to another bank's must leave that bank's outputs alone:
+ * links a's and b's identical outputs, changes b and splits it again with -o (and each writer).
+ */
+static int check_overwrite_links(const char * dir, const char * split_path) {
+    static const char * writers[] = { "", "-j 4", "-u 4" };
+    char a_dir[MAX_PATH], b_dir[MAX_PATH], name[MAX_PATH], args[MAX_PATH];
+    uint64_t * before, * after;
+    int writer, count, ok = 1;
+
+    format_path(name, "%s%clinks", dir, DIRSEP);
+    make_directory(name);
+    format_path(a_dir, "%s%ca", name, DIRSEP);
+    format_path(b_dir, "%s%cb", name, DIRSEP);
+    make_directory(a_dir);
+    make_directory(b_dir);
+
+    for (writer = 0; writer < sizeof(writers) / sizeof(writers[0]) && ok; writer++) {
+        format_path(name, "%s%cbank", a_dir, DIRSEP);
+        make_bank(&layouts[4], 4, 1, name);
+        format_path(name, "%s%cbank", b_dir, DIRSEP);
+        make_bank(&layouts[4], 4, 1, name);
+
+        /* -o so earlier check runs' outputs are replaced (and linked again) */
+        format_path(args, "-c -o -b -L hard -F \"%s%clinks%cfp.txt\" \"%s\" \"%s\"", dir, DIRSEP, DIRSEP, a_dir, b_dir);
+        if (!run_split(split_path, args))
+            return 0;
+        format_path(name, "%s%cbank", a_dir, DIRSEP);
+        count = hash_outputs(name, &before);
+
+        /* same stream count and names, other data */
+        format_path(name, "%s%cbank", b_dir, DIRSEP);
+        make_bank(&layouts[4], 4, 2, name);
+        format_path(args, "-c -o %s \"%s.xwb\"", writers[writer], name);
+        ok = run_split(split_path, args);
+
+        format_path(name, "%s%cbank", a_dir, DIRSEP);
+        if (ok && (hash_outputs(name, &after) != count || memcmp(before, after, count * sizeof(uint64_t)) != 0)) {
+            printf("    a's outputs changed after splitting b again with -o %s\n", writers[writer]);
+            ok = 0;
+        }
+        free(before);
+        if (ok)
+            free(after);
+    }
+
+    return ok;
+}
+
+/**
+ * Checks a -W output against its stream: RIFF and chunk sizes, the pad byte after odd data, and the
+ * data itself, which must be byte-swapped for 16-bit PCM from BE banks. Returns 0 and says why if not.
+ */
+static int check_riff(const char * name, const uint8_t * bank, int little_endian, const xwb_stream_info * info) {
+    off_t size, pos = 0x0c;
+    uint8_t * riff = load_file(name, &size);
+    const uint8_t * fmt = NULL, * data = NULL;
+    uint32_t data_size = 0;
+    const char * error = NULL;
+    int swap = 0;
+    size_t i;
+
+    if (!riff) {
+        printf("    %s: not written\n", name);
+        return 0;
+    }
+
+    if (size < 0x0c || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 0x08, "WAVE", 4) != 0)
+        error = "not a RIFF WAVE";
+    else if (read_32_le(riff + 0x04) != size - 0x08)
+        error = "RIFF size doesn't match the file";
+
+    while (!error && !data && pos + 0x08 <= size) {
+        uint32_t chunk_size = read_32_le(riff + pos + 0x04);
+
+        if (chunk_size > size - pos - 0x08)
+            error = "chunk past the end";
+        else if (memcmp(riff + pos, "fmt ", 4) == 0)
+            fmt = riff + pos + 0x08;
+        else if (memcmp(riff + pos, "data", 4) == 0) {
+            data = riff + pos + 0x08;
+            data_size = chunk_size;
+        }
+        pos += 0x08 + chunk_size;
+    }
+
+    if (!error && (!fmt || !data))
+        error = "no fmt or data chunk";
+    else if (!error && read_16_le(fmt + 0x02) == 0)
+        error = "no channels";
+    else if (!error && data_size != info->size)
+        error = "data size isn't the stream's";
+    else if (!error && pos + (data_size & 1) != size)
+        error = "bad padding after data";
+    else if (!error && (data_size & 1) && riff[pos] != 0)
+        error = "pad byte isn't 0";
+
+    if (!error) {
+        const uint8_t * stream = bank + info->offset;
+
+        swap = !little_endian && read_16_le(fmt + 0x00) == 0x0001 && read_16_le(fmt + 0x0e) == 16;
+        for (i = 0; i < data_size && !error; i++) {
+            size_t from = swap && (i | 1) < data_size ? i ^ 1 : i;
+            if (data[i] != stream[from])
+                error = swap ? "data isn't the stream's byte-swapped" : "data isn't the stream's";
+        }
+    }
+
+    if (error)
+        printf("    %s: %s\n", name, error);
+    free(riff);
+    return error == NULL;
+}
+
+/**
+ * -W must write a valid .wav for every stream of every layout, with PCM16 from BE banks in LE.
+ */
+static int check_riff_outputs(const char * dir, const char * split_path) {
+    char bank_name[MAX_PATH], name[MAX_PATH], args[MAX_PATH];
+    int layout, ok = 1;
+
+    format_path(name, "%s%criff", dir, DIRSEP);
+    make_directory(name);
+
+    for (layout = 0; layout < sizeof(layouts) / sizeof(layouts[0]); layout++) {
+        xwb_context xwb;
+        xwb_options opts;
+        xwb_stream_info info;
+        uint8_t * bank;
+        off_t bank_size;
+        int i;
+
+        format_path(bank_name, "%s%criff%c%s", dir, DIRSEP, DIRSEP, layouts[layout].name);
+        make_bank(&layouts[layout], 16, 1, bank_name);
+
+        format_path(args, "-c -o -I -P -W \"%s.xwb\"", bank_name);
+        if (!run_split(split_path, args)) {
+            ok = 0;
+            continue;
+        }
+
+        memset(&opts, 0, sizeof(opts));
+        opts.ignore_xsb_xwb_name = 1;
+        format_path(name, "%s.xwb", bank_name);
+        CHECK_EXIT(xwb_open(&xwb, name, NULL, &opts) != XWB_OK, "%s: %s", name, xwb_error(&xwb));
+        bank = load_file(name, &bank_size);
+        CHECK_EXIT(!bank, "ERROR: can't open %s", name);
+
+        for (i = 0; i < xwb.xwb.streams_count; i++) {
+            CHECK_EXIT(xwb_get_stream(&xwb, i, &info, NULL, NULL) != XWB_OK, "%s", xwb_error(&xwb));
+            format_path(name, "%s%c%03i.wav", bank_name, DIRSEP, i);
+            ok &= check_riff(name, bank, layouts[layout].little_endian, &info);
+        }
+
+        free(bank);
+        xwb_close(&xwb);
+    }
+
+    return ok;
+}
+
+/**
+ * Reads size bytes at offset of a file, returns 1 if all were there.
+ */
+static int read_file_at(const char * name, off_t offset, uint8_t * buf, size_t size) {
+    FILE * infile = fopen(name, "rb");
+    int ok;
+
+    if (!infile)
+        return 0;
+    ok = fseeko(infile, offset, SEEK_SET) == 0 && fread(buf, 1, size, infile) == size;
+    fclose(infile);
+    return ok;
+}
+
+/**
+ * Splits a sparse bank over 4GB with each writer, checking output sizes and the marker bytes
+ * patched in at the start, middle and end of each stream (the rest is a hole).
+ */
+static int check_large_bank(const char * dir, const char * split_path) {
+    static const char * writers[] = { "", "-j 4", "-u 4" };
+    char bank_name[MAX_PATH], name[MAX_PATH], args[MAX_PATH];
+    off_t offsets[LARGE_STREAMS], marker_pos[LARGE_STREAMS][3];
+    size_t sizes[LARGE_STREAMS], marker_size[LARGE_STREAMS], header_size;
+    uint8_t markers[LARGE_STREAMS][3][8], buf[8];
+    unsigned char * header = NULL;
+    size_t header_max = 0;
+    xwb_context xwb;
+    xwb_options opts;
+    xwb_stream_info info;
+    FILE * outfile;
+    int writer, i, j, ok = 1;
+
+    format_path(name, "%s%clarge", dir, DIRSEP);
+    make_directory(name);
+    format_path(bank_name, "%s%clarge%cbank", dir, DIRSEP, DIRSEP);
+    format_path(name, "%s.xwb", bank_name);
+    rng_state = 1;
+    CHECK_EXIT(!make_xwb(&layouts[4], LARGE_STREAMS, LARGE_AVG_SIZE, 1, LARGE_DATA_START, name), "ERROR: can't make %s", name);
+
+    memset(&opts, 0, sizeof(opts));
+    opts.ignore_xsb_xwb_name = 1;
+    CHECK_EXIT(xwb_open(&xwb, name, NULL, &opts) != XWB_OK, "%s: %s", name, xwb_error(&xwb));
+    CHECK_EXIT(xwb.xwb.streams_count != LARGE_STREAMS, "ERROR: %s has %i streams", name, (int)xwb.xwb.streams_count);
+    for (i = 0; i < LARGE_STREAMS; i++) {
+        CHECK_EXIT(xwb_get_stream(&xwb, i, &info, &header, &header_max) != XWB_OK, "%s", xwb_error(&xwb));
+        offsets[i] = info.offset;
+        sizes[i] = info.size;
+    }
+    header_size = info.header_size;
+    free(header);
+    xwb_close(&xwb);
+
+    if ((uint64_t)offsets[LARGE_STREAMS - 1] <= UINT32_MAX) {
+        printf("    %s: last stream isn't past 4GB\n", name);
+        return 0;
+    }
+
+    outfile = fopen(name, "r+b");
+    CHECK_EXIT(!outfile, "ERROR: can't open %s", name);
+    for (i = 0; i < LARGE_STREAMS; i++) {
+        marker_size[i] = sizes[i] < 8 ? sizes[i] : 8;
+        marker_pos[i][0] = 0;
+        marker_pos[i][1] = sizes[i] / 2 - sizes[i] / 2 % 8;
+        marker_pos[i][2] = sizes[i] - marker_size[i];
+        for (j = 0; j < 3; j++) {
+            uint32_t values[2] = { rng_next(), rng_next() };
+            memcpy(markers[i][j], values, 8);
+            CHECK_EXIT(fseeko(outfile, offsets[i] + marker_pos[i][j], SEEK_SET) != 0
+                    || fwrite(markers[i][j], 1, marker_size[i], outfile) != marker_size[i], "ERROR: can't write %s", name);
+        }
+    }
+    CHECK_EXIT(fclose(outfile) != 0, "ERROR: can't write %s", name);
+
+    for (writer = 0; writer < sizeof(writers) / sizeof(writers[0]); writer++) {
+        format_path(args, "-o -I -P %s \"%s.xwb\"", writers[writer], bank_name);
+        if (!run_split(split_path, args)) {
+            ok = 0;
+            continue;
+        }
+
+        for (i = 0; i < LARGE_STREAMS; i++) {
+            struct stat st;
+
+            format_path(name, "%s%c%03i.xwb", bank_name, DIRSEP, i);
+            if (stat(name, &st) != 0 || (uint64_t)st.st_size != header_size + sizes[i]) {
+                printf("    %s: not written or wrong size (%s)\n", name, writers[writer]);
+                ok = 0;
+                continue;
+            }
+            for (j = 0; j < 3; j++) {
+                if (!read_file_at(name, header_size + marker_pos[i][j], buf, marker_size[i])
+                        || memcmp(buf, markers[i][j], marker_size[i]) != 0) {
+                    printf("    %s: wrong data at %"PRIu64" (%s)\n", name, (uint64_t)marker_pos[i][j], writers[writer]);
+                    ok = 0;
+                }
+            }
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * A bad bank in batch mode must be skipped: the banks after it are still split, and the run fails.
+ */
+static int check_batch_failures(const char * dir, const char * split_path) {
+    static const char garbage[] = "not a wavebank, not even close";
+    char batch_dir[MAX_PATH], name[MAX_PATH], args[MAX_PATH];
+    uint64_t * hashes;
+    FILE * outfile;
+    int count;
+
+    format_path(batch_dir, "%s%cbatch", dir, DIRSEP);
+    make_directory(batch_dir);
+
+    /* found in name order, so the bad one goes first */
+    format_path(name, "%s%ca_bad.xwb", batch_dir, DIRSEP);
+    outfile = fopen(name, "wb");
+    CHECK_EXIT(!outfile || fwrite(garbage, 1, sizeof(garbage), outfile) != sizeof(garbage) || fclose(outfile) != 0, "ERROR: can't write %s", name);
+    format_path(name, "%s%cb_good", batch_dir, DIRSEP);
+    make_bank(&layouts[4], 4, 1, name);
+
+    format_path(args, "-c -o -b \"%s\"", batch_dir);
+    if (!run_split_expecting(split_path, args, 1))
+        return 0;
+
+    count = hash_outputs(name, &hashes);
+    free(hashes);
+    if (count != 4) {
+        printf("    %s: %i outputs instead of 4\n", name, count);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * A bank piped into xwb_split (input -) must be read to the end with every output, so the writer
+ * never gets a broken pipe. The last stream is empty and starts right at the end of the wave data.
+ */
+static int check_stdin_pipe(const char * dir, const char * split_path) {
+    static const char * outputs[] = { "-l", "-T", "" };
+    static const unsigned char padding[0x10000];
+    char pipe_dir[MAX_PATH], bank_name[MAX_PATH], name[MAX_PATH], command[MAX_PATH];
+    uint8_t * data;
+    off_t entry, data_size;
+    uint64_t * hashes;
+    xwb_context xwb;
+    xwb_options opts;
+    FILE * outfile;
+    struct stat st;
+    int output, i, count, ret, ok = 1;
+
+#ifdef SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    format_path(pipe_dir, "%s%cpipe", dir, DIRSEP);
+    make_directory(pipe_dir);
+    format_path(bank_name, "%s%cbank", pipe_dir, DIRSEP);
+    make_bank(&layouts[4], 8, 1, bank_name);
+
+    format_path(name, "%s.xwb", bank_name);
+    memset(&opts, 0, sizeof(opts));
+    opts.ignore_xsb_xwb_name = 1;
+    CHECK_EXIT(xwb_open(&xwb, name, NULL, &opts) != XWB_OK, "%s: %s", name, xwb_error(&xwb));
+    entry = xwb.xwb.entry_offset + 7 * xwb.xwb.entry_elem_size;
+    outfile = fopen(name, "r+b");
+    CHECK_EXIT(!outfile, "ERROR: can't open %s", name);
+    put_32_le_seek(xwb.xwb.data_size, entry + 0x08, outfile);
+    put_32_le_seek(0, entry + 0x0c, outfile);
+    CHECK_EXIT(fclose(outfile) != 0, "ERROR: can't write %s", name);
+    xwb_close(&xwb);
+
+    data = load_file(name, &data_size);
+    CHECK_EXIT(!data, "ERROR: can't open %s", name);
+
+    for (output = 0; output < sizeof(outputs) / sizeof(outputs[0]); output++) {
+        ret = snprintf(command, MAX_PATH, "\"%s\" -c -o %s -x \"%s.xsb\" - > " NULL_DEVICE " 2>&1", split_path, outputs[output], bank_name);
+        CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+
+        /* more than a pipe buffer past the bank, so an exit before reading it all breaks the pipe */
+        outfile = popen(command, "w");
+        CHECK_EXIT(!outfile, "ERROR: can't run %s", command);
+        ret = fwrite(data, 1, data_size, outfile) == data_size;
+        for (i = 0; ret && i < 16; i++)
+            ret = fwrite(padding, 1, sizeof(padding), outfile) == sizeof(padding);
+        ret = fflush(outfile) == 0 && ret;
+        if (pclose(outfile) != 0 || !ret) {
+            printf("    %s: %s\n", ret ? "failed" : "didn't read the whole pipe", command);
+            ok = 0;
+        }
+    }
+    free(data);
+
+    format_path(name, "%s_manifest.tsv", bank_name);
+    if (stat(name, &st) != 0) {
+        printf("    %s: not written\n", name);
+        ok = 0;
+    }
+    count = hash_outputs(bank_name, &hashes);
+    free(hashes);
+    if (count != 8) {
+        printf("    %s: %i outputs instead of 8\n", bank_name, count);
+        ok = 0;
+    }
+    return ok;
+}
+
+typedef int (*check_fn)(const char * dir, const char * split_path);
+
+typedef struct {
+    const char * name;
+    check_fn fn;
+    int large; /* writes GBs (sparse) and some MBs, only with check -l */
+} bench_check;
+
+static const bench_check checks[] = {
+    { "overwrite hardlinked outputs", check_overwrite_links, 0 },
+    { "-W outputs of every layout", check_riff_outputs, 0 },
+    { "batch mode skips bad banks", check_batch_failures, 0 },
+    { "stdin is read to the end", check_stdin_pipe, 0 },
+    { "split a sparse bank over 4GB", check_large_bank, 1 },
+};
+
+/**
+ * Runs every check (with large ones or only those) in dir, returns the number that failed.
+ */
+static int check(const char * dir, const char * split_path, int large) {
+    int i, failed = 0;
+
+    make_directory(dir);
+
+    for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        int ok;
+
+        if (checks[i].large != large)
+            continue;
+        ok = checks[i].fn(dir, split_path);
+        printf("%-40s %s\n", checks[i].name, ok ? "ok" : "FAILED");
+        fflush(stdout);
+        failed += !ok;
+    }
+
+    return failed;
+}
+
+static void usage(const char * name) {
+    fprintf(stderr,"xwb_split benchmark\n\n"
+            "Usage: %s gen [-s bytes] [-z] (dir) (streams) ...\n"
+            "       %s run [-x xwb_split] (dir)\n"
+            "       %s check [-l] [-x xwb_split] (dir)\n"
+            "gen: writes a bank of each layout (XACT1/1.1/2/3, LE/BE, compact, multi-wavebank .xsb) per stream count\n"
+            "    -s bytes: average stream size (default 1024)\n"
+            "    -z: leave stream data as a hole (zeroes in a sparse file), for multi-GB banks that take no space\n"
+            "       Banks are skipped when the data doesn't fit their offsets (4GB, or 1GB for compact entries)\n"
+            "    .xsb are skipped when the streams don't fit their format (over 65535, or 64KB for XACT1)\n"
+            "run: times each bank in dir: parse (.xwb only), names (.xsb and name lookups on top),\n"
+            "    and running xwb_split with -l, the default split with each -C copy method, -j 4, -u 4 and -a (best of a few runs)\n"
+            "    Each split's outputs are compared with a serial buffered split first, mismatch instead of a time if they differ\n"
+            "    Methods the platform lacks fall back like in xwb_split, so they time the same as buffered\n"
+            "    -a is skipped when its outputs would take over 1GB, as each one repeats the whole bank header\n"
+            "    -x xwb_split: path to the splitter (default ./xwb_split)\n"
+            "check: regression checks, splits banks made in dir and checks the outputs (exit code 1 if any fails)\n"
+            "    -l: run the large file checks instead, on a sparse bank over 4GB (needs ~200MB free)\n"
+            ,name, name, name);
+}
+
+int main(int argc, char ** argv) {
+    int i;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "gen") == 0) {
+        uint64_t avg_size = 1024;
+        int sparse = 0;
+        int * counts = malloc(argc * sizeof(int));
+        int counts_total = 0;
+        const char * dir = NULL;
+
+        CHECK_EXIT(!counts, "ERROR: out of memory");
+        for (i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                avg_size = read_long(argv[++i]);
+                CHECK_EXIT(avg_size == 0 || avg_size > UINT32_MAX / 2, "ERROR: bad stream size");
+            }
+            else if (strcmp(argv[i], "-z") == 0) {
+                sparse = 1;
+            }
+            else if (!dir) {
+                dir = argv[i];
+            }
+            else {
+                counts[counts_total] = read_long(argv[i]);
+                CHECK_EXIT(counts[counts_total] <= 0, "ERROR: bad stream count");
+                counts_total++;
+            }
+        }
+        CHECK_EXIT(!dir || counts_total == 0, "ERROR: missing dir or stream counts");
+
+        generate(dir, counts, counts_total, avg_size, sparse);
+        free(counts);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "run") == 0) {
+        const char * split_path = "./xwb_split";
+        const char * dir = NULL;
+
+        for (i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+                split_path = argv[++i];
+            else
+                dir = argv[i];
+        }
+        CHECK_EXIT(!dir, "ERROR: missing dir");
+
+        run(dir, split_path);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "check") == 0) {
+        const char * split_path = "./xwb_split";
+        const char * dir = NULL;
+        int large = 0;
+
+        for (i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+                split_path = argv[++i];
+            else if (strcmp(argv[i], "-l") == 0)
+                large = 1;
+            else
+                dir = argv[i];
+        }
+        CHECK_EXIT(!dir, "ERROR: missing dir");
+
+        return check(dir, split_path, large) ? 1 : 0;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
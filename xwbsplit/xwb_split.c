@@ -7,24 +7,43 @@
  */
 
 #include "util.h"
+#include "xwb.h"
+#include "pool.h"
+#include "uring.h"
+#include "server.h"
+#include "dedup.h"
+#include "hash.h"
+#include "stats.h"
+#include "tar.h"
+#include "filter.h"
+#include "thread.h"
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
 
 #define VERSION "1.1.4"
 enum { MAX_PATH = 32768 };
+enum { MAX_ERROR = 512 };
 
-#define WAVEBANK_FLAGS_COMPACT              0x00020000  // Bank uses compact format
+#define BATCH_BANKS     64          /* banks open at once in batch mode */
+#define SERVER_CACHE_MB 64          /* parsed banks kept in daemon mode */
 
-/* the x.x version is just to make it clearer, MS only classifies XACT as 1/2/3 */
-#define XACT1_0_MAX     1           /* Project Gotham Racing 2 (v1), Silent Hill 4 (v1) */
-#define XACT1_1_MAX     3           /* Unreal Championship (v2), The King of Fighters 2003 (v3) */
-#define XACT2_0_MAX     34          /* Dead or Alive 4 (v17), Kameo (v23), Table Tennis (v34) */ // v35/36/37 too?
-#define XACT2_1_MAX     38          /* Prey (v38) */ // v39 too?
-#define XACT2_2_MAX     41          /* Blue Dragon (v40) */
-#define XACT3_0_MAX     46          /* Ninja Blade (t43 v42), Persona 4 Ultimax NESSICA (t45 v43) */
-#define XACT_TECHLAND   0x10000     /* Sniper Ghost Warrior, Nail'd (PS3/X360) */
-#define XACT_CRACKDOWN  0x87        /* Crackdown 1, equivalent to XACT2_2 */
-#define XSB_XACT1_MAX   11
-#define XSB_XACT2_MAX   41
+/* how identical outputs are shared */
+enum {
+    DEDUP_NONE,
+    DEDUP_HARDLINK,     /* same file */
+    DEDUP_REFLINK,      /* separate files sharing the data (btrfs/xfs), hardlink if not supported */
+};
+
+/* what gets written for each stream */
+enum {
+    OUTPUT_SPLIT,       /* split .xwb with header + copied data */
+    OUTPUT_TXTP,        /* .txtp pointing to the subsong in the original bank, for vgmstream */
+    OUTPUT_MANIFEST,    /* a single (bank)_manifest.tsv with subsongs, offsets, sizes and names */
+    OUTPUT_ARCHIVE,     /* split .xwb as members of a single tar, for all banks */
+    OUTPUT_RIFF,        /* .wav with a RIFF header made from the stream's format, then the stream data */
+};
 
 
 #define CHECK_EXIT(condition, ...) \
@@ -35,6 +54,16 @@ enum { MAX_PATH = 32768 };
        DEBUG_EXIT; \
     } } while (0)
 
+/**
+ * For code that also runs on -j threads, where nothing can exit: keeps the message in
+ * error (MAX_ERROR) and returns 0, so the caller's thread can pass it on to the main one.
+ */
+#define CHECK_FAIL(error, condition, ...) \
+    do {if (condition) { \
+       snprintf(error, MAX_ERROR, __VA_ARGS__); \
+       return 0; \
+    } } while (0)
+
 
 /**
  * Program config to move around
@@ -56,115 +85,174 @@ typedef struct {
     int ignore_names_not_found;
     int debug;
     int alt_extraction;
-
-    FILE *xwb_file;
-    FILE *xsb_file;
+    int threads;
+    int uring_depth; /* 0 = don't use io_uring */
+    int batch;
+    const char * soundbank_name; /* -X, split every wavebank of this .xsb */
+    int streaming; /* .xwb read front to back from stdin (input "-") */
+    int use_index; /* load/save a sidecar (bank).xwb.idx */
+    int resume; /* skip outputs a previous run already wrote: 1 checks sizes, 2 also contents */
+    int dedup;
+    const char * dedup_name; /* persistent fingerprint store, NULL for none */
+    dedup_store * dedup_store; /* shared by all banks */
+    int checksums; /* CHECKSUM_* flags for the per-bank checksum file, 0 for none */
+    const char * socket_path; /* daemon mode */
+    int cache_mb;
+    stats * stats; /* --stats, shared by all banks, NULL when not wanted */
+    int stats_json;
+    int output;
+    const char * out_ext; /* stream extension, depends on output */
+    const char * archive_name; /* -A, "-" for stdout */
+    int archive_fd;
+    int64_t archive_mtime; /* of every member, when the run started */
+    int archive_members;
+    stream_filter * filter; /* -S/-N/-E/--min-size/--max-size, NULL to write every stream */
+    uint64_t min_size;
+    uint64_t max_size; /* 0 for no limit */
+
+    char ** inputs; /* input .xwb or dirs, from argv */
+    int inputs_count;
+
+    /* output info, resolved once */
+    char out_base[MAX_PATH];
+    char out_path[MAX_PATH];
 
 } xwb_config;
 
 
 /**
- * XWB contain stream info (channels, loop, data etc), often from multiple streams.
- * XSBs contain info about how to play sounds (volume, pitch, name, etc) from XWBs (music or SFX).
- * We only need to parse the XSB for the stream names.
+ * A bank being split, with its own config copy since some values are autodetected per bank
  */
 typedef struct {
-    int sound_count;
-} xsb_wavebank;
-
-typedef struct {
-    int stream_index; /* stream id in the xwb (doesn't need to match xsb sound order) */
-    int wavebank; /* xwb id, if the xsb has multiple wavebanks */
-    off_t name_index; /* name order */
-    off_t name_offset; /* global offset to the name string */
-    off_t sound_offset; /* global offset to the xsb sound */
-    off_t unk_index; /* some kind of number up to sound_count or 0xffff */
-} xsb_sound;
+    xwb_config cfg;
+    xwb_context ctx;
+    checksum_state * sums; /* per stream, when writing checksums */
+    int * selected; /* streams to write (all unless filtered), in order */
+    int selected_count;
+} xwb_bank;
 
+/**
+ * Per-thread state to write streams
+ */
 typedef struct {
-    off_t stream_offset;
-    size_t stream_size;
-} xwb_stream;
+    unsigned char * buf; /* copy buffer */
+    size_t buf_size;
+    unsigned char * header; /* split header buffer */
+    size_t header_size;
+    char name[MAX_PATH]; /* last output name */
+    int defer_print; /* stream line is printed by the caller once done */
+    int skipped; /* last output was already written (resuming) */
+    double started; /* wall time the current stream was started (io_uring, with stats) */
+    char error[MAX_ERROR]; /* why the last stream failed */
+} xwb_worker;
 
+/**
+ * Shared state to write streams in parallel
+ */
 typedef struct {
-    /* XWB header info */
-    int little_endian;
-    int version;
+    xwb_bank * banks;
+    int * job_bank; /* bank and stream of each job, in bank then stream order */
+    int * job_stream;
+    int jobs_count;
+    xwb_worker * workers;
+    int workers_count;
 
-    /* segments */
-    off_t base_offset;
-    size_t base_size;
-    off_t entry_offset;
-    size_t entry_size;
-    off_t extra1_offset;
-    size_t extra1_size;
-    off_t extra2_offset;
-    size_t extra2_size;
-    off_t data_offset;
-    size_t data_size;
+    char ** lines; /* finished stream lines, printed in job order */
+    int next_line;
+    int skipped; /* outputs already written (resuming) */
+    int failed; /* a job failed, the rest aren't started and the main thread exits with error */
+    char error[MAX_ERROR];
+    pthread_mutex_t lines_lock; /* also for failed/error */
 
-    off_t names_offset;
-    size_t names_size;
-
-    uint32_t base_flags;
-    size_t entry_elem_size;
-    size_t name_elem_size;
-    size_t entry_alignment;
-
-    xwb_stream * xwb_streams; /* array of stream info from the xwb, simplified */
-    size_t streams_count;
-    int is_stardew_valley;
-
-
-    /* XSB header info */
-    xsb_sound * xsb_sounds; /* array of sounds info from the xsb, simplified */
-    xsb_wavebank * xsb_wavebanks; /* array of wavebank info from the xsb, simplified */
-
-    off_t xsb_sounds_offset;
-    size_t xsb_sounds_count;
-
-    size_t xsb_simple_sounds_offset; /* sound cues */
-    size_t xsb_simple_sounds_count;
-    size_t xsb_complex_sounds_offset;
-    size_t xsb_complex_sounds_count;
-
-    size_t xsb_wavebanks_count;
-    off_t xsb_nameoffsets_offset;
-} xwb_header;
+    stats_timer timer; /* io_uring phases, all in one thread */
+} xwb_jobs;
 
 
 static void usage(const char * name);
 static void parse_cfg(xwb_config *cfg, int argc, char ** argv);
-static void parse_xwb(xwb_header * xwb, xwb_config * cfg);
-static void parse_xsb(xwb_header * xwb, xwb_config * cfg);
-static void write_stream(xwb_header * xwb, xwb_config * cfg, int num_stream);
-static void get_output_name(char * buf_path, char * buf_name, int buf_size, xwb_header * xwb, xwb_config * cfg, int num_stream);
+static int open_bank(xwb_bank * bank, char * error);
+static void open_stream_bank(xwb_bank * bank);
+static void drain_input(reader * xwb_file);
+static int parse_bank(xwb_bank * bank, reader * xwb_file, reader * xsb_file, const xwb_context * xsb, char * error);
+static void get_options(xwb_config * cfg, xwb_options * opts);
+static void close_bank(xwb_bank * bank);
+static int prepare_output(xwb_bank * bank, char * error);
+static int write_stream(xwb_bank * bank, int num_stream, xwb_worker * worker);
+static void write_streams(xwb_bank * banks, int banks_count, xwb_config * cfg);
+static int write_batch(xwb_config * cfg);
+static void write_soundbank(xwb_config * cfg);
+static void resolve_output(xwb_config * cfg);
+static int get_output_name(char * buf_name, int buf_size, xwb_bank * bank, int num_stream, char * error);
+static void write_checksums(xwb_bank * bank);
+static void close_dedup(xwb_config * cfg);
+static void open_archive(xwb_config * cfg);
+static void close_archive(xwb_config * cfg);
 
 
 int main(int argc, char ** argv) {
-    int stream;
-    xwb_config cfg;
-    xwb_header xwb;
+    xwb_bank bank;
+    xwb_config * cfg = &bank.cfg;
+    stats_timer timer;
+    char error[MAX_ERROR];
+    int failed = 0;
 
-    memset(&cfg,0,sizeof(xwb_config));
-    memset(&xwb,0,sizeof(xwb_header));
+    memset(&bank,0,sizeof(xwb_bank));
     
     if (argc <= 1) {
         usage(argv[0]);
         return 1;
     }
 
-    parse_cfg(&cfg, argc, argv);
-    parse_xwb(&xwb, &cfg);
-    parse_xsb(&xwb, &cfg);
+    /* stats don't exist until the flags are parsed */
+    get_times(&timer.wall, &timer.cpu);
+    parse_cfg(cfg, argc, argv);
+    stats_stop(cfg->stats, STATS_PARSE_CFG, 1, &timer);
+
+    if (cfg->socket_path) {
+        xwb_options opts;
+        get_options(cfg, &opts);
+        CHECK_EXIT(!server_run(cfg->socket_path, (size_t)cfg->cache_mb * 1024 * 1024, cfg->overwrite, &opts),
+                "ERROR: daemon mode not supported on this platform");
+        return 0;
+    }
 
-    printf("Writting streams...\n");
+    if (cfg->dedup) {
+        cfg->dedup_store = dedup_open(cfg->dedup_name);
+        CHECK_EXIT(!cfg->dedup_store, "ERROR: failed loading fingerprint file");
+    }
 
-    for (stream = 0; stream < xwb.streams_count; stream++) {
-        write_stream(&xwb, &cfg, stream);
+    if (cfg->archive_name && !cfg->list_only)
+        open_archive(cfg);
+
+    if (cfg->batch || cfg->soundbank_name) {
+        if (cfg->batch)
+            failed = write_batch(cfg);
+        else
+            write_soundbank(cfg);
+        close_dedup(cfg);
+        close_archive(cfg);
+        stats_print(cfg->stats, cfg->stats_json);
+        return failed ? 1 : 0;
     }
 
+    if (cfg->streaming)
+        open_stream_bank(&bank);
+    else
+        CHECK_EXIT(!open_bank(&bank, error), "%s", error);
+
+    printf("Writting streams...\n");
+
+    CHECK_EXIT(!prepare_output(&bank, error), "%s", error);
+
+    write_streams(&bank, 1, cfg);
+    write_checksums(&bank);
+    if (cfg->streaming)
+        drain_input(bank.ctx.xwb_file);
+    close_dedup(cfg);
+    close_archive(cfg);
+
     printf("Done\n");
+    stats_print(cfg->stats, cfg->stats_json);
 
     //todo close/cleanup (not important since the SO will release resources after exit, but ugly)
     return 0;
@@ -173,6 +261,8 @@ int main(int argc, char ** argv) {
 static void usage(const char * name) {
     fprintf(stderr,"xwb splitter " VERSION " " __DATE__ "\n\n"
             "Usage: %s [options] (infile).xwb\n"
+            "       %s -b [options] (infile).xwb|(dir) ...\n"
+            "       %s -X (infile).xsb [options] [(infile).xwb|(dir) ...]\n"
             "Options:\n"
             "    -x file.xsb: name of the .xsb companion file used for stream names\n"
             "       Defaults to (infile).xwb if not specified\n"
@@ -196,16 +286,78 @@ static void usage(const char * name) {
             "    -o: overwrite extracted files\n"
             "    -d: print debug info\n"
             "    -a: alt extraction method if current fails\n"
-            ,name);
+            "    -b: batch mode, split every input .xwb and every .xwb found in input dirs\n"
+            "       Each bank uses its companion (bank).xsb, or its own names if not found\n"
+            "    -X file.xsb: split every wavebank of a multi .xsb, which is parsed once for all of them\n"
+            "       Each .xwb is matched to its wavebank by its bank name or file name (by stream count if the\n"
+            "       .xsb has no wavebank names); uses (wavebank name).xwb next to the .xsb if none are given\n"
+            "    -j N: write streams using N threads (one thread on Windows builds)\n"
+            "       Bigger streams go first, output is the same as with a single thread\n"
+            "    -u N: write streams with io_uring, keeping N files in flight (Linux)\n"
+            "       Uses normal writes if io_uring isn't available, takes precedence over -j\n"
+            "    -t: write a .txtp per stream pointing to the bank's subsong, instead of copying data\n"
+            "    -T: write a single (infile)_manifest.tsv with each stream's subsong, offset, size and name\n"
+            "    -W: write a .wav per stream (RIFF with the stream's format and data) instead of a split .xwb\n"
+            "       Works for PCM, ADPCM and XMA2 streams, so they can be read without parsing the .xwb\n"
+            "    -A file: write the split streams of all banks into a single tar instead of a folder per bank (- for stdout)\n"
+            "       Members are (bank)/(stream).xwb, as in the folders; messages go to stderr when writing to stdout\n"
+            "       Written by a single thread, so it can't be combined with -j or -u\n"
+            ,name,name,name);
+    fprintf(stderr,
+            "    -S ranges: only write streams in index ranges, like 0-19,40,100- (as the Stream NNN numbers)\n"
+            "    -N glob: only write streams whose name matches glob (* ? [set], can be repeated)\n"
+            "    -E regex: only write streams whose name matches the extended regex (anywhere, use ^$ for whole names)\n"
+            "    --min-size=N, --max-size=N: only write streams with N or more/fewer bytes of data\n"
+            "       Filters combine (a stream must pass all), other streams aren't read or written\n"
+            "    -H sums: write (infile)_checksums.tsv next to the split streams with each one's size and checksums\n"
+            "       sums: crc32c, xxh64 or all; computed while copying, so outputs aren't read again\n"
+            "    -k: keep a sidecar (infile).xwb.idx with the parsed bank and names\n"
+            "       Later runs load it instead of parsing, until the .xwb or .xsb change\n"
+            "    -r: resume, skip outputs that already have the expected size and rewrite the rest\n"
+            "       For restarting a split that was stopped halfway\n"
+            "    -R: resume, also comparing the content of existing outputs (reads them back)\n"
+            "    -L mode: link identical outputs (same header and data, in any bank) instead of copying\n"
+            "       hard: hardlinks, reflink: copies sharing the data where supported, hardlinks otherwise\n"
+            "    -F file: keep -L fingerprints in file, so later runs link to earlier outputs too\n"
+            "    -C method: stream data copy method (auto, copy_range, sendfile, buffered)\n"
+            "       Defaults to auto: copy in the kernel when possible, buffered otherwise\n"
+            "    -D socket: daemon mode, serve stream requests on a Unix socket instead of splitting\n"
+            "       Parsed banks are cached, see server.h for requests (list, extract, send, fd, stats)\n"
+            "    -M N: daemon cache size in MB (default %i)\n"
+            "    --stats[=json]: print time per phase, I/O counts, peak memory and stream latencies to stderr\n"
+            "       Batch mode adds up all banks, JSON prints a single object\n"
+            "Use - as infile to read the .xwb from stdin in a single pass (for pipes)\n"
+            "    Streams are named after the -x .xsb, or stdin_NNN with the .xwb names\n"
+            "    The input is always read to the end, also with -l and -T, so the writer doesn't get SIGPIPE\n"
+            ,SERVER_CACHE_MB);
+}
+
+
+/* filters are made when the first filter flag is found */
+static stream_filter * get_filter(xwb_config * cfg) {
+    if (!cfg->filter)
+        cfg->filter = filter_new();
+    return cfg->filter;
 }
 
+static int read_size(const char * text, uint64_t * size) {
+    char * end;
+
+    if (*text < '0' || *text > '9')
+        return 0;
+    *size = strtoull(text, &end, 10);
+    return *end == '\0';
+}
 
 static void parse_cfg(xwb_config * cfg, int argc, char ** argv) {
     int i;
     for (i = 1; i < argc; i++) {
-        if (argv[i][0] != '-') {
-            CHECK_EXIT(cfg->xwb_name[0]!=0, "ERROR: multiple input .xwb specified");
-            strcpy(cfg->xwb_name, argv[i]);
+        if (argv[i][0] != '-' || argv[i][1] == '\0') {
+            if (!cfg->inputs) {
+                cfg->inputs = malloc(argc * sizeof(char *));
+                CHECK_EXIT(!cfg->inputs, "ERROR: out of memory");
+            }
+            cfg->inputs[cfg->inputs_count++] = argv[i];
             continue;
         }
 
@@ -260,12 +412,211 @@ static void parse_cfg(xwb_config * cfg, int argc, char ** argv) {
             case 'a':
                 cfg->alt_extraction = 1;
                 break;
+            case 'b':
+                cfg->batch = 1;
+                break;
+            case 'X':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty xsb name");
+                i++;
+                cfg->soundbank_name = argv[i];
+                break;
+            case 'j':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty thread count");
+                i++;
+                cfg->threads = strtol(argv[i], NULL, 10);
+                CHECK_EXIT(cfg->threads<=0, "ERROR: wrong thread count (must be numeric and 1 or more)");
+                break;
+            case 'u':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty queue depth");
+                i++;
+                cfg->uring_depth = strtol(argv[i], NULL, 10);
+                CHECK_EXIT(cfg->uring_depth<=0, "ERROR: wrong queue depth (must be numeric and 1 or more)");
+                break;
+            case 't':
+                cfg->output = OUTPUT_TXTP;
+                break;
+            case 'T':
+                cfg->output = OUTPUT_MANIFEST;
+                break;
+            case 'W':
+                cfg->output = OUTPUT_RIFF;
+                break;
+            case 'A':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty archive name");
+                i++;
+                cfg->archive_name = argv[i];
+                cfg->output = OUTPUT_ARCHIVE;
+                break;
+            case 'H':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty checksums");
+                i++;
+                if (strcmp(argv[i], "crc32c") == 0)
+                    cfg->checksums = CHECKSUM_CRC32C;
+                else if (strcmp(argv[i], "xxh64") == 0)
+                    cfg->checksums = CHECKSUM_XXH64;
+                else if (strcmp(argv[i], "all") == 0)
+                    cfg->checksums = CHECKSUM_CRC32C | CHECKSUM_XXH64;
+                else
+                    CHECK_EXIT(1, "ERROR: unknown checksums (must be crc32c, xxh64 or all)");
+                break;
+            case 'r':
+                cfg->resume = 1;
+                break;
+            case 'R':
+                cfg->resume = 2;
+                break;
+            case 'L':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty link mode");
+                i++;
+                if (strcmp(argv[i], "hard") == 0)
+                    cfg->dedup = DEDUP_HARDLINK;
+                else if (strcmp(argv[i], "reflink") == 0)
+                    cfg->dedup = DEDUP_REFLINK;
+                else
+                    CHECK_EXIT(1, "ERROR: unknown link mode (must be hard or reflink)");
+                break;
+            case 'F':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty fingerprint file");
+                i++;
+                cfg->dedup_name = argv[i];
+                break;
+            case 'k':
+                cfg->use_index = 1;
+                break;
+            case 'D':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty socket path");
+                i++;
+                cfg->socket_path = argv[i];
+                break;
+            case 'M':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty cache size");
+                i++;
+                cfg->cache_mb = strtol(argv[i], NULL, 10);
+                CHECK_EXIT(cfg->cache_mb<=0, "ERROR: wrong cache size (must be numeric and 1 or more)");
+                break;
+            case 'S':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty stream ranges");
+                i++;
+                CHECK_EXIT(!filter_add_ranges(get_filter(cfg), argv[i]), "ERROR: wrong stream ranges (must be like 0-19,40,100-)");
+                break;
+            case 'N':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty name glob");
+                i++;
+                CHECK_EXIT(!filter_add_glob(get_filter(cfg), argv[i]), "ERROR: wrong name glob (unclosed [set])");
+                break;
+            case 'E':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty name regex");
+                i++;
+                CHECK_EXIT(!filter_set_regex(get_filter(cfg), argv[i]), "ERROR: wrong name regex (or not supported on this platform)");
+                break;
+            case '-':
+                if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+                    if (!cfg->stats)
+                        cfg->stats = stats_new();
+                    cfg->stats_json = argv[i][7] == '=';
+                }
+                else if (strncmp(argv[i], "--min-size=", 11) == 0) {
+                    CHECK_EXIT(!read_size(argv[i] + 11, &cfg->min_size), "ERROR: wrong min size (must be numeric)");
+                    get_filter(cfg);
+                }
+                else if (strncmp(argv[i], "--max-size=", 11) == 0) {
+                    CHECK_EXIT(!read_size(argv[i] + 11, &cfg->max_size) || cfg->max_size == 0, "ERROR: wrong max size (must be numeric and 1 or more)");
+                    get_filter(cfg);
+                }
+                else
+                    CHECK_EXIT(1, "ERROR: unknown option %s", argv[i]);
+                break;
+            case 'C':
+                CHECK_EXIT(i+1 >= argc, "ERROR: empty copy method");
+                i++;
+                if (strcmp(argv[i], "auto") == 0)
+                    set_dump_method(DUMP_AUTO);
+                else if (strcmp(argv[i], "copy_range") == 0)
+                    set_dump_method(DUMP_COPY_RANGE);
+                else if (strcmp(argv[i], "sendfile") == 0)
+                    set_dump_method(DUMP_SENDFILE);
+                else if (strcmp(argv[i], "buffered") == 0)
+                    set_dump_method(DUMP_BUFFERED);
+                else
+                    CHECK_EXIT(1, "ERROR: unknown copy method (must be auto, copy_range, sendfile or buffered)");
+                break;
 
             default:
                 break;
         }
     }
-    CHECK_EXIT(cfg->xwb_name[0]==0, "ERROR: input .xwb not specified");
+    if (cfg->socket_path) {
+        CHECK_EXIT(cfg->inputs_count > 0 || cfg->batch || cfg->xsb_name[0]!=0 || cfg->soundbank_name, "ERROR: daemon mode takes no input files");
+        CHECK_EXIT(cfg->stats != NULL, "ERROR: no --stats in daemon mode (use its stats request)");
+        CHECK_EXIT(cfg->filter != NULL, "ERROR: no stream filters in daemon mode (requests name their streams)");
+        if (!cfg->cache_mb)
+            cfg->cache_mb = SERVER_CACHE_MB;
+        return;
+    }
+
+    CHECK_EXIT(cfg->inputs_count == 0 && !cfg->soundbank_name, "ERROR: input .xwb not specified");
+
+    if (cfg->filter) {
+        CHECK_EXIT(cfg->max_size && cfg->min_size > cfg->max_size, "ERROR: min size over max size");
+        filter_set_sizes(cfg->filter, cfg->min_size, cfg->max_size ? cfg->max_size : UINT64_MAX);
+    }
+
+    cfg->out_ext = cfg->output == OUTPUT_TXTP ? "txtp" : (cfg->output == OUTPUT_RIFF ? "wav" : "xwb");
+
+    /* outputs that don't match are rewritten */
+    if (cfg->resume)
+        cfg->overwrite = 1;
+
+    CHECK_EXIT(cfg->dedup_name && !cfg->dedup, "ERROR: fingerprint file needs -L");
+    CHECK_EXIT(cfg->dedup && cfg->output != OUTPUT_SPLIT, "ERROR: can only link split outputs");
+    CHECK_EXIT(cfg->checksums && cfg->output != OUTPUT_SPLIT, "ERROR: can only checksum split outputs");
+    CHECK_EXIT(cfg->archive_name && cfg->output != OUTPUT_ARCHIVE, "ERROR: can only archive split outputs");
+    CHECK_EXIT(cfg->resume && cfg->output == OUTPUT_ARCHIVE, "ERROR: can't resume into an archive");
+    CHECK_EXIT(cfg->output == OUTPUT_ARCHIVE && (cfg->threads > 1 || cfg->uring_depth > 0), "ERROR: archives are written in order by one thread (no -j or -u with -A)");
+
+    if (cfg->soundbank_name) {
+        /* wavebanks and names come from the .xsb */
+        CHECK_EXIT(cfg->batch, "ERROR: can't use batch mode with -X (give the .xwb or dirs after it)");
+        CHECK_EXIT(cfg->xsb_name[0]!=0, "ERROR: can't specify another .xsb with -X");
+        CHECK_EXIT(cfg->selected_wavebank || cfg->start_sound, "ERROR: can't select a wavebank or start sound with -X");
+        CHECK_EXIT(cfg->ignore_xsb_name || cfg->ignore_xsb_xwb_name, "ERROR: can't ignore names with -X");
+        CHECK_EXIT(cfg->use_index, "ERROR: can't keep a sidecar index with -X");
+        for (i = 0; i < cfg->inputs_count; i++) {
+            CHECK_EXIT(strcmp(cfg->inputs[i], "-") == 0, "ERROR: can't read stdin with -X");
+        }
+        return;
+    }
+
+    if (cfg->batch) {
+        CHECK_EXIT(cfg->xsb_name[0]!=0, "ERROR: can't specify .xsb in batch mode");
+        for (i = 0; i < cfg->inputs_count; i++) {
+            CHECK_EXIT(strcmp(cfg->inputs[i], "-") == 0, "ERROR: can't read stdin in batch mode");
+        }
+        return;
+    }
+
+    CHECK_EXIT(cfg->inputs_count > 1, "ERROR: multiple input .xwb specified (use -b for batch mode)");
+    CHECK_EXIT(strlen(cfg->inputs[0]) >= MAX_PATH, "ERROR: buffer overflow");
+    strcpy(cfg->xwb_name, cfg->inputs[0]);
+
+    if (strcmp(cfg->xwb_name, "-") == 0) {
+        CHECK_EXIT(cfg->output == OUTPUT_TXTP, "ERROR: can't write .txtp for a .xwb read from stdin");
+        CHECK_EXIT(cfg->resume == 2, "ERROR: can't compare outputs with a .xwb read from stdin (use -r)");
+        CHECK_EXIT(cfg->dedup, "ERROR: can't link outputs with a .xwb read from stdin");
+        CHECK_EXIT(cfg->output == OUTPUT_ARCHIVE, "ERROR: can't archive a .xwb read from stdin");
+        CHECK_EXIT(cfg->output == OUTPUT_RIFF, "ERROR: can't write .wav from a .xwb read from stdin");
+        cfg->streaming = 1;
+    }
+}
+
+/**
+ * Opens the .xwb and its companion .xsb (derived from the .xwb name if not specified).
+ * Returns 0 on errors, with the message in error (MAX_ERROR).
+ */
+static int open_bank(xwb_bank * bank, char * error) {
+    xwb_config * cfg = &bank->cfg;
+    reader * xwb_file;
+    reader * xsb_file = NULL;
 
     /* get XSB name if not specified */
     if (cfg->xsb_name[0]==0) {
@@ -277,727 +628,1364 @@ static void parse_cfg(xwb_config * cfg, int argc, char ** argv) {
     }
     
     /* open files */
-    cfg->xwb_file = fopen(cfg->xwb_name, "rb");
-    CHECK_EXIT(!cfg->xwb_file, "ERROR: failed opening input .xwb");
+    xwb_file = reader_open(cfg->xwb_name, 1);
+    CHECK_FAIL(error, !xwb_file, "ERROR: failed opening input .xwb");
 
     if (!cfg->ignore_xsb_name && !cfg->ignore_xsb_xwb_name) {
-        cfg->xsb_file = fopen(cfg->xsb_name, "rb");
-        CHECK_EXIT(!cfg->xsb_file, "ERROR: failed opening companion .xsb (use -x to specify or -i to ignore)");
-    }
-}    
+        xsb_file = reader_open(cfg->xsb_name, 1);
 
-static void parse_xwb(xwb_header * xwb, xwb_config * cfg) {
-    /*quick hack from xwb.c (probably slow)*/
-    FILE * streamFile = cfg->xwb_file;
-    off_t off, suboff;
-    uint32_t (*read_32bit)(long,FILE*) = NULL;
-    int i;
+        /* in batch mode some banks are expected to lack names */
+        if (!xsb_file && cfg->batch) {
+            printf("No companion .xsb found, using .xwb names\n");
+        }
+        else if (!xsb_file) {
+            reader_close(xwb_file);
+            CHECK_FAIL(error, 1, "ERROR: failed opening companion .xsb (use -x to specify or -i to ignore)");
+        }
+    }
 
-    if ((read_32bitBE(0x00,streamFile) != 0x57424E44) &&    /* "WBND" (LE) */
-        (read_32bitBE(0x00,streamFile) != 0x444E4257))      /* "DNBW" (BE) */
-        goto fail;
+    return parse_bank(bank, xwb_file, xsb_file, NULL, error);
+}
 
-    xwb->little_endian = read_32bitBE(0x00,streamFile) == 0x57424E44;/* WBND */
-    if (xwb->little_endian) {
-        read_32bit = read_32bitLE;
-    } else {
-        read_32bit = read_32bitBE;
-    }
+/**
+ * Opens the .xwb from stdin and keeps its header in memory, the wave data is read later while writing.
+ * There is no .xwb name so the bank is named after the .xsb, if any.
+ */
+static void open_stream_bank(xwb_bank * bank) {
+    xwb_config * cfg = &bank->cfg;
+    reader * xwb_file;
+    reader * xsb_file = NULL;
+    char name[MAX_PATH];
+    char error[MAX_ERROR];
+    off_t header_end = 0;
+    int ret;
 
-    /* read main header (WAVEBANKHEADER) */
-    xwb->version = read_32bit(0x04, streamFile);
+    xwb_file = reader_open_pipe(0); /* stdin */
+    CHECK_EXIT(!xwb_file, "ERROR: failed opening input .xwb");
 
-    /* Crackdown 1 X360, essentially XACT2 but may have split header in some cases */
-    if (xwb->version == XACT_CRACKDOWN)
-        xwb->version = XACT2_2_MAX;
+    /* the first bytes tell how many more are needed */
+    do {
+        reader_fill(xwb_file, header_end);
+        ret = xwb_header_end(xwb_file, &header_end);
+    } while (ret == XWB_ERROR_READ);
+    CHECK_EXIT(ret != XWB_OK, "error parsing XWB");
+    reader_fill(xwb_file, header_end);
 
-    /* read segment offsets (SEGIDX) */
-    if (xwb->version <= XACT1_0_MAX) {
-        xwb->streams_count= read_32bit(0x0c, streamFile);
-        /* 0x10: bank name */
-        xwb->entry_elem_size = 0x14;
-        xwb->entry_offset= 0x50;
-        xwb->entry_size  = xwb->entry_elem_size * xwb->streams_count;
-        xwb->data_offset = xwb->entry_offset + xwb->entry_size;
-        xwb->data_size   = get_streamfile_size(streamFile) - xwb->data_offset;
+    if (cfg->xsb_name[0] == 0 || cfg->ignore_xsb_name || cfg->ignore_xsb_xwb_name) {
+        strcpy(cfg->xwb_name, "stdin.xwb");
     }
     else {
-        off = xwb->version <= XACT2_2_MAX ? 0x08 : 0x0c;
-        xwb->base_offset = read_32bit(off+0x00, streamFile);//BANKDATA
-        xwb->base_size   = read_32bit(off+0x04, streamFile);
-        xwb->entry_offset= read_32bit(off+0x08, streamFile);//ENTRYMETADATA
-        xwb->entry_size  = read_32bit(off+0x0c, streamFile);
-        xwb->extra1_offset= read_32bit(off+0x10, streamFile);//XACT1: ENTRYNAMES, XACT2: ? (SEEKTABLES in v40, ENTRYNAMES in doc), XACT3: SEEKTABLES
-        xwb->extra1_size  = read_32bit(off+0x14, streamFile);
-        if (xwb->version <= XACT1_1_MAX) {
-            xwb->data_offset    = read_32bit(off+0x18, streamFile);//ENTRYWAVEDATA
-            xwb->data_size      = read_32bit(off+0x1c, streamFile);
-        } else {
-            xwb->extra2_offset  = read_32bit(off+0x18, streamFile);//XACT2: ? (ENTRYNAMES in v40, EXTRA in doc), XACT3: ENTRYNAMES
-            xwb->extra2_size    = read_32bit(off+0x1c, streamFile);
-            xwb->data_offset    = read_32bit(off+0x20, streamFile);//ENTRYWAVEDATA
-            xwb->data_size      = read_32bit(off+0x24, streamFile);
-        }
+        strip_ext(name,MAX_PATH, cfg->xsb_name);
+        ret = snprintf(cfg->xwb_name,MAX_PATH,"%s.xwb", name);
+        CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
 
-        /* for Techland's XWB with no data */
-        CHECK_EXIT(xwb->base_offset == 0 || xwb->data_offset == 0, "ERROR: no start found (fake XWB?)");
+        xsb_file = reader_open(cfg->xsb_name, 1);
+        CHECK_EXIT(!xsb_file, "ERROR: failed opening .xsb");
+    }
 
-        /* Stardew Valley (Switch/Vita) hijacks (needs weird size to detect) */
-        if (xwb->version == XACT3_0_MAX
-                && (xwb->data_size == 0x55951c1c || xwb->data_size == 0x4e0a1000)) {
-            xwb->is_stardew_valley = 1;
-        }
+    CHECK_EXIT(!parse_bank(bank, xwb_file, xsb_file, NULL, error), "%s", error);
+}
+
+/**
+ * Reads the rest of a .xwb from stdin, so whatever writes into the pipe doesn't fail.
+ * Listing (-l) or -T never get to the wave data, and split streams may end before the input does.
+ */
+static void drain_input(reader * xwb_file) {
+    unsigned char buf[0x8000];
 
-        CHECK_EXIT((xwb->data_offset + xwb->data_size) > get_streamfile_size(streamFile) && !xwb->is_stardew_valley, "ERROR: filesize mismatch");
+    while (read_bytes(xwb_file->fd, buf, sizeof(buf)) > 0) {
+    }
+}
 
+/**
+ * Parses the opened files with libxwb, and keeps what it autodetected for this bank.
+ * With an already parsed .xsb (-X) there is no xsb_file, the bank's names come from it.
+ * Returns 0 on errors, with the message in error (MAX_ERROR); the files are in bank->ctx either way.
+ */
+static int parse_bank(xwb_bank * bank, reader * xwb_file, reader * xsb_file, const xwb_context * xsb, char * error) {
+    xwb_config * cfg = &bank->cfg;
+    xwb_options opts;
+    char index_name[MAX_PATH];
+    int ret;
 
-        //todo XACT2 < v40 may use extra1 as names offset
-        if (xwb->version <= XACT1_1_MAX) {
-            xwb->names_offset = xwb->extra1_offset;
-            xwb->names_size = xwb->extra1_size;
-        } else {
-            xwb->names_offset = xwb->extra2_offset;
-            xwb->names_size = xwb->extra2_size;
-        }
+    get_options(cfg, &opts);
+    opts.verbose = 1;
 
-        /* read base entry (WAVEBANKDATA) */
-        off = xwb->base_offset;
-        xwb->base_flags = (uint32_t)read_32bit(off+0x00, streamFile);
-        xwb->streams_count = read_32bit(off+0x04, streamFile);
-        /* 0x08 bank_name */
-        suboff = 0x08 + (xwb->version <= XACT1_1_MAX ? 0x10 : 0x40);
-        xwb->entry_elem_size = read_32bit(off+suboff+0x00, streamFile);
-        xwb->name_elem_size = read_32bit(off+suboff+0x04, streamFile);
-        xwb->entry_alignment = read_32bit(off+suboff+0x08, streamFile); /* usually 1 dvd sector */
-        //xwb->format = read_32bit(off+suboff+0x0c, streamFile); /* compact mode only */
-        /* suboff+0x10: build time 64b (XACT2/3) */
+    if (cfg->use_index && !cfg->streaming) {
+        ret = snprintf(index_name,MAX_PATH,"%s.idx", cfg->xwb_name);
+        CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+        opts.index_name = index_name;
     }
 
-    CHECK_EXIT(cfg->multi_only && xwb->streams_count == 1, "ERROR: only one stream found");
+    if (xsb)
+        ret = xwb_open_shared(&bank->ctx, xwb_file, xsb, &opts);
+    else
+        ret = xwb_open_readers(&bank->ctx, xwb_file, xsb_file, &opts);
+    CHECK_FAIL(error, ret != XWB_OK, "%s", xwb_error(&bank->ctx));
+    /* the library reads softly, but copying the streams exits on read errors like the rest of the CLI */
+    xwb_file->soft_errors = 0;
 
+    stats_add(cfg->stats, STATS_PARSE_XWB, 1, bank->ctx.times.xwb_wall, bank->ctx.times.xwb_cpu);
+    stats_add(cfg->stats, STATS_PARSE_XSB, 1, bank->ctx.times.xsb_wall, bank->ctx.times.xsb_cpu);
+    stats_add(cfg->stats, STATS_NAMES, 1, bank->ctx.times.names_wall, bank->ctx.times.names_cpu);
 
-    /* parse xwb streams */
-    xwb->xwb_streams = calloc(xwb->streams_count, sizeof(xsb_sound));
-    if (!xwb->xwb_streams) goto fail;
+    cfg->selected_wavebank = bank->ctx.opts.selected_wavebank;
+    cfg->ignore_xsb_name = bank->ctx.opts.ignore_xsb_name;
 
-    for (i = 0; i < xwb->streams_count; i++) {
-        xwb_stream *s = &(xwb->xwb_streams[i]);
+    resolve_output(cfg);
+    return 1;
+}
 
-        /* read stream entry (WAVEBANKENTRY) */
-        off = xwb->entry_offset + i * xwb->entry_elem_size;
+/**
+ * Library options from the flags.
+ */
+static void get_options(xwb_config * cfg, xwb_options * opts) {
+    memset(opts,0,sizeof(xwb_options));
+    opts->selected_wavebank = cfg->selected_wavebank;
+    opts->start_sound = cfg->start_sound;
+    opts->ignore_cue_totals = cfg->ignore_cue_totals;
+    opts->ignore_names_not_found = cfg->ignore_names_not_found;
+    opts->ignore_xsb_name = cfg->ignore_xsb_name;
+    opts->ignore_xsb_xwb_name = cfg->ignore_xsb_xwb_name;
+    opts->multi_only = cfg->multi_only;
+    opts->alt_extraction = cfg->alt_extraction;
+    opts->debug = cfg->debug;
+}
 
-        if (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) { /* compact entry */
-            uint32_t entry, size_deviation, sector_offset;
-            off_t next_stream_offset;
+static void close_bank(xwb_bank * bank) {
+    xwb_close(&bank->ctx);
+    free(bank->sums);
+    bank->sums = NULL;
+    free(bank->selected);
+    bank->selected = NULL;
+}
 
-            entry = (uint32_t)read_32bit(off+0x00, streamFile);
-            size_deviation = ((entry >> 21) & 0x7FF); /* 11b, padding data for sector alignment in bytes*/
-            sector_offset = (entry & 0x1FFFFF); /* 21b, offset within data in sectors */
 
-            s->stream_offset  = xwb->data_offset + sector_offset*xwb->entry_alignment;
+/**
+ * Lists the streams to write, all of them or those passing the filters (on the resolved names).
+ */
+static void select_streams(xwb_bank * bank) {
+    xwb_config * cfg = &bank->cfg;
+    xwb_header * xwb = &bank->ctx.xwb;
+    int stream;
 
-            /* find size using next offset */
-            if (i+1 < xwb->streams_count) {
-                uint32_t next_entry = (uint32_t)read_32bit(off+0x04, streamFile);
-                next_stream_offset = xwb->data_offset + (next_entry & 0x1FFFFF)*xwb->entry_alignment;
-            }
-            else { /* for last entry (or first, when subsongs = 1) */
-                next_stream_offset = xwb->data_offset + xwb->data_size;
-            }
-            s->stream_size = next_stream_offset - s->stream_offset - size_deviation;
-        }
-        else if (xwb->version <= XACT1_0_MAX) {
-            s->stream_offset   = xwb->data_offset + (uint32_t)read_32bit(off+0x04, streamFile);
-            s->stream_size     = (uint32_t)read_32bit(off+0x08, streamFile);
-        }
-        else {
-            s->stream_offset   = xwb->data_offset + (uint32_t)read_32bit(off+0x08, streamFile);
-            s->stream_size     = (uint32_t)read_32bit(off+0x0c, streamFile);
-        }
+    bank->selected = malloc(xwb->streams_count * sizeof(int) + 1);
+    CHECK_EXIT(!bank->selected, "ERROR: out of memory");
+
+    bank->selected_count = 0;
+    for (stream = 0; stream < xwb->streams_count; stream++) {
+        xwb_stream * s = &(xwb->xwb_streams[stream]);
+        if (cfg->filter && !filter_match(cfg->filter, stream, s->name, s->stream_size))
+            continue;
+        bank->selected[bank->selected_count++] = stream;
     }
 
-    if (cfg->debug) {
-        for (i = 0; i < xwb->streams_count; i++) {
-            xwb_stream *s = &(xwb->xwb_streams[i]);;
-            printf("XWB s%04i: off=%08lx, size=%08x\n", i, s->stream_offset, s->stream_size);
-        }
+    if (cfg->filter)
+        printf("Selected %i of %i streams\n", bank->selected_count, (int)xwb->streams_count);
+}
+
+/**
+ * Gets the bank ready for the selected output, once names are resolved.
+ * Returns 0 on errors, with the message in error (MAX_ERROR).
+ */
+static int prepare_output(xwb_bank * bank, char * error) {
+    xwb_config * cfg = &bank->cfg;
+    stats_timer timer;
+
+    select_streams(bank);
+
+    if (cfg->list_only)
+        return 1;
+    stats_start(cfg->stats, &timer);
+
+    /* headers are made from several threads later */
+    if (cfg->output == OUTPUT_SPLIT || cfg->output == OUTPUT_ARCHIVE)
+        CHECK_FAIL(error, xwb_build_headers(&bank->ctx) != XWB_OK, "%s", xwb_error(&bank->ctx));
+    if (cfg->output == OUTPUT_SPLIT || cfg->output == OUTPUT_TXTP || cfg->output == OUTPUT_RIFF)
+        make_directory(cfg->out_path);
+
+    /* filled by whichever writer copies each stream */
+    if (cfg->checksums && cfg->output == OUTPUT_SPLIT) {
+        bank->sums = calloc(bank->ctx.xwb.streams_count, sizeof(checksum_state));
+        CHECK_EXIT(!bank->sums, "ERROR: out of memory");
     }
 
+    stats_stop(cfg->stats, STATS_PREPARE, 1, &timer);
+    return 1;
+}
 
-    printf("XWB has %i streams\n", xwb->streams_count);
+/**
+ * Writes a .txtp that plays the stream straight from the bank (one folder up), so no data is copied.
+ */
+static int write_txtp(xwb_config * cfg, int num_stream, const char * name, xwb_worker * worker) {
+    char text[MAX_PATH];
+    int outfd, ret;
+
+    /* vgmstream subsongs are 1-based, and .txtp paths always use '/' */
+    ret = snprintf(text,MAX_PATH,"../%s#%i\n", strip_path(cfg->xwb_name), num_stream + 1);
+    CHECK_FAIL(worker->error, ret >= MAX_PATH, "ERROR: buffer overflow");
+
+    /* tiny, so always compared */
+    if (cfg->resume && file_matches(name, (const unsigned char *)text, ret, NULL, 0, 0, 1, worker->buf, worker->buf_size)) {
+        worker->skipped = 1;
+        return 1;
+    }
+
+    outfd = create_file(name, cfg->overwrite);
+    CHECK_FAIL(worker->error, outfd < 0 && errno == EEXIST, "ERROR: filename exists in path");
+    CHECK_FAIL(worker->error, outfd < 0, "ERROR: output open failed");
 
-    return;
+    write_bytes(outfd, (const unsigned char *)text, ret);
 
-fail:
-    CHECK_EXIT(1, "error parsing XWB");
+    close_file(outfd);
+    return 1;
 }
 
+/**
+ * Writes the bank's manifest next to it, one line per stream, instead of any stream files.
+ */
+static void write_manifest(xwb_bank * bank) {
+    xwb_config * cfg = &bank->cfg;
+    xwb_header * xwb = &bank->ctx.xwb;
+    char path[MAX_PATH];
+    char manifest_name[MAX_PATH];
+    char name[MAX_PATH];
+    char error[MAX_ERROR];
+    char * text;
+    size_t text_size, text_max = DUMP_BUF;
+    int outfd, i, ret;
+    stats_timer timer;
 
-static void parse_xsb(xwb_header * xwb, xwb_config * cfg) {
-    FILE * streamFile = cfg->xsb_file;
-    off_t off, suboff;
-    int i,j;
-    int xsb_version, xsb_little_endian;
-    uint32_t (*read_32bit)(long,FILE*) = NULL;
-    uint16_t (*read_16bit)(long,FILE*) = NULL;
+    stats_start(cfg->stats, &timer);
+    strip_filename(path, MAX_PATH, cfg->xwb_name);
+    ret = snprintf(manifest_name,MAX_PATH,"%s%s_manifest.tsv", path, cfg->out_base);
+    CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
 
+    outfd = create_file(manifest_name, cfg->overwrite);
+    CHECK_EXIT(outfd < 0 && errno == EEXIST, "ERROR: manifest exists in path");
+    CHECK_EXIT(outfd < 0, "ERROR: manifest open failed");
 
-    if (cfg->ignore_xsb_name || cfg->ignore_xsb_xwb_name)
-        return;
+    text = malloc(text_max);
+    CHECK_EXIT(!text, "ERROR: out of memory");
 
-    if ((read_32bitBE(0x00,streamFile) != 0x5344424B) &&    /* "SDBK" (LE) */
-        (read_32bitBE(0x00,streamFile) != 0x4B424453))      /* "KBDS" (BE) */
-        goto fail;
-
-
-    xsb_little_endian = read_32bitBE(0x00,streamFile) == 0x5344424B;/* SDBK */
-    if (xsb_little_endian) {
-        read_32bit = read_32bitLE;
-        read_16bit = read_16bitLE;
-    } else {
-        read_32bit = read_32bitBE;
-        read_16bit = read_16bitBE;
-    }
-
-
-    /* read main header (SoundBankHeader) */
-    xsb_version = read_16bit(0x04, streamFile);
-
-    /* check XSB versions */
-    CHECK_EXIT( (xwb->version <= XACT1_1_MAX && xsb_version > XSB_XACT1_MAX) || (xwb->version <= XACT2_2_MAX && xsb_version > XSB_XACT2_MAX)
-            , "ERROR: xsb and xwb are from different XACT versions (xsb v%i vs xwb v%i)", xsb_version, xwb->version);
-
-    off = 0;
-    if (xsb_version <= XSB_XACT1_MAX) {
-        xwb->xsb_wavebanks_count = 1; //read_8bit(0x22, streamFile);
-        xwb->xsb_sounds_count = read_16bit(0x1e, streamFile);//@ 0x1a? 0x1c?
-        //xwb->xsb_names_size   = 0;
-        //xwb->xsb_names_offset = 0;
-        xwb->xsb_nameoffsets_offset = 0;
-        xwb->xsb_sounds_offset = 0x38;
-    } else if (xsb_version <= XSB_XACT2_MAX) {
-        xwb->xsb_simple_sounds_count = read_16bit(0x09, streamFile);
-        xwb->xsb_complex_sounds_count = read_16bit(0x0B, streamFile);
-        xwb->xsb_wavebanks_count = read_8bit(0x11, streamFile);
-        xwb->xsb_sounds_count = read_16bit(0x12, streamFile);
-        //0x14: 16b unk
-        //xwb->xsb_names_size   = read_32bit(0x16, streamFile);
-        xwb->xsb_simple_sounds_offset = read_32bit(0x1a, streamFile);
-        xwb->xsb_complex_sounds_offset = read_32bit(0x1e, streamFile); //todo 0x1e?
-        //xwb->xsb_names_offset = read_32bit(0x22, streamFile);
-        xwb->xsb_nameoffsets_offset = read_32bit(0x3a, streamFile);
-        xwb->xsb_sounds_offset = read_32bit(0x3e, streamFile);
-    } else {
-        xwb->xsb_simple_sounds_count = read_16bit(0x13, streamFile);
-        xwb->xsb_complex_sounds_count = read_16bit(0x15, streamFile);
-        xwb->xsb_wavebanks_count = read_8bit(0x1b, streamFile);
-        xwb->xsb_sounds_count = read_16bit(0x1c, streamFile);
-        //xwb->xsb_names_size   = read_32bit(0x1e, streamFile);
-        xwb->xsb_simple_sounds_offset = read_32bit(0x22, streamFile);
-        xwb->xsb_complex_sounds_offset = read_32bit(0x26, streamFile);
-        //xwb->xsb_names_offset = read_32bit(0x2a, streamFile);
-        xwb->xsb_nameoffsets_offset = read_32bit(0x42, streamFile);
-        xwb->xsb_sounds_offset = read_32bit(0x46, streamFile);
-    }
-
-
-    CHECK_EXIT(!cfg->ignore_names_not_found && xwb->xsb_sounds_count < xwb->streams_count, "ERROR: number of streams in xsb lower than xwb (xsb %i vs xwb %i), use -n to ignore", xwb->xsb_sounds_count, xwb->streams_count);
-
-    CHECK_EXIT(!cfg->ignore_cue_totals && xwb->xsb_simple_sounds_count + xwb->xsb_complex_sounds_count != xwb->xsb_sounds_count, "ERROR: number of xsb sounds doesn't match simple + complex sounds (simple %i, complex %i, total %i), use -c to ignore", xwb->xsb_simple_sounds_count, xwb->xsb_complex_sounds_count, xwb->xsb_sounds_count);
-
-    /* init stuff */
-    xwb->xsb_sounds = calloc(xwb->xsb_sounds_count, sizeof(xsb_sound));
-    if (!xwb->xsb_sounds) goto fail;
-
-    xwb->xsb_wavebanks = calloc(xwb->xsb_wavebanks_count, sizeof(xsb_wavebank));
-    if (!xwb->xsb_wavebanks) goto fail;
-
-    /* The following is a bizarre soup of flags, tables, offsets to offsets and stuff, just to get the actual name.
-     * info: https://wiki.multimedia.cx/index.php/XACT */
-
-    /* parse xsb sounds */
-    off = xwb->xsb_sounds_offset;
-    for (i = 0; i < xwb->xsb_sounds_count; i++) {
-        xsb_sound *s = &(xwb->xsb_sounds[i]);
-        uint32_t flag;
-        size_t size;
-
-        if (xsb_version <= XSB_XACT1_MAX) {
-            /* The format seems constant */
-            flag = read_8bit(off+0x00, streamFile);
-            size = 0x14;
-
-            CHECK_EXIT(flag != 0x01, "ERROR: xsb flag 0x%x at offset 0x%08lx not implemented", flag, off);
-
-            s->wavebank     = 0; //read_8bit(off+suboff + 0x02, streamFile);
-            s->stream_index = read_16bit(off+0x02, streamFile);
-            s->sound_offset = off;
-            s->name_offset  = read_16bit(off+0x04, streamFile);
-        }
-        else {
-            /* Each XSB sound has a variable size and somewhere inside is the stream/wavebank index.
-             * Various flags control the sound layout, but I can't make sense of them so quick hack instead */
-            flag = read_8bit(off+0x00, streamFile);
-            //0x01 16b unk, 0x03: 8b unk 04: 16b unk, 06: 8b unk
-            size = read_16bit(off+0x07, streamFile);
-
-            if (!(flag & 0x01)) { /* simple sound */
-                suboff = 0x09;
-            } else { /* complex sound */
-                /* not very exact but seems to work */
-                if (flag==0x01 || flag==0x03 || flag==0x05 || flag==0x07) {
-                    if (size == 0x49) { //grotesque hack for Eschatos (these flags are way too complex)
-                        suboff = 0x23;
-                    } else if (size % 2 == 1 && read_16bit(off+size-0x2, streamFile)!=0) {
-                        suboff = size - 0x08 - 0x07; //7 unk bytes at the end
-                    } else {
-                        suboff = size - 0x08;
-                    }
-                } else {
-                    CHECK_EXIT(1, "ERROR: xsb flag 0x%x at offset 0x%08lx not implemented", flag, off);
-                }
-            }
+    ret = snprintf(text,text_max,"# %s\nsubsong\toffset\tsize\tname\n", strip_path(cfg->xwb_name));
+    CHECK_EXIT(ret >= text_max, "ERROR: buffer overflow");
+    text_size = ret;
+
+    for (i = 0; i < bank->selected_count; i++) {
+        int stream = bank->selected[i];
+        xwb_stream *s = &(xwb->xwb_streams[stream]);
 
-            s->stream_index = read_16bit(off+suboff + 0x00, streamFile);
-            s->wavebank     =  read_8bit(off+suboff + 0x02, streamFile);
-            s->sound_offset = off;
+        stats_stop(cfg->stats, STATS_WRITE, 0, &timer);
+        CHECK_EXIT(!get_output_name(name, MAX_PATH, bank, stream, error), "%s", error);
+        stats_stop(cfg->stats, STATS_OUTPUT_NAME, 1, &timer);
+        printf("Stream %03i: %s\n", stream, name);
+
+        /* flush when a line might not fit */
+        if (text_max - text_size < MAX_PATH + 64) {
+            write_bytes(outfd, (const unsigned char *)text, text_size);
+            text_size = 0;
         }
 
-        CHECK_EXIT(s->wavebank+1 > xwb->xsb_wavebanks_count, "ERROR: unknown xsb wavebank id %i at offset 0x%lx", s->wavebank, off);
-
-        xwb->xsb_wavebanks[s->wavebank].sound_count += 1;
-        off += size;
-    }
-
-
-    /* parse name offsets */
-    if (xsb_version > XSB_XACT1_MAX) {
-#if 1
-        /* "cue" name order: first simple sounds, then complex sounds
-         * Both aren't ordered like the sound entries, instead use a global offset to the entry
-         *
-         * ex. of a possible XSB:
-         *   name 1 = simple  sound 1 > sound entry 2 (points to xwb stream 4): stream 4 uses name 1
-         *   name 2 = simple  sound 2 > sound entry 1 (points to xwb stream 1): stream 1 uses name 2
-         *   name 3 = complex sound 1 > sound entry 3 (points to xwb stream 3): stream 3 uses name 3
-         *   name 4 = complex sound 2 > sound entry 4 (points to xwb stream 2): stream 2 uses name 4
-         *
-         * Multiple cues can point to the same sound entry but we only use the first name (meaning some won't be used) */
-        off_t n_off = xwb->xsb_nameoffsets_offset;
-
-        off = xwb->xsb_simple_sounds_offset;
-        for (i = 0; i < xwb->xsb_simple_sounds_count; i++) {
-            off_t sound_offset = read_32bit(off + 0x01, streamFile);
-            if (cfg->debug) printf("XSB simple %i: off=%04lx, s.off=%04lx, n.off=%04lx\n", i, off, sound_offset, n_off);
-            off += 0x05;
-
-            /* find sound by offset */
-            for (j = 0; j < xwb->xsb_sounds_count; j++) {
-                xsb_sound *s = &(xwb->xsb_sounds[j]);;
-                /* update with the current name offset */
-                if (!s->name_offset && sound_offset == s->sound_offset) {
-                    s->name_offset = read_32bit(n_off + 0x00, streamFile);
-                    s->unk_index  = read_16bit(n_off + 0x04, streamFile);
-                    n_off += 0x06;
-                    break;
-                }
-            }
+        ret = snprintf(text + text_size, text_max - text_size, "%i\t0x%08"PRIx64"\t%"PRIu64"\t%s\n",
+                stream + 1, (uint64_t)s->stream_offset, (uint64_t)s->stream_size, strip_path(name));
+        CHECK_EXIT(ret >= text_max - text_size, "ERROR: buffer overflow");
+        text_size += ret;
+    }
+
+    write_bytes(outfd, (const unsigned char *)text, text_size);
+    close_file(outfd);
+    free(text);
+    stats_stop(cfg->stats, STATS_WRITE, 1, &timer);
+
+    printf("Manifest: %s\n", manifest_name);
+}
+
+/**
+ * Writes the bank's checksum file next to its split streams, once all are written.
+ */
+static void write_checksums(xwb_bank * bank) {
+    xwb_config * cfg = &bank->cfg;
+    char sums_name[MAX_PATH];
+    char name[MAX_PATH];
+    char error[MAX_ERROR];
+    char * text;
+    size_t text_size, text_max = DUMP_BUF;
+    int outfd, i, ret;
+
+    if (!bank->sums)
+        return;
+
+    ret = snprintf(sums_name,MAX_PATH,"%s%s_checksums.tsv", cfg->out_path, cfg->out_base);
+    CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+
+    /* rewritten every run, as it describes the current outputs */
+    outfd = create_file(sums_name, 1);
+    CHECK_EXIT(outfd < 0, "ERROR: checksums open failed");
+
+    text = malloc(text_max);
+    CHECK_EXIT(!text, "ERROR: out of memory");
+
+    ret = snprintf(text,text_max,"# %s\nname\tsize%s%s\n", strip_path(cfg->xwb_name),
+            cfg->checksums & CHECKSUM_CRC32C ? "\tcrc32c" : "", cfg->checksums & CHECKSUM_XXH64 ? "\txxh64" : "");
+    CHECK_EXIT(ret >= text_max, "ERROR: buffer overflow");
+    text_size = ret;
+
+    for (i = 0; i < bank->selected_count; i++) {
+        int stream = bank->selected[i];
+        checksum_state * sums = &bank->sums[stream];
+
+        CHECK_EXIT(!get_output_name(name, MAX_PATH, bank, stream, error), "%s", error);
+
+        /* flush when a line might not fit */
+        if (text_max - text_size < MAX_PATH + 64) {
+            write_bytes(outfd, (const unsigned char *)text, text_size);
+            text_size = 0;
         }
 
-        off = xwb->xsb_complex_sounds_offset;
-        for (i = 0; i < xwb->xsb_complex_sounds_count; i++) {
-            off_t sound_offset = read_32bit(off + 0x01, streamFile);
-            if (cfg->debug) printf("XSB complex %i: off=%04lx, s.off=%04lx, n.off=%04lx\n", i, off, sound_offset, n_off);
-            off += 0x0f;
-
-            /* find sound by offset */
-            for (j = 0; j < xwb->xsb_sounds_count; j++) {
-                xsb_sound *s = &(xwb->xsb_sounds[j]);;
-                /* update with the current name offset */
-                if (!s->name_offset && sound_offset == s->sound_offset) {
-                    s->name_offset = read_32bit(n_off + 0x00, streamFile);
-                    s->unk_index  = read_16bit(n_off + 0x04, streamFile);
-                    n_off += 0x06;
-                    break;
-                }
-            }
+        ret = snprintf(text + text_size, text_max - text_size, "%s\t%"PRIu64, strip_path(name), sums->size);
+        CHECK_EXIT(ret >= text_max - text_size, "ERROR: buffer overflow");
+        text_size += ret;
+        if (cfg->checksums & CHECKSUM_CRC32C) {
+            text_size += snprintf(text + text_size, text_max - text_size, "\t%08"PRIx32, sums->crc32c);
         }
-#endif
-#if 0
-        off = xwb->xsb_nameoffsets_offset;
-        /* lineal name order, disregarding wavebanks */
-        for (i = 0; i < xwb->xsb_sounds_count; i++) {
-            xsb_sound *s = &(xwb->xsb_sounds[i]);;
-
-            s->name_offset = read_32bit(off + 0x00, streamFile);
-            s->unk_index  = read_16bit(off + 0x04, streamFile);
-            off += 0x04 + 0x02;
+        if (cfg->checksums & CHECKSUM_XXH64) {
+            text_size += snprintf(text + text_size, text_max - text_size, "\t%016"PRIx64, xxh64_digest(&sums->xxh64));
         }
-#endif
-#if 0
-        off = xwb->xsb_nameoffsets_offset;
-        /* wavebank name order: first all names from bank 0, then 1, etc
-         * rarely a XSB may bank sound0-bank0, sound1-bank1, sound2-bank0 etc */
-        for (i = 0; i < xwb->xsb_wavebanks_count; i++) { //wavebanks
-            int sound = 0;
-            for (int j = 0; j < xwb->xsb_wavebanks[i].sound_count; j++) { //sounds in wavebank
-                for (int k = sound; k < xwb->xsb_sounds_count; k++) {//find wavebank sound in global sound list
-                    xsb_sound *s = &(xwb->xsb_sounds[k]);
-                    if (s->wavebank==i) {
-                        s->name_offset = read_32bit(off + 0x00, streamFile);
-
-                        off += 0x04 + 0x02;
-                        sound = k+1;
-                        break;
-                    }
-                }
-            }
-        }
-#endif
+        text[text_size++] = '\n';
     }
 
-    if (cfg->debug) {
-        for (i = 0; i < xwb->xsb_sounds_count; i++) {
-            xsb_sound *s = &(xwb->xsb_sounds[i]);;
-            printf("XSB w%i s%04i: stream %04i u.idx %04lx, s.off=%08lx, n.off=%08lx\n", s->wavebank, i, s->stream_index, s->unk_index, s->sound_offset, s->name_offset);
+    write_bytes(outfd, (const unsigned char *)text, text_size);
+    close_file(outfd);
+    free(text);
+
+    printf("Checksums: %s\n", sums_name);
+}
+
+/**
+ * Checksums an output (header + stream data) from the bank, for outputs that aren't copied.
+ */
+static void sum_output(checksum_state * sums, const unsigned char * header, size_t header_size, reader * infile, off_t offset, size_t size, unsigned char * buf, size_t buf_size) {
+    checksum_update(sums, header, header_size);
+    if (infile->map) {
+        checksum_update(sums, infile->map + offset, size);
+    }
+    else {
+        while (size > 0) {
+            size_t bytes = size > buf_size ? buf_size : size;
+            get_bytes_at(offset, infile, buf, bytes);
+            checksum_update(sums, buf, bytes);
+            offset += bytes;
+            size -= bytes;
         }
     }
+}
 
+/**
+ * Gets the stream's checksums ready, returns NULL if not wanted.
+ */
+static checksum_state * init_sums(xwb_bank * bank, int num_stream) {
+    if (!bank->sums)
+        return NULL;
+    checksum_init(&bank->sums[num_stream], bank->cfg.checksums);
+    return &bank->sums[num_stream];
+}
 
-    // todo: it's possible to find the wavebank using the name
-    /* try to find correct wavebank, in cases of multiple */
-    if (!cfg->selected_wavebank) {
-        for (i = 0; i < xwb->xsb_wavebanks_count; i++) {
-            xsb_wavebank *w = &(xwb->xsb_wavebanks[i]);
-            printf("XSB wavebank %i has %i sounds\n", i, w->sound_count);
+/**
+ * Links the stream's output to an identical earlier one instead of writing it, filling sums (if any) on the way.
+ * Returns 0 if there is none yet (or linking failed), and the caller writes it.
+ */
+static int link_duplicate(xwb_bank * bank, int num_stream, xwb_worker * worker, checksum_state * sums) {
+    xwb_config * cfg = &bank->cfg;
+    xwb_header * xwb = &bank->ctx.xwb;
+    xwb_stream * s = &(xwb->xwb_streams[num_stream]);
+    reader * infile = bank->ctx.xwb_file;
+    uint64_t hash, size = xwb->header_size + s->stream_size;
+    char found[MAX_PATH];
+    checksum_state fingerprint;
+
+    if (!sums)
+        sums = &fingerprint;
+    checksum_init(sums, cfg->checksums | CHECKSUM_XXH64);
+    sum_output(sums, worker->header, xwb->header_size, infile, s->stream_offset, s->stream_size, worker->buf, worker->buf_size);
+    hash = xxh64_digest(&sums->xxh64);
+    if (!dedup_find(cfg->dedup_store, hash, size, worker->name, found, MAX_PATH))
+        return 0;
+
+    /* rerun over the same output, it already has this content */
+    if (strcmp(found, worker->name) == 0 && file_matches(found, worker->header, xwb->header_size, infile, s->stream_offset, s->stream_size, 1, worker->buf, worker->buf_size))
+        return 1;
 
-            //CHECK_EXIT(w->sound_count == 0, "ERROR: xsb wavebank %i has no sounds", i); //Ikaruga PC
+    /* a hash match is only likely the same, compare all before sharing */
+    if (strcmp(found, worker->name) == 0
+            || !file_matches(found, worker->header, xwb->header_size, infile, s->stream_offset, s->stream_size, 1, worker->buf, worker->buf_size)
+            || link_file(found, worker->name, cfg->dedup == DEDUP_REFLINK, cfg->overwrite) != 0) {
+        dedup_replace(cfg->dedup_store, hash, size, worker->name);
+        return 0;
+    }
 
-            if (w->sound_count == xwb->streams_count) {
-                CHECK_EXIT(cfg->selected_wavebank, "ERROR: multiple xsb wavebanks with the same number of sounds, use -w to specify one of the wavebanks");
+    dedup_count(cfg->dedup_store, size);
+    return 1;
+}
 
-                cfg->selected_wavebank = i+1;
-            }
-        }
+/**
+ * Appends the stream's split .xwb to the archive, named as it would be in the bank's folder.
+ */
+static void write_archive_member(xwb_bank * bank, int num_stream, xwb_worker * worker) {
+    xwb_config * cfg = &bank->cfg;
+    xwb_header * xwb = &bank->ctx.xwb;
+    xwb_stream * s = &(xwb->xwb_streams[num_stream]);
+    uint64_t size = xwb->header_size + s->stream_size;
+    char member[MAX_PATH];
+    char * c;
+
+    /* (bank)/(stream), dropping the bank's dir; tar paths always use '/' */
+    strcpy(member, worker->name + strlen(cfg->out_path) - strlen(cfg->out_base) - 1);
+    for (c = member; *c != '\0'; c++) {
+        if (*c == DIRSEP)
+            *c = '/';
     }
 
-    /* banks with different number of sounds but only one wavebank, just select the first */
-    if (!cfg->selected_wavebank && xwb->xsb_wavebanks_count==1) {
-        cfg->selected_wavebank = 1;
+    tar_header(cfg->archive_fd, member, size, cfg->archive_mtime);
+    append_with_header(cfg->archive_fd, worker->header, xwb->header_size, bank->ctx.xwb_file, s->stream_offset, s->stream_size, worker->buf, worker->buf_size);
+    tar_pad(cfg->archive_fd, size);
+    cfg->archive_members++;
+}
+
+/**
+ * Writes the stream's output once named (or skips or links it).
+ * Returns 0 on errors, with the message in the worker.
+ */
+static int write_output(xwb_bank * bank, int num_stream, xwb_worker * worker) {
+    xwb_config * cfg = &bank->cfg;
+    xwb_header * xwb = &bank->ctx.xwb;
+    int outfd, swap16 = 0;
+    size_t header_size;
+    char * name = worker->name;
+    xwb_stream *s = &(xwb->xwb_streams[num_stream]);
+    checksum_state * sums;
+
+    if (cfg->output == OUTPUT_TXTP)
+        return write_txtp(cfg, num_stream, name, worker);
+
+    if (cfg->output == OUTPUT_RIFF) {
+        CHECK_FAIL(worker->error, xwb_make_riff(&bank->ctx, num_stream, &worker->header, &worker->header_size, &header_size) != XWB_OK, "%s", xwb_error(&bank->ctx));
+        swap16 = xwb_riff_swap16(&bank->ctx, num_stream);
+    }
+    else {
+        CHECK_FAIL(worker->error, xwb_make_header(&bank->ctx, num_stream, &worker->header, &worker->header_size) != XWB_OK, "%s", xwb_error(&bank->ctx));
+        header_size = xwb->header_size;
+    }
+
+    if (cfg->output == OUTPUT_ARCHIVE) {
+        write_archive_member(bank, num_stream, worker);
+        return 1;
+    }
+
+    sums = init_sums(bank, num_stream);
+
+    /* swapped outputs can't be compared with the bank's bytes, -R rewrites them */
+    if (cfg->resume && !(swap16 && cfg->resume == 2) && file_matches(name, worker->header, header_size, bank->ctx.xwb_file, s->stream_offset, s->stream_size,
+            cfg->resume == 2, worker->buf, worker->buf_size)) {
+        worker->skipped = 1;
+        if (sums)
+            sum_output(sums, worker->header, header_size, bank->ctx.xwb_file, s->stream_offset, s->stream_size, worker->buf, worker->buf_size);
+        return 1;
     }
 
-    printf("Selected XSB wavebank %i\n", cfg->selected_wavebank-1);
+    if (cfg->dedup && link_duplicate(bank, num_stream, worker, sums))
+        return 1;
+    if (sums)
+        checksum_init(sums, cfg->checksums);
 
-    CHECK_EXIT(!cfg->selected_wavebank, "ERROR: multiple xsb wavebanks but autodetect didn't work, use -w to specify one of the wavebanks");
-    CHECK_EXIT(xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count == 0, "ERROR: xsb selected wavebank %i has no sounds", i);
+    outfd = create_file(name, cfg->overwrite);
+    CHECK_FAIL(worker->error, outfd < 0 && errno == EEXIST, "ERROR: filename exists in path");
+    CHECK_FAIL(worker->error, outfd < 0, "ERROR: output open failed");
 
-    if (cfg->start_sound) {
-        CHECK_EXIT(xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count - (cfg->start_sound-1) < xwb->streams_count, "ERROR: starting sound too high (max in selected wavebank is %i)", xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count - xwb->streams_count + 1);
-    } else {
-        if (!cfg->ignore_names_not_found)
-            CHECK_EXIT(xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count > xwb->streams_count, "ERROR: number of streams in xsb wavebank bigger than xwb (xsb %i vs xwb %i), use -s to specify (1=first)", xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count, xwb->streams_count);
-        if (!cfg->ignore_names_not_found)
-            CHECK_EXIT(xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count < xwb->streams_count, "ERROR: number of streams in xsb wavebank lower than xwb (xsb %i vs xwb %i), use -n to ignore (some names won't be extracted)", xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count, xwb->streams_count);
+    /* split or RIFF header + stream main data */
+    if (swap16)
+        dump_swap16(outfd, worker->header, header_size, bank->ctx.xwb_file, s->stream_offset, s->stream_size, worker->buf, worker->buf_size);
+    else
+        dump_with_header(outfd, worker->header, header_size, bank->ctx.xwb_file, s->stream_offset, s->stream_size, worker->buf, worker->buf_size, sums);
+    /* RIFF pad byte after odd data (so -r rewrites those, their size never matches) */
+    if (cfg->output == OUTPUT_RIFF && (s->stream_size & 1))
+        write_bytes(outfd, (const unsigned char *)"", 1);
 
+    close_file(outfd);
+    return 1;
+}
 
-        //if (!cfg->ignore_names_not_found)
-        //    CHECK_EXIT(xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count != xwb->streams_count, "ERROR: number of streams in xsb wavebank different than xwb (xsb %i vs xwb %i), use -s to specify (1=first)", xwb->xsb_wavebanks[cfg->selected_wavebank-1].sound_count, xwb->streams_count);
+/**
+ * Names and writes (or lists) a stream. Returns 0 on errors, with the message in the worker.
+ */
+static int write_stream(xwb_bank * bank, int num_stream, xwb_worker * worker) {
+    xwb_config * cfg = &bank->cfg;
+    stats_timer timer, started;
+
+    stats_start(cfg->stats, &timer);
+    started = timer;
+
+    /* get name and open file */
+    if (!get_output_name(worker->name, MAX_PATH, bank, num_stream, worker->error))
+        return 0;
+    worker->skipped = 0;
+    stats_stop(cfg->stats, STATS_OUTPUT_NAME, 1, &timer);
+
+    if (!worker->defer_print)
+        printf("Stream %03i: %s\n", num_stream, worker->name);
+    if (cfg->list_only)
+        return 1;
+
+    if (!write_output(bank, num_stream, worker))
+        return 0;
+
+    if (cfg->stats) {
+        stats_stop(cfg->stats, STATS_WRITE, 1, &timer);
+        stats_stream(cfg->stats, timer.wall - started.wall);
     }
+    return 1;
+}
 
-    return;
-fail:
-    CHECK_EXIT(1, "ERROR: generic error parsing XSB");
+/**
+ * Keeps the first job error for the main thread, which exits with it once all threads are done.
+ */
+static void fail_job(xwb_jobs * jobs, const char * error) {
+    pthread_mutex_lock(&jobs->lines_lock);
+    if (!jobs->failed) {
+        jobs->failed = 1;
+        strcpy(jobs->error, error);
+    }
+    pthread_mutex_unlock(&jobs->lines_lock);
 }
 
-static void write_stream(xwb_header * xwb, xwb_config * cfg, int num_stream) {
-    FILE * outfile = NULL;
-    char path[MAX_PATH];
-    char name[MAX_PATH];
-    int ret;
-    off_t off;
+static int job_failed(xwb_jobs * jobs) {
+    int failed;
 
-    void (*put_32bit_s)(uint32_t, long, FILE *) = NULL;
+    pthread_mutex_lock(&jobs->lines_lock);
+    failed = jobs->failed;
+    pthread_mutex_unlock(&jobs->lines_lock);
+    return failed;
+}
 
-    if (xwb->little_endian) {
-        put_32bit_s = put_32_le_seek;
-    } else {
-        put_32bit_s = put_32_be_seek;
+/**
+ * Prints all finished streams up to the first pending one, so the output looks like a serial run.
+ */
+static void print_stream_lines(xwb_jobs * jobs, int job, const char * name, int skipped) {
+    char * line = malloc(strlen(name) + 1);
+    if (!line) {
+        fail_job(jobs, "ERROR: out of memory");
+        return;
+    }
+    strcpy(line, name);
+
+    pthread_mutex_lock(&jobs->lines_lock);
+    jobs->lines[job] = line;
+    jobs->skipped += skipped;
+    while (jobs->next_line < jobs->jobs_count && jobs->lines[jobs->next_line]) {
+        printf("Stream %03i: %s\n", jobs->job_stream[jobs->next_line], jobs->lines[jobs->next_line]);
+        free(jobs->lines[jobs->next_line]);
+        jobs->next_line++;
     }
+    pthread_mutex_unlock(&jobs->lines_lock);
+}
 
-    /* get name and open file */
-    get_output_name(path, name, MAX_PATH, xwb,cfg, num_stream);
+static void write_stream_job(void * ctx, int job, int worker) {
+    xwb_jobs * jobs = ctx;
+    xwb_worker * w = &(jobs->workers[worker]);
+    xwb_bank * bank = &(jobs->banks[jobs->job_bank[job]]);
 
-    printf("Stream %03i: %s\n", num_stream, name);
-    if (cfg->list_only)
+    /* a serial run would have stopped at the failed stream, so don't start new ones */
+    if (job_failed(jobs))
         return;
 
-    make_directory(path);
+    if (!write_stream(bank, jobs->job_stream[job], w)) {
+        fail_job(jobs, w->error);
+        return;
+    }
+
+    print_stream_lines(jobs, job, w->name, w->skipped);
+}
 
-    if (!cfg->overwrite) {
-        outfile = fopen(name, "rb");
-        CHECK_EXIT(outfile, "ERROR: filename exists in path");
+typedef struct {
+    size_t size;
+    int job;
+} xwb_job_size;
+
+static int compare_job_size(const void * a, const void * b) {
+    const xwb_job_size * ja = a;
+    const xwb_job_size * jb = b;
+
+    /* biggest first, otherwise keep job order */
+    if (ja->size != jb->size)
+        return ja->size > jb->size ? -1 : 1;
+    return ja->job - jb->job;
+}
+
+/**
+ * Lists all streams of all banks as jobs, with a worker (copy buffer and header) for each thread or io_uring slot.
+ */
+static void init_jobs(xwb_jobs * jobs, xwb_bank * banks, int banks_count, int workers_count) {
+    int i, j, job;
+
+    memset(jobs,0,sizeof(xwb_jobs));
+    jobs->banks = banks;
+    for (i = 0; i < banks_count; i++) {
+        jobs->jobs_count += banks[i].selected_count;
     }
 
-    outfile = fopen(name, "wb");
-    CHECK_EXIT(!outfile, "ERROR: output open failed");
+    jobs->job_bank = malloc(jobs->jobs_count * sizeof(int));
+    jobs->job_stream = malloc(jobs->jobs_count * sizeof(int));
+    jobs->workers = calloc(workers_count, sizeof(xwb_worker));
+    jobs->workers_count = workers_count;
+    jobs->lines = calloc(jobs->jobs_count, sizeof(char *));
+    CHECK_EXIT(!jobs->job_bank || !jobs->job_stream || !jobs->workers || !jobs->lines, "ERROR: out of memory");
+    CHECK_EXIT(pthread_mutex_init(&jobs->lines_lock, NULL) != 0, "ERROR: mutex init failed");
+
+    for (i = 0; i < workers_count; i++) {
+        jobs->workers[i].buf_size = DUMP_BUF;
+        jobs->workers[i].buf = malloc(jobs->workers[i].buf_size);
+        jobs->workers[i].defer_print = 1;
+        CHECK_EXIT(!jobs->workers[i].buf, "ERROR: out of memory");
+    }
 
-    if (xwb->version <= XACT1_0_MAX) {
-        /* creates a new header, as XACT v1 is very simple */
-        xwb_stream *s = &(xwb->xwb_streams[num_stream]);
+    job = 0;
+    for (i = 0; i < banks_count; i++) {
+        for (j = 0; j < banks[i].selected_count; j++) {
+            jobs->job_bank[job] = i;
+            jobs->job_stream[job] = banks[i].selected[j];
+            job++;
+        }
+    }
+}
 
-        /* copy main header */
-        dump(cfg->xwb_file, outfile, 0x00, xwb->entry_offset);
+static void print_skipped(int skipped) {
+    if (skipped)
+        printf("Resume: %i streams were already written\n", skipped);
+}
 
-        /* ENTRY segment (now single entry) */
-        dump(cfg->xwb_file, outfile, xwb->entry_offset + num_stream*xwb->entry_elem_size, xwb->entry_elem_size);
+static void free_jobs(xwb_jobs * jobs) {
+    int i;
 
-        /* copy stream main data */
-        dump(cfg->xwb_file, outfile, s->stream_offset, s->stream_size);
+    for (i = 0; i < jobs->workers_count; i++) {
+        free(jobs->workers[i].buf);
+        free(jobs->workers[i].header);
+    }
+    pthread_mutex_destroy(&jobs->lines_lock);
+    free(jobs->job_bank);
+    free(jobs->job_stream);
+    free(jobs->workers);
+    free(jobs->lines);
+}
 
+/**
+ * Writes all streams of all banks on a thread pool, biggest streams first so the last ones to finish are small.
+ */
+static void write_streams_parallel(xwb_bank * banks, int banks_count, int threads) {
+    xwb_jobs jobs;
+    xwb_job_size * by_size;
+    int * order;
+    int i;
 
-        /* at the end to avoid FILE pos jumping around */
+    init_jobs(&jobs, banks, banks_count, threads);
 
-        put_32bit_s(1, 0x0c, outfile); /* 1 stream */
+    by_size = malloc(jobs.jobs_count * sizeof(xwb_job_size));
+    order = malloc(jobs.jobs_count * sizeof(int));
+    CHECK_EXIT(!by_size || !order, "ERROR: out of memory");
+
+    for (i = 0; i < jobs.jobs_count; i++) {
+        xwb_bank * bank = &banks[jobs.job_bank[i]];
+        by_size[i].size = bank->ctx.xwb.xwb_streams[jobs.job_stream[i]].stream_size;
+        by_size[i].job = i;
     }
-    else if (cfg->alt_extraction) {
-        /* older extraction: keeps the header intact, but results in bigger files */
-        xwb_stream *s = &(xwb->xwb_streams[num_stream]);
 
-        /* copy main header as-is, even though we only need one of the streams (to simplify) */
-        dump(cfg->xwb_file, outfile, 0, xwb->data_offset);
-        /* copy stream main data */
-        dump(cfg->xwb_file, outfile, s->stream_offset, s->stream_size);
-        /* change the few offsets needed to point to the stream */
-        off = 0x04 + (xwb->version <= XACT2_2_MAX ? 0x04 : 0x08) + 0x04+0x04; //segments offset
+    qsort(by_size, jobs.jobs_count, sizeof(xwb_job_size), compare_job_size);
+    for (i = 0; i < jobs.jobs_count; i++) {
+        order[i] = by_size[i].job;
+    }
 
-        /* ENTRY segment (now single entry) */
-        put_32bit_s(xwb->entry_offset + num_stream*xwb->entry_elem_size, off+0x00, outfile);
-        put_32bit_s(xwb->entry_elem_size, off+0x04, outfile);
+    pool_run(threads, order, jobs.jobs_count, write_stream_job, &jobs);
+    CHECK_EXIT(jobs.failed, "%s", jobs.error);
 
-        /* other segments */
-        if (xwb->version <= XACT1_1_MAX) {
-            if (xwb->extra1_offset && xwb->extra1_size) {//XACT1: ENTRYNAMES
-                put_32bit_s(xwb->extra1_offset + num_stream*xwb->name_elem_size, off+0x08, outfile);
-                put_32bit_s(xwb->name_elem_size, off+0x0c, outfile);
-            }
-            off += 0x10;
-        } else if (xwb->version <= XACT2_2_MAX) {//todo XACT2 < v40 may use extra1 as names offset
-            if (xwb->extra1_offset && xwb->extra1_size) {//XACT2: SEEKTABLES (v40)
-                //0x08, 0x0c: no idea
+    print_skipped(jobs.skipped);
+    free_jobs(&jobs);
+    free(by_size);
+    free(order);
+}
+
+static void uring_prepare_job(void * ctx, int job, int slot, uring_job * out) {
+    xwb_jobs * jobs = ctx;
+    xwb_worker * w = &(jobs->workers[slot]);
+    xwb_bank * bank = &(jobs->banks[jobs->job_bank[job]]);
+    int num_stream = jobs->job_stream[job];
+    xwb_stream *s = &(bank->ctx.xwb.xwb_streams[num_stream]);
+
+    stats_stop(bank->cfg.stats, STATS_WRITE, 0, &jobs->timer);
+    w->started = jobs->timer.wall;
+    CHECK_EXIT(!get_output_name(w->name, MAX_PATH, bank, num_stream, w->error), "%s", w->error);
+    stats_stop(bank->cfg.stats, STATS_OUTPUT_NAME, 1, &jobs->timer);
+    CHECK_EXIT(xwb_make_header(&bank->ctx, num_stream, &w->header, &w->header_size) != XWB_OK, "%s", xwb_error(&bank->ctx));
+
+    w->skipped = bank->cfg.resume && file_matches(w->name, w->header, bank->ctx.xwb.header_size, bank->ctx.xwb_file,
+            s->stream_offset, s->stream_size, bank->cfg.resume == 2, w->buf, w->buf_size);
+    out->sums = init_sums(bank, num_stream);
+    if (w->skipped && out->sums)
+        sum_output(out->sums, w->header, bank->ctx.xwb.header_size, bank->ctx.xwb_file, s->stream_offset, s->stream_size, w->buf, w->buf_size);
+
+    out->name = w->name;
+    out->header = w->header;
+    out->header_size = bank->ctx.xwb.header_size;
+    out->infile = bank->ctx.xwb_file;
+    out->offset = s->stream_offset;
+    out->size = s->stream_size;
+    out->buf = w->buf;
+    out->buf_size = w->buf_size;
+    out->skip = w->skipped || (bank->cfg.dedup && link_duplicate(bank, num_stream, w, out->sums));
+    if (!out->skip && out->sums)
+        checksum_init(out->sums, bank->cfg.checksums);
+}
+
+static void uring_done_job(void * ctx, int job, int slot, int err) {
+    xwb_jobs * jobs = ctx;
+    stats * st = jobs->banks[jobs->job_bank[job]].cfg.stats;
+
+    CHECK_EXIT(err == EEXIST, "ERROR: filename exists in path");
+    CHECK_EXIT(err != 0, "ERROR: output write failed (%s)", strerror(err));
+
+    /* in flight with others, so from being picked up to done rather than the time spent on it */
+    if (st) {
+        stats_stop(st, STATS_WRITE, 1, &jobs->timer);
+        stats_stream(st, jobs->timer.wall - jobs->workers[slot].started);
+    }
+
+    print_stream_lines(jobs, job, jobs->workers[slot].name, jobs->workers[slot].skipped);
+}
+
+/**
+ * Writes all streams of all banks from a single thread with io_uring, in stream order.
+ * Returns 0 if io_uring isn't usable.
+ */
+static int write_streams_uring(xwb_bank * banks, int banks_count, int depth) {
+    xwb_jobs jobs;
+    uring_stats stats;
+    int done;
+
+    init_jobs(&jobs, banks, banks_count, depth);
+
+    stats_start(banks[0].cfg.stats, &jobs.timer);
+    done = uring_run(depth, banks[0].cfg.overwrite, jobs.jobs_count, uring_prepare_job, uring_done_job, &jobs, &stats);
+    stats_stop(banks[0].cfg.stats, STATS_WRITE, 0, &jobs.timer);
+    CHECK_EXIT(jobs.failed, "%s", jobs.error);
+    if (done) {
+        double mb = stats.bytes / 1048576.0;
+        if (stats.depth < depth)
+            printf("io_uring: queue depth %i is over the kernel limit, used %i\n", depth, stats.depth);
+        printf("io_uring: %i streams, %.1f MB in %.2fs (%.1f MB/s)\n",
+                stats.files, mb, stats.seconds, stats.seconds > 0 ? mb / stats.seconds : 0.0);
+    }
+    else {
+        printf("io_uring: not available, using normal writes\n");
+    }
+
+    print_skipped(jobs.skipped);
+    free_jobs(&jobs);
+    return done;
+}
+
+typedef struct {
+    off_t offset;
+    int job; /* selected stream */
+} xwb_stream_start;
+
+static int compare_stream_start(const void * a, const void * b) {
+    const xwb_stream_start * sa = a;
+    const xwb_stream_start * sb = b;
+
+    if (sa->offset != sb->offset)
+        return sa->offset < sb->offset ? -1 : 1;
+    return sa->job - sb->job;
+}
+
+/**
+ * Writes all streams of a bank read front to back from a pipe, in a single pass with bounded memory.
+ * Each stream is opened once its data start is reached and gets its part of every chunk read after that,
+ * so overlapping streams (or ones pointing back into the header) are written without reading anything twice.
+ */
+static void write_streams_single_pass(xwb_bank * bank) {
+    xwb_header * xwb = &bank->ctx.xwb;
+    xwb_config * cfg = &bank->cfg;
+    reader * infile = bank->ctx.xwb_file;
+    xwb_jobs jobs;
+    xwb_worker * w;
+    xwb_stream_start * starts;
+    int * open_streams;
+    int * open_fds;
+    double * open_started;
+    int open_count = 0, next = 0, i;
+    stats_timer timer;
+    const unsigned char * chunk;
+    size_t chunk_size;
+    off_t pos = 0, chunk_end;
+
+    init_jobs(&jobs, bank, 1, 1);
+    w = &jobs.workers[0];
+
+    starts = malloc(jobs.jobs_count * sizeof(xwb_stream_start) + 1);
+    open_streams = malloc(jobs.jobs_count * sizeof(int) + 1);
+    open_fds = malloc(jobs.jobs_count * sizeof(int) + 1);
+    open_started = malloc(jobs.jobs_count * sizeof(double) + 1);
+    CHECK_EXIT(!starts || !open_streams || !open_fds || !open_started, "ERROR: out of memory");
+
+    for (i = 0; i < jobs.jobs_count; i++) {
+        starts[i].offset = xwb->xwb_streams[jobs.job_stream[i]].stream_offset;
+        starts[i].job = i;
+    }
+    qsort(starts, jobs.jobs_count, sizeof(xwb_stream_start), compare_stream_start);
+
+    stats_start(cfg->stats, &timer);
+
+    /* first chunk is the header part already in memory */
+    chunk = infile->map;
+    chunk_size = reader_size(infile);
+    while (1) {
+        chunk_end = pos + chunk_size;
+
+        while (next < jobs.jobs_count && starts[next].offset <= chunk_end) {
+            int job = starts[next++].job;
+            int stream = jobs.job_stream[job];
+            int outfd;
+
+            stats_stop(cfg->stats, STATS_WRITE, 0, &timer);
+            CHECK_EXIT(!get_output_name(w->name, MAX_PATH, bank, stream, w->error), "%s", w->error);
+            stats_stop(cfg->stats, STATS_OUTPUT_NAME, 1, &timer);
+            CHECK_EXIT(xwb_make_header(&bank->ctx, stream, &w->header, &w->header_size) != XWB_OK, "%s", xwb_error(&bank->ctx));
+
+            /* only sizes can be checked, the data isn't here yet */
+            w->skipped = cfg->resume && file_matches(w->name, w->header, xwb->header_size, infile,
+                    xwb->xwb_streams[stream].stream_offset, xwb->xwb_streams[stream].stream_size, 0, w->buf, w->buf_size);
+            print_stream_lines(&jobs, job, w->name, w->skipped);
+
+            /* skipped outputs still follow the chunks when checksumming, just without a file */
+            if (init_sums(bank, stream))
+                checksum_update(&bank->sums[stream], w->header, xwb->header_size);
+            else if (w->skipped)
+                continue;
+
+            outfd = -1;
+            if (!w->skipped) {
+                outfd = create_file(w->name, cfg->overwrite);
+                CHECK_EXIT(outfd < 0 && errno == EEXIST, "ERROR: filename exists in path");
+                CHECK_EXIT(outfd < 0, "ERROR: output open failed");
+
+                write_bytes(outfd, w->header, xwb->header_size);
             }
-            if (xwb->extra2_offset && xwb->extra2_size) {//XACT2: ENTRYNAMES
-                put_32bit_s(xwb->extra2_offset + num_stream*xwb->name_elem_size, off+0x10, outfile);
-                put_32bit_s(xwb->name_elem_size, off+0x14, outfile);
+
+            open_streams[open_count] = stream;
+            open_fds[open_count] = outfd;
+            open_started[open_count] = timer.wall;
+            open_count++;
+        }
+
+        /* give each open stream its part of the chunk, and close the finished ones */
+        for (i = 0; i < open_count; ) {
+            xwb_stream * s = &(xwb->xwb_streams[open_streams[i]]);
+            off_t start = s->stream_offset > pos ? s->stream_offset : pos;
+            off_t end = s->stream_offset + s->stream_size;
+            off_t part_end = end > chunk_end ? chunk_end : end;
+
+            if (part_end > start) {
+                if (bank->sums)
+                    checksum_update(&bank->sums[open_streams[i]], chunk + (start - pos), part_end - start);
+                if (open_fds[i] >= 0)
+                    write_bytes(open_fds[i], chunk + (start - pos), part_end - start);
             }
-            off += 0x18;
-        } else {
-            if (xwb->extra1_offset && xwb->extra1_size) {//XACT3: SEEKTABLES
-                //0x08, 0x0c: no idea
+
+            if (end > chunk_end) {
+                i++;
+                continue;
             }
-            if (xwb->extra2_offset && xwb->extra2_size) {//XACT3: ENTRYNAMES
-                put_32bit_s(xwb->extra2_offset + num_stream*xwb->name_elem_size, off+0x10, outfile);//XACT2: EXTRA
-                put_32bit_s(xwb->name_elem_size, off+0x14, outfile);
+
+            if (open_fds[i] >= 0)
+                close_file(open_fds[i]);
+
+            /* open while the data streamed in, so mostly waiting for the pipe */
+            if (cfg->stats) {
+                stats_stop(cfg->stats, STATS_WRITE, 1, &timer);
+                stats_stream(cfg->stats, timer.wall - open_started[i]);
             }
-            off += 0x18;
+
+            open_count--;
+            open_streams[i] = open_streams[open_count];
+            open_fds[i] = open_fds[open_count];
+            open_started[i] = open_started[open_count];
         }
 
+        if (next == jobs.jobs_count && open_count == 0)
+            break;
 
-        /* ENTRYWAVEDATA segment */
-        //put_32bit_s(xwb->data_offset, off+0x00, outfile);
-        put_32bit_s(s->stream_size, off+0x04, outfile);
+        pos = chunk_end;
+        chunk = w->buf;
+        chunk_size = read_bytes(infile->fd, w->buf, w->buf_size);
+        CHECK_EXIT(chunk_size == 0, "ERROR: unexpected end of .xwb data");
+    }
 
-        /* stream entry, now at offset 0 */
-        off = xwb->entry_offset + num_stream*xwb->entry_elem_size;
-        if (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) {
-            put_32bit_s(0, off+0x00, outfile);
-        } else {
-            put_32bit_s(0, off+0x08, outfile);
+    stats_stop(cfg->stats, STATS_WRITE, 0, &timer);
+
+    print_skipped(jobs.skipped);
+    free_jobs(&jobs);
+    free(starts);
+    free(open_streams);
+    free(open_fds);
+    free(open_started);
+}
+
+/**
+ * Writes (or lists) all streams of all banks with the configured method.
+ */
+static void write_streams(xwb_bank * banks, int banks_count, xwb_config * cfg) {
+    xwb_worker worker;
+    int i, j, skipped = 0;
+
+    if (!cfg->list_only && cfg->output == OUTPUT_MANIFEST) {
+        for (i = 0; i < banks_count; i++) {
+            write_manifest(&banks[i]);
         }
+        return;
+    }
+
+    if (!cfg->list_only && cfg->streaming) {
+        write_streams_single_pass(banks);
+        return;
+    }
 
-        /* use extra space in the base flags to store original num_stream and extra flag to identify split XWBs
-         *  (better to tell them apart when bugfixing) */
-        put_32bit_s(xwb->base_flags | 0x00008000 | ((num_stream>0xFF? 0xFF : num_stream)<<24), xwb->base_offset, outfile);
-        put_32bit_s(1, xwb->base_offset+0x04, outfile); /* only 1 stream now */
+    /* .txtp are tiny, only split files and .wav are worth the parallel writers */
+    if (!cfg->list_only && (cfg->output == OUTPUT_SPLIT || cfg->output == OUTPUT_RIFF)) {
+        if (cfg->output == OUTPUT_SPLIT && cfg->uring_depth > 0 && write_streams_uring(banks, banks_count, cfg->uring_depth))
+            return;
 
-        //todo offset to seek tables 
-        // format: 
-        // - stream X has N ints
-        // - when int is less than prev: new stream Y
+        if (cfg->threads > 1) {
+            write_streams_parallel(banks, banks_count, cfg->threads);
+            return;
+        }
     }
-    else {
-        /* creates a new header ignoring extra tables, less tested */
-        off_t new_entry_offset, new_data_offset;
-        size_t new_data_size;
-        xwb_stream *s = &(xwb->xwb_streams[num_stream]);
 
-        void (*put_32bit)(uint32_t, FILE *) = NULL;
-        uint32_t (*read_32bit)(long,FILE*) = NULL;
+    memset(&worker,0,sizeof(xwb_worker));
+    worker.buf_size = DUMP_BUF;
+    worker.buf = malloc(worker.buf_size);
+    CHECK_EXIT(!worker.buf, "ERROR: out of memory");
 
-        if (xwb->little_endian) {
-            put_32bit = put_32_le;
-            read_32bit = read_32bitLE;
-        } else {
-            put_32bit = put_32_be;
-            read_32bit = read_32bitBE;
+    for (i = 0; i < banks_count; i++) {
+        for (j = 0; j < banks[i].selected_count; j++) {
+            CHECK_EXIT(!write_stream(&banks[i], banks[i].selected[j], &worker), "%s", worker.error);
+            skipped += worker.skipped;
         }
+    }
+
+    print_skipped(skipped);
+
+    free(worker.buf);
+    free(worker.header);
+}
+
+/**
+ * Splits many banks in one go. Banks are parsed in groups and the streams of each group are
+ * written together, so the thread pool doesn't go idle between banks.
+ * Banks that fail to open or parse are reported and skipped, returns how many.
+ */
+static int write_batch(xwb_config * cfg) {
+    char ** names = NULL;
+    int names_count = 0;
+    xwb_bank * banks;
+    char error[MAX_ERROR];
+    int first, i, j;
+    int total_banks = 0, total_streams = 0, total_unnamed = 0, total_failed = 0;
+    uint64_t total_bytes = 0;
+
+    /* expand dirs */
+    for (i = 0; i < cfg->inputs_count; i++) {
+        find_files(cfg->inputs[i], ".xwb", &names, &names_count);
+    }
+    CHECK_EXIT(names_count == 0, "ERROR: no .xwb found");
+
+    banks = calloc(BATCH_BANKS, sizeof(xwb_bank));
+    CHECK_EXIT(!banks, "ERROR: out of memory");
+
+    for (first = 0; first < names_count; first += BATCH_BANKS) {
+        int group_count = names_count - first, banks_count = 0;
+        if (group_count > BATCH_BANKS)
+            group_count = BATCH_BANKS;
+
+        /* parse group (serially, to keep messages in order) */
+        for (i = 0; i < group_count; i++) {
+            xwb_bank * bank = &banks[banks_count];
+
+            memset(bank,0,sizeof(xwb_bank));
+            bank->cfg = *cfg;
+            bank->cfg.archive_members = 0; /* added back to cfg once written */
+            CHECK_EXIT(strlen(names[first+i]) >= MAX_PATH, "ERROR: buffer overflow");
+            strcpy(bank->cfg.xwb_name, names[first+i]);
+
+            printf("Bank %s\n", bank->cfg.xwb_name);
+            if (!open_bank(bank, error)) {
+                close_bank(bank);
+                printf("%s, skipped\n", error);
+                total_failed++;
+                continue;
+            }
 
-        new_entry_offset = xwb->base_offset + xwb->base_size;
-        new_data_offset = new_entry_offset + xwb->entry_elem_size;  /*xwb->data_offset*/
-        new_data_size = s->stream_size;
-        if (xwb->is_stardew_valley) {
-            new_data_size = xwb->data_size;
+            /* names are loaded at this point */
+            reader_close(bank->ctx.xsb_file);
+            bank->ctx.xsb_file = NULL;
+
+            if (!prepare_output(bank, error)) {
+                close_bank(bank);
+                printf("%s, skipped\n", error);
+                total_failed++;
+                continue;
+            }
+
+            banks_count++;
+            total_banks++;
+            total_streams += bank->selected_count;
+            if (bank->cfg.ignore_xsb_name && !cfg->ignore_xsb_name)
+                total_unnamed++;
+            for (j = 0; j < bank->selected_count; j++) {
+                total_bytes += bank->ctx.xwb.xwb_streams[bank->selected[j]].stream_size;
+            }
         }
 
+        if (!banks_count)
+            continue;
 
-        /* copy base header */
-        dump(cfg->xwb_file, outfile, 0x0, xwb->version <= XACT2_2_MAX ? 0x08 : 0x0c);
-
-        put_32bit(xwb->base_offset, outfile);//BANKDATA
-        put_32bit(xwb->base_size, outfile);
-        put_32bit(new_entry_offset, outfile);//ENTRYMETADATA
-        put_32bit(xwb->entry_elem_size, outfile); /* single entry size */
-
-        /* other segments */
-        if (xwb->version <= XACT1_1_MAX) {
-            put_32bit(0, outfile);//XACT1: ENTRYNAMES //todo
-            put_32bit(0, outfile);
-            put_32bit(new_data_offset, outfile);//ENTRYWAVEDATA
-            put_32bit(new_data_size, outfile); /* single entry data size */
-        } else if (xwb->version <= XACT2_2_MAX) {
-            put_32bit(0, outfile);//XACT2: ENTRYNAMES//todo
-            put_32bit(0, outfile);
-            put_32bit(0, outfile);//XACT2: EXTRA//todo
-            put_32bit(0, outfile);
-            put_32bit(new_data_offset, outfile);//ENTRYWAVEDATA
-            put_32bit(new_data_size, outfile); /* single entry data size */
-        } else {
-            put_32bit(0, outfile);//XACT3: SEEKTABLES//XWMA/XMA seek tables (not needed, though)
-            put_32bit(0, outfile);
-            put_32bit(0, outfile);//XACT3: ENTRYNAMES//todo
-            put_32bit(0, outfile);
-            put_32bit(new_data_offset, outfile);//ENTRYWAVEDATA
-            put_32bit(new_data_size, outfile); /* single entry data size */
+        printf("Writting streams...\n");
+
+        write_streams(banks, banks_count, cfg);
+
+        for (i = 0; i < banks_count; i++) {
+            write_checksums(&banks[i]);
+            cfg->archive_members += banks[i].cfg.archive_members;
+            close_bank(&banks[i]);
         }
+    }
+
+    printf("Batch done: %i banks, %i streams, %"PRIu64" bytes of stream data", total_banks, total_streams, total_bytes);
+    if (total_unnamed)
+        printf(" (%i banks without .xsb)", total_unnamed);
+    printf("\n");
+    if (total_failed)
+        fprintf(stderr, "ERROR: %i banks failed\n", total_failed);
+
+    for (i = 0; i < names_count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(banks);
+    return total_failed;
+}
 
-        /* copy base entry */
-        dump(cfg->xwb_file, outfile, xwb->base_offset, xwb->base_size);
+/**
+ * Case insensitive, as file names on Windows (where XACT names the .xwb after the wavebank)
+ */
+static int same_name(const char * a, const char * b) {
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
 
-        /* main entry */
-        dump(cfg->xwb_file, outfile, xwb->entry_offset + num_stream*xwb->entry_elem_size, xwb->entry_elem_size);
+/**
+ * Finds the .xsb wavebank (1=first) of an .xwb: the one named like the bank inside the .xwb, or like
+ * the file. If the .xsb has no wavebank names, the only one with as many sounds as the .xwb has streams.
+ * Returns -1 if not found.
+ */
+static int find_wavebank(const xwb_header * sb, reader * xwb_file, const char * xwb_name) {
+    char bank_name[0x40+1];
+    char stem[MAX_PATH];
+    int i, named = 0, found = 0, streams_count;
 
-        /* main stream data */
-        dump(cfg->xwb_file, outfile, s->stream_offset, s->stream_size);
+    if (xwb_get_bank_info(xwb_file, bank_name, sizeof(bank_name), &streams_count) != XWB_OK)
+        return -1;
+    strip_ext(stem, MAX_PATH, strip_path(xwb_name));
 
+    for (i = 0; i < sb->xsb_wavebanks_count; i++) {
+        if (!sb->xsb_wavebanks[i].name[0])
+            continue;
+        named = 1;
+        if (bank_name[0] && same_name(sb->xsb_wavebanks[i].name, bank_name))
+            return i+1;
+    }
+    for (i = 0; i < sb->xsb_wavebanks_count; i++) {
+        if (sb->xsb_wavebanks[i].name[0] && same_name(sb->xsb_wavebanks[i].name, stem))
+            return i+1;
+    }
 
-        /* at the end to avoid FILE pos jumping around */
+    if (sb->xsb_wavebanks_count == 1)
+        return 1;
+    if (named)
+        return -1;
 
-        /* use extra space in the base flags to store original num_stream and extra flag to identify split XWBs
-         *  (better to tell them apart when bugfixing) */
-        put_32bit_s(xwb->base_flags | 0x00008000 | ((num_stream>0xFF? 0xFF : num_stream)<<24), xwb->base_offset, outfile);
-        put_32bit_s(1, xwb->base_offset+0x04, outfile); /* only 1 stream now */
+    for (i = 0; i < sb->xsb_wavebanks_count; i++) {
+        if (sb->xsb_wavebanks[i].sound_count != streams_count)
+            continue;
+        if (found)
+            return -1;
+        found = i+1;
+    }
+    return found ? found : -1;
+}
 
-        /* change starting offset to 0 */
-        if (xwb->base_flags & WAVEBANK_FLAGS_COMPACT) { /* compact entry */
-            /* read original compact entry and remove 21b of sector offset, leaving size_deviation */
-            uint32_t entry = (uint32_t)read_32bit((xwb->entry_offset + num_stream*xwb->entry_elem_size)+0x00, cfg->xwb_file);
-            entry = (entry & 0xFFE00000);
+/**
+ * Splits every wavebank of a multi .xsb (-X). The .xsb is parsed once and shared by all banks, and
+ * the streams of every bank are written together like a batch group.
+ */
+static void write_soundbank(xwb_config * cfg) {
+    xwb_context xsb;
+    xwb_header * sb = &xsb.xwb;
+    xwb_options opts;
+    char ** names = NULL;
+    int names_count = 0;
+    xwb_bank * banks;
+    int banks_count = 0;
+    char path[MAX_PATH], stem[MAX_PATH], name[MAX_PATH];
+    char error[MAX_ERROR];
+    int i, j, ret;
+    int total_streams = 0, total_missing = 0;
+    uint64_t total_bytes = 0;
+
+    get_options(cfg, &opts);
+    ret = xwb_open_xsb(&xsb, cfg->soundbank_name, &opts);
+    CHECK_EXIT(ret != XWB_OK, "%s", xwb_error(&xsb));
+    stats_add(cfg->stats, STATS_PARSE_XSB, 1, xsb.times.xsb_wall, xsb.times.xsb_cpu);
+
+    printf("Soundbank %s: %i wavebanks\n", cfg->soundbank_name, (int)sb->xsb_wavebanks_count);
+    for (i = 0; i < sb->xsb_wavebanks_count; i++) {
+        printf("Wavebank %i%s%s%s: %i sounds\n", i, sb->xsb_wavebanks[i].name[0] ? " (" : "", sb->xsb_wavebanks[i].name, sb->xsb_wavebanks[i].name[0] ? ")" : "", (int)sb->xsb_wavebanks[i].sound_count);
+    }
 
-            put_32bit_s(entry, new_entry_offset+0x00, outfile);
+    /* the given .xwb, or the wavebanks' own (name).xwb next to the .xsb */
+    if (cfg->inputs_count) {
+        for (i = 0; i < cfg->inputs_count; i++) {
+            find_files(cfg->inputs[i], ".xwb", &names, &names_count);
         }
-        else {
-            put_32bit_s(0, new_entry_offset+0x08, outfile);
+    }
+    else {
+        names = calloc(sb->xsb_wavebanks_count + 1, sizeof(char *));
+        CHECK_EXIT(!names, "ERROR: out of memory");
+        strip_filename(path, MAX_PATH, cfg->soundbank_name);
+        strip_ext(stem, MAX_PATH, cfg->soundbank_name);
+
+        for (i = 0; i < sb->xsb_wavebanks_count; i++) {
+            if (sb->xsb_wavebanks[i].name[0])
+                ret = snprintf(name,MAX_PATH,"%s%s.xwb", path, sb->xsb_wavebanks[i].name);
+            else if (sb->xsb_wavebanks_count == 1)
+                ret = snprintf(name,MAX_PATH,"%s.xwb", stem);
+            else
+                continue;
+            CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+            names[names_count] = malloc(strlen(name) + 1);
+            CHECK_EXIT(!names[names_count], "ERROR: out of memory");
+            strcpy(names[names_count], name);
+            names_count++;
         }
     }
 
+    banks = calloc(sb->xsb_wavebanks_count, sizeof(xwb_bank));
+    CHECK_EXIT(!banks, "ERROR: out of memory");
+
+    /* parse (serially, to keep messages in order) */
+    for (i = 0; i < names_count; i++) {
+        xwb_bank * bank = &banks[banks_count];
+        reader * xwb_file;
+        int wavebank;
+
+        xwb_file = reader_open(names[i], 1);
+        if (!xwb_file) {
+            printf("Bank %s not found, skipped\n", names[i]);
+            continue;
+        }
+
+        wavebank = find_wavebank(sb, xwb_file, names[i]);
+        for (j = 0; j < banks_count && wavebank > 0; j++) {
+            if (banks[j].cfg.selected_wavebank == wavebank)
+                break;
+        }
+        if (wavebank < 0 || j < banks_count || !sb->xsb_wavebanks[wavebank-1].sound_count) {
+            printf("Bank %s %s, skipped\n", names[i], wavebank < 0 ? "doesn't match a wavebank of the .xsb" : (j < banks_count ? "is a wavebank already split" : "has no sounds in the .xsb"));
+            reader_close(xwb_file);
+            continue;
+        }
 
-    ret = fclose(outfile);
-    CHECK_EXIT(ret == EOF, "ERROR: fclose outfile");
+        memset(bank,0,sizeof(xwb_bank));
+        bank->cfg = *cfg;
+        bank->cfg.archive_members = 0; /* added back to cfg once written */
+        CHECK_EXIT(strlen(names[i]) >= MAX_PATH, "ERROR: buffer overflow");
+        strcpy(bank->cfg.xwb_name, names[i]);
+        bank->cfg.selected_wavebank = wavebank;
+
+        printf("Bank %s\n", bank->cfg.xwb_name);
+        CHECK_EXIT(!parse_bank(bank, xwb_file, NULL, &xsb, error), "%s", error);
+        CHECK_EXIT(!prepare_output(bank, error), "%s", error);
+
+        banks_count++;
+        total_streams += bank->selected_count;
+        for (j = 0; j < bank->selected_count; j++) {
+            total_bytes += bank->ctx.xwb.xwb_streams[bank->selected[j]].stream_size;
+        }
+    }
+
+    /* wavebanks without sounds are common (unused or streamed elsewhere) */
+    for (i = 0; i < sb->xsb_wavebanks_count; i++) {
+        if (!sb->xsb_wavebanks[i].sound_count)
+            continue;
+        for (j = 0; j < banks_count; j++) {
+            if (banks[j].cfg.selected_wavebank == i+1)
+                break;
+        }
+        if (j == banks_count) {
+            printf("Wavebank %i has no .xwb, skipped\n", i);
+            total_missing++;
+        }
+    }
+
+    if (banks_count) {
+        printf("Writting streams...\n");
+        write_streams(banks, banks_count, cfg);
+    }
+
+    for (i = 0; i < banks_count; i++) {
+        write_checksums(&banks[i]);
+        cfg->archive_members += banks[i].cfg.archive_members;
+        close_bank(&banks[i]);
+    }
+    xwb_close(&xsb);
+
+    printf("Soundbank done: %i banks, %i streams, %"PRIu64" bytes of stream data", banks_count, total_streams, total_bytes);
+    if (total_missing)
+        printf(" (%i wavebanks without .xwb)", total_missing);
+    printf("\n");
+
+    for (i = 0; i < names_count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(banks);
 }
 
-static void get_output_name(char * buf_path, char * buf_name, int buf_size, xwb_header * xwb, xwb_config * cfg, int num_stream) {
-    char base[MAX_PATH];
+/**
+ * Resolves the output path once, so writing a stream doesn't need to.
+ */
+static void resolve_output(xwb_config * cfg) {
     char path[MAX_PATH];
-    char prefix[MAX_PATH];
     int ret;
 
-    strip_ext(base, MAX_PATH, strip_path(cfg->xwb_name));
+    strip_ext(cfg->out_base, MAX_PATH, strip_path(cfg->xwb_name));
     strip_filename(path, MAX_PATH, cfg->xwb_name);
 
-    ret = snprintf(buf_path,buf_size,"%s%s%c", path,base,DIRSEP);
-    CHECK_EXIT(ret >= buf_size, "ERROR buffer overflow");
+    ret = snprintf(cfg->out_path,MAX_PATH,"%s%s%c", path,cfg->out_base,DIRSEP);
+    CHECK_EXIT(ret >= MAX_PATH, "ERROR buffer overflow");
+}
+
+/**
+ * Makes the stream's output name. Returns 0 on errors, with the message in error (MAX_ERROR).
+ */
+static int get_output_name(char * buf_name, int buf_size, xwb_bank * bank, int num_stream, char * error) {
+    xwb_config * cfg = &bank->cfg;
+    xwb_header * xwb = &bank->ctx.xwb;
+    char prefix[MAX_PATH];
+    const char * buf_path = cfg->out_path;
+    int ret;
 
     if (cfg->short_prefix)
         ret = snprintf(prefix,buf_size,"%03d", num_stream);
     else
-        ret = snprintf(prefix,buf_size,"%s_%03d", base,num_stream);
-    CHECK_EXIT(ret >= buf_size, "ERROR buffer overflow");
+        ret = snprintf(prefix,buf_size,"%s_%03d", cfg->out_base,num_stream);
+    CHECK_FAIL(error, ret >= buf_size, "ERROR buffer overflow");
 
 
     if (cfg->ignore_xsb_xwb_name) {
-        ret = snprintf(buf_name,buf_size,"%s%s.xwb", buf_path, prefix);
-        CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer overflow");
+        ret = snprintf(buf_name,buf_size,"%s%s.%s", buf_path, prefix, cfg->out_ext);
+        CHECK_FAIL(error, ret >= MAX_PATH, "ERROR: buffer overflow");
     }
     else if (cfg->ignore_xsb_name) {
-        char xwb_name[MAX_PATH];
-        xwb_name[0] = '\0';
-
         /* try to get the internal name */
-        if (xwb->names_offset && xwb->names_size && xwb->name_elem_size) {
-            get_bytes_seek(xwb->names_offset + num_stream*xwb->name_elem_size, cfg->xwb_file, (unsigned char *)xwb_name, xwb->name_elem_size);
-            xwb_name[xwb->name_elem_size] = '\0'; /* just in case */
-        }
+        const char * xwb_name = xwb->xwb_streams[num_stream].name;
 
-        if (strlen(xwb_name)) {
+        if (xwb_name && xwb_name[0] != '\0') {
             if (cfg->no_prefix) {
-                ret = snprintf(buf_name,buf_size,"%s%s.xwb", buf_path, xwb_name);
+                ret = snprintf(buf_name,buf_size,"%s%s.%s", buf_path, xwb_name, cfg->out_ext);
             } else {
-                ret = snprintf(buf_name,buf_size,"%s%s__%s.xwb", buf_path, prefix, xwb_name);
+                ret = snprintf(buf_name,buf_size,"%s%s__%s.%s", buf_path, prefix, xwb_name, cfg->out_ext);
             }
         } else {
-            ret = snprintf(buf_name,buf_size,"%s%s.xwb", buf_path, prefix);
+            ret = snprintf(buf_name,buf_size,"%s%s.%s", buf_path, prefix, cfg->out_ext);
         }
 
-        CHECK_EXIT(ret >= MAX_PATH, "ERROR: buffer name overflow");
+        CHECK_FAIL(error, ret >= MAX_PATH, "ERROR: buffer name overflow");
     }
     else {
-        int i = 0;
-        char xsb_name[MAX_PATH];
-        off_t off = 0;
-        int start_sound = cfg->start_sound ? cfg->start_sound-1 : 0;
-
-        /* get name offset */
-        for (i = start_sound; i < xwb->xsb_sounds_count; i++) {
-            xsb_sound *s = &(xwb->xsb_sounds[i]);
-            if (s->wavebank == cfg->selected_wavebank-1
-                    && s->stream_index == num_stream){
-                off = s->name_offset;
-                break;
-            }
-        }
-
-        if (cfg->debug) printf("XSB n.off=%08lx\n", off);
+        char unknown_name[MAX_PATH];
+        const char * xsb_name = xwb->xwb_streams[num_stream].name;
+        off_t off = xwb->xwb_streams[num_stream].name_offset;
 
-        CHECK_EXIT(!cfg->ignore_names_not_found && off == 0, "ERROR: XSB name not found for stream %i, use -n to ignore", num_stream);
+        if (cfg->debug) printf("XSB n.off=%08"PRIx64"\n", (uint64_t)off);
 
-        if (off) {
-            /* read null-terminated name at offset */
-            for (i = 0; i < MAX_PATH; i++) {
-                xsb_name[i] = get_byte_seek(off, cfg->xsb_file);
-                if (xsb_name[i] == '\0')
-                    break;
+        CHECK_FAIL(error, !cfg->ignore_names_not_found && off == 0, "ERROR: XSB name not found for stream %i, use -n to ignore", num_stream);
 
-                off += 1;
-            }
-        }
-        else {
-            ret = snprintf(xsb_name,buf_size,"(unknown_%03i)", num_stream);
+        if (!off) {
+            ret = snprintf(unknown_name,buf_size,"(unknown_%03i)", num_stream);
+            xsb_name = unknown_name;
         }
 
         if (cfg->no_prefix) {
-            ret = snprintf(buf_name,buf_size,"%s%s.xwb", buf_path, xsb_name);
+            ret = snprintf(buf_name,buf_size,"%s%s.%s", buf_path, xsb_name, cfg->out_ext);
         } else {
-            ret = snprintf(buf_name,buf_size,"%s%s__%s.xwb", buf_path, prefix,xsb_name);
+            ret = snprintf(buf_name,buf_size,"%s%s__%s.%s", buf_path, prefix,xsb_name, cfg->out_ext);
         }
-        CHECK_EXIT(ret >= buf_size, "buffer name overflow");
+        CHECK_FAIL(error, ret >= buf_size, "buffer name overflow");
+    }
+    return 1;
+}
+
+/**
+ * Opens the archive before any bank is written. Writing it to stdout moves stdout to stderr,
+ * so the usual messages don't end up inside the tar.
+ */
+static void open_archive(xwb_config * cfg) {
+    cfg->archive_mtime = time(NULL);
+
+    if (strcmp(cfg->archive_name, "-") == 0) {
+        cfg->archive_fd = take_stdout();
+        CHECK_EXIT(cfg->archive_fd < 0, "ERROR: can't write archive to stdout");
+        return;
     }
+
+    cfg->archive_fd = create_file(cfg->archive_name, cfg->overwrite);
+    CHECK_EXIT(cfg->archive_fd < 0 && errno == EEXIST, "ERROR: archive exists (use -o to overwrite)");
+    CHECK_EXIT(cfg->archive_fd < 0, "ERROR: archive open failed");
+}
+
+static void close_archive(xwb_config * cfg) {
+    if (!cfg->archive_name || cfg->list_only)
+        return;
+
+    tar_end(cfg->archive_fd);
+    close_file(cfg->archive_fd);
+    printf("Archive: %s, %i streams\n", cfg->archive_name, cfg->archive_members);
+}
+
+/**
+ * Reports and saves the fingerprints, once every bank is written.
+ */
+static void close_dedup(xwb_config * cfg) {
+    uint64_t bytes_saved;
+    int linked;
+
+    if (!cfg->dedup_store)
+        return;
+
+    dedup_stats(cfg->dedup_store, &linked, &bytes_saved);
+    printf("Linked %i identical streams, %"PRIu64" bytes saved\n", linked, bytes_saved);
+
+    CHECK_EXIT(!dedup_close(cfg->dedup_store), "ERROR: failed saving fingerprint file");
+    cfg->dedup_store = NULL;
 }